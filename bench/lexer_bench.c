@@ -0,0 +1,137 @@
+// Lexer microbenchmark. Lexes a file, or a generated input of the requested
+// size, several times and reports the best throughput.
+//
+// Usage: lexer_bench [--size MB] [--iterations N]
+//                    [--scanner scalar|sse2|avx2] [file]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/lexer.h"
+
+// A chunk of code exercising comments, identifiers, keywords, literals and
+// operators in roughly the proportions of generated sources.
+static const char *const sample =
+    "// Generated helper\n"
+    "/* Computes a running checksum over the\n"
+    "   values produced by the generator */\n"
+    "int checksum_accumulator_step(int previous_value, int next_value) {\n"
+    "    int scaled_next_value = next_value * 31 + 17;\n"
+    "    if (previous_value >= scaled_next_value && next_value != 0) {\n"
+    "        previous_value = previous_value - scaled_next_value / 2;\n"
+    "    } else {\n"
+    "        previous_value = previous_value + scaled_next_value;\n"
+    "    }\n"
+    "    while (previous_value > 1000000) {\n"
+    "        previous_value = previous_value - 999983;\n"
+    "    }\n"
+    "    printf(\"step: %d %d\\n\", previous_value, next_value);\n"
+    "    return previous_value;\n"
+    "}\n\n";
+
+static double now_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char *generate_input(size_t size, size_t *length) {
+  size_t sample_len = strlen(sample);
+  char *input = malloc(size + sample_len + 1);
+  size_t pos = 0;
+  while (pos < size) {
+    memcpy(input + pos, sample, sample_len);
+    pos = pos + sample_len;
+  }
+  input[pos] = '\0';
+  *length = pos;
+  return input;
+}
+
+static char *read_input(const char *filename, size_t *length) {
+  FILE *file = fopen(filename, "r");
+  if (!file) {
+    fprintf(stderr, "Error: could not open file '%s'\n", filename);
+    exit(1);
+  }
+  fseek(file, 0, SEEK_END);
+  *length = ftell(file);
+  rewind(file);
+  char *input = malloc(*length + 1);
+  *length = fread(input, 1, *length, file);
+  input[*length] = '\0';
+  fclose(file);
+  return input;
+}
+
+int main(int argc, char *argv[]) {
+  size_t size_mb = 64;
+  int iterations = 5;
+  const char *filename = NULL;
+
+  int i = 1;
+  while (i < argc) {
+    if (strcmp(argv[i], "--size") == 0 && i + 1 < argc) {
+      size_mb = atoi(argv[i + 1]);
+      i++;
+    } else if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc) {
+      iterations = atoi(argv[i + 1]);
+      i++;
+    } else if (strcmp(argv[i], "--scanner") == 0 && i + 1 < argc) {
+      int scanner = SCANNER_AUTO;
+      if (strcmp(argv[i + 1], "scalar") == 0) {
+        scanner = SCANNER_SCALAR;
+      } else if (strcmp(argv[i + 1], "sse2") == 0) {
+        scanner = SCANNER_SSE2;
+      } else if (strcmp(argv[i + 1], "avx2") == 0) {
+        scanner = SCANNER_AVX2;
+      }
+      if (!set_scanner(scanner)) {
+        fprintf(stderr, "Error: scanner '%s' is not supported\n", argv[i + 1]);
+        return 1;
+      }
+      i++;
+    } else {
+      filename = argv[i];
+    }
+    i++;
+  }
+
+  size_t length;
+  char *input = filename ? read_input(filename, &length)
+                         : generate_input(size_mb * 1024 * 1024, &length);
+
+  double best = 0;
+  int token_count = 0;
+  int iteration = 0;
+  while (iteration < iterations) {
+    struct Arena arena;
+    arena_init(&arena);
+    struct Lexer lexer;
+    struct Token token;
+    int status;
+    double start = now_seconds();
+    init_lexer(&lexer, input, length, &arena);
+    token_count = 0;
+    while ((status = next_token(&lexer, &token)) > 0) {
+      token_count++;
+    }
+    if (status < 0) {
+      return 1;
+    }
+    double elapsed = now_seconds() - start;
+    arena_free(&arena);
+    if (iteration == 0 || elapsed < best) {
+      best = elapsed;
+    }
+    iteration++;
+  }
+
+  double mb = length / (1024.0 * 1024.0);
+  printf("%.1f MB, %d tokens, best of %d: %.3f s, %.1f MB/s\n", mb,
+         token_count, iterations, best, mb / best);
+  free(input);
+  return 0;
+}
@@ -0,0 +1,261 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Region allocator used by the compiler phases. Allocations are bump-pointer
+// carved out of large blocks and are never freed individually; the whole
+// arena is released at once with arena_free.
+
+#define ARENA_BLOCK_SIZE 65536
+#define ARENA_ALIGNMENT 16
+// Allocations at least this large get a block of their own so they don't
+// waste the tail of the current block and can be grown with realloc.
+#define ARENA_LARGE_ALLOCATION 16384
+
+struct ArenaBlock {
+  struct ArenaBlock *next;
+  size_t size; // Usable bytes after the header
+  size_t used;
+};
+
+struct Arena {
+  struct ArenaBlock *blocks; // Current block first
+  size_t reserved;           // Total bytes obtained from malloc
+};
+
+// Arenas for each compiler phase. Tokens, AST nodes, symbols and instructions
+// all live until the compilation is done and are released together with
+// free_compiler_arenas.
+struct CompilerArenas {
+  struct Arena lex;
+  struct Arena parse;
+  struct Arena ast; // Flat AST, outlives the parser's pointer AST
+  struct Arena sema;
+  struct Arena codegen;
+  struct Arena function; // The function being compiled with --stream
+};
+
+static size_t arena_align(size_t size) {
+  return (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+}
+
+static char *arena_block_data(struct ArenaBlock *block) {
+  return (char *)block + arena_align(sizeof(struct ArenaBlock));
+}
+
+void arena_init(struct Arena *arena) {
+  arena->blocks = NULL;
+  arena->reserved = 0;
+}
+
+static struct ArenaBlock *arena_new_block(struct Arena *arena, size_t size) {
+  struct ArenaBlock *block =
+      malloc(arena_align(sizeof(struct ArenaBlock)) + size);
+  if (!block) {
+    fprintf(stderr, "Error: memory allocation failed\n");
+    exit(1);
+  }
+  block->size = size;
+  block->used = 0;
+  arena->reserved = arena->reserved + size;
+  return block;
+}
+
+// Allocate size bytes, aligned to ARENA_ALIGNMENT. The memory is not zeroed.
+void *arena_alloc(struct Arena *arena, size_t size) {
+  size = arena_align(size);
+
+  if (size >= ARENA_LARGE_ALLOCATION) {
+    // Dedicated block, linked behind the current block so the current block
+    // stays available for small allocations.
+    struct ArenaBlock *block = arena_new_block(arena, size);
+    block->used = size;
+    if (arena->blocks) {
+      block->next = arena->blocks->next;
+      arena->blocks->next = block;
+    } else {
+      block->next = NULL;
+      arena->blocks = block;
+    }
+    return arena_block_data(block);
+  }
+
+  struct ArenaBlock *block = arena->blocks;
+  if (!block || block->size - block->used < size) {
+    block = arena_new_block(arena, ARENA_BLOCK_SIZE);
+    block->next = arena->blocks;
+    arena->blocks = block;
+  }
+  void *ptr = arena_block_data(block) + block->used;
+  block->used = block->used + size;
+  return ptr;
+}
+
+void *arena_calloc(struct Arena *arena, size_t size) {
+  void *ptr = arena_alloc(arena, size);
+  memset(ptr, 0, size);
+  return ptr;
+}
+
+// Grow an allocation. Large allocations own their block and are resized with
+// realloc; the most recent small allocation is extended in place; anything
+// else is copied into a fresh allocation.
+void *arena_realloc(struct Arena *arena, void *ptr, size_t old_size,
+                    size_t new_size) {
+  if (!ptr) {
+    return arena_alloc(arena, new_size);
+  }
+  old_size = arena_align(old_size);
+  new_size = arena_align(new_size);
+  if (new_size <= old_size) {
+    return ptr;
+  }
+
+  if (old_size >= ARENA_LARGE_ALLOCATION) {
+    struct ArenaBlock **link = &arena->blocks;
+    while (*link && arena_block_data(*link) != ptr) {
+      link = &(*link)->next;
+    }
+    if (*link) {
+      struct ArenaBlock *next = (*link)->next;
+      struct ArenaBlock *block =
+          realloc(*link, arena_align(sizeof(struct ArenaBlock)) + new_size);
+      if (!block) {
+        fprintf(stderr, "Error: memory allocation failed\n");
+        exit(1);
+      }
+      arena->reserved = arena->reserved + new_size - block->size;
+      block->size = new_size;
+      block->used = new_size;
+      block->next = next;
+      *link = block;
+      return arena_block_data(block);
+    }
+  }
+
+  struct ArenaBlock *block = arena->blocks;
+  if (block && new_size < ARENA_LARGE_ALLOCATION &&
+      arena_block_data(block) + block->used == (char *)ptr + old_size &&
+      block->size - block->used >= new_size - old_size) {
+    block->used = block->used + new_size - old_size;
+    return ptr;
+  }
+
+  void *new_ptr = arena_alloc(arena, new_size);
+  memcpy(new_ptr, ptr, old_size);
+  return new_ptr;
+}
+
+char *arena_strndup(struct Arena *arena, const char *str, size_t len) {
+  char *copy = arena_alloc(arena, len + 1);
+  memcpy(copy, str, len);
+  copy[len] = '\0';
+  return copy;
+}
+
+char *arena_strdup(struct Arena *arena, const char *str) {
+  return arena_strndup(arena, str, strlen(str));
+}
+
+// Release every block owned by the arena. The arena can be reused afterwards.
+void arena_free(struct Arena *arena) {
+  struct ArenaBlock *block = arena->blocks;
+  while (block) {
+    struct ArenaBlock *next = block->next;
+    free(block);
+    block = next;
+  }
+  arena->blocks = NULL;
+  arena->reserved = 0;
+}
+
+// Move every block of from into arena, which then releases them. Allocations
+// made from either arena stay valid; from is left empty.
+void arena_adopt(struct Arena *arena, struct Arena *from) {
+  struct ArenaBlock *last = from->blocks;
+  if (!last) {
+    return;
+  }
+  while (last->next) {
+    last = last->next;
+  }
+  // The current block of arena stays first so it is still allocated from
+  if (arena->blocks) {
+    last->next = arena->blocks->next;
+    arena->blocks->next = from->blocks;
+  } else {
+    arena->blocks = from->blocks;
+  }
+  arena->reserved = arena->reserved + from->reserved;
+  from->blocks = NULL;
+  from->reserved = 0;
+}
+
+// Release everything allocated from the arena but keep one block for the
+// allocations that follow, so an arena reused in a loop stays at the size of
+// its largest round instead of growing with the total.
+void arena_reset(struct Arena *arena) {
+  struct ArenaBlock *kept = NULL;
+  struct ArenaBlock *block = arena->blocks;
+  while (block) {
+    struct ArenaBlock *next = block->next;
+    if (!kept && block->size == ARENA_BLOCK_SIZE) {
+      kept = block;
+    } else {
+      free(block);
+    }
+    block = next;
+  }
+  arena->blocks = kept;
+  arena->reserved = 0;
+  if (kept) {
+    kept->next = NULL;
+    kept->used = 0;
+    arena->reserved = kept->size;
+  }
+}
+
+// Explicit stacks for the iterative tree walkers. A stack starts out in a
+// small array owned by the caller and moves to the heap once it outgrows it,
+// so shallow trees need no allocation. Returns the (possibly moved) frames.
+void *stack_grow(void *frames, void *inline_frames, int *capacity,
+                 size_t size) {
+  void *grown = malloc(*capacity * 2 * size);
+  if (!grown) {
+    fprintf(stderr, "Error: memory allocation failed\n");
+    exit(1);
+  }
+  memcpy(grown, frames, *capacity * size);
+  if (frames != inline_frames) {
+    free(frames);
+  }
+  *capacity = *capacity * 2;
+  return grown;
+}
+
+void stack_free(void *frames, void *inline_frames) {
+  if (frames != inline_frames) {
+    free(frames);
+  }
+}
+
+void init_compiler_arenas(struct CompilerArenas *arenas) {
+  arena_init(&arenas->lex);
+  arena_init(&arenas->parse);
+  arena_init(&arenas->ast);
+  arena_init(&arenas->sema);
+  arena_init(&arenas->codegen);
+  arena_init(&arenas->function);
+}
+
+void free_compiler_arenas(struct CompilerArenas *arenas) {
+  arena_free(&arenas->lex);
+  arena_free(&arenas->parse);
+  arena_free(&arenas->ast);
+  arena_free(&arenas->sema);
+  arena_free(&arenas->codegen);
+  arena_free(&arenas->function);
+}
@@ -0,0 +1,225 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "common.h"
+#include "fail.h"
+#include "intern.h"
+
+// Lowering of the parser's pointer AST into the flat AST walked by sema and
+// codegen (see struct FlatAST in common.h).
+
+// Grow an arena-backed array so it can hold one more element
+static void *flat_reserve(struct Arena *arena, void *array, int count,
+                          int *capacity, size_t size) {
+  if (count < *capacity) {
+    return array;
+  }
+  int new_capacity = *capacity == 0 ? 64 : *capacity * 2;
+  array = arena_realloc(arena, array, *capacity * size, new_capacity * size);
+  *capacity = new_capacity;
+  return array;
+}
+
+// Append a node and return its index. Its end is set by flat_close once its
+// children have been added.
+static int flat_open(struct FlatAST *ast, int kind, int data) {
+  if (ast->count >= ast->capacity) {
+    int capacity = ast->capacity == 0 ? 1024 : ast->capacity * 2;
+    ast->kinds = arena_realloc(ast->arena, ast->kinds, ast->capacity,
+                               capacity);
+    ast->data = arena_realloc(ast->arena, ast->data,
+                              ast->capacity * sizeof(int),
+                              capacity * sizeof(int));
+    ast->ends = arena_realloc(ast->arena, ast->ends,
+                              ast->capacity * sizeof(int),
+                              capacity * sizeof(int));
+    ast->capacity = capacity;
+  }
+  int index = ast->count++;
+  ast->kinds[index] = kind;
+  ast->data[index] = data;
+  ast->ends[index] = index + 1;
+  return index;
+}
+
+static void flat_close(struct FlatAST *ast, int index) {
+  ast->ends[index] = ast->count;
+}
+
+// Work items of the flattening walk, which keeps its own stack so that deep
+// nesting and long else-if chains don't recurse
+#define FLATTEN_NODE 0  // Lower node with its subtree
+#define FLATTEN_BLOCK 1 // Lower the statement list starting at node
+#define FLATTEN_CLOSE 2 // The subtree of flat node index is complete
+
+struct FlattenItem {
+  int action;
+  struct ASTNode *node;
+  int index;
+};
+
+struct FlattenStack {
+  struct FlattenItem *items;
+  int count;
+  int capacity;
+  struct FlattenItem inline_items[64];
+};
+
+static void flatten_push(struct FlattenStack *stack, int action,
+                         struct ASTNode *node, int index) {
+  if (stack->count == stack->capacity) {
+    stack->items = stack_grow(stack->items, stack->inline_items,
+                              &stack->capacity, sizeof(struct FlattenItem));
+  }
+  struct FlattenItem *item = &stack->items[stack->count++];
+  item->action = action;
+  item->node = node;
+  item->index = index;
+}
+
+// Push the nodes of a list so that the first one is lowered first
+static void flatten_push_list(struct FlattenStack *stack,
+                              struct ASTNode *list) {
+  int first = stack->count;
+  while (list) {
+    flatten_push(stack, FLATTEN_NODE, list, 0);
+    list = list->next;
+  }
+  int last = stack->count - 1;
+  while (first < last) {
+    struct FlattenItem item = stack->items[first];
+    stack->items[first] = stack->items[last];
+    stack->items[last] = item;
+    first++;
+    last--;
+  }
+}
+
+// Add node to the flat AST and push its children, last child first
+static void flatten_node(struct FlatAST *ast, struct FlattenStack *stack,
+                         struct ASTNode *node) {
+  int index;
+  if (node->type == NODE_FUNCTION_DECLARATION) {
+    ast->functions =
+        flat_reserve(ast->arena, ast->functions, ast->function_count,
+                     &ast->function_capacity, sizeof(struct FlatFunction));
+    struct FlatFunction *function = &ast->functions[ast->function_count];
+    function->name = node->function_decl.name;
+    function->return_type = node->function_decl.return_type;
+    function->param_count = node->function_decl.param_count;
+    function->symbol = node->function_decl.symbol;
+    function->parameters = arena_alloc(
+        ast->arena, function->param_count * sizeof(struct FunctionParameter));
+    if (function->param_count > 0) {
+      memcpy(function->parameters, node->function_decl.parameters,
+             function->param_count * sizeof(struct FunctionParameter));
+    }
+    index = flat_open(ast, NODE_FUNCTION_DECLARATION, ast->function_count++);
+    flatten_push(stack, FLATTEN_CLOSE, NULL, index);
+    flatten_push(stack, FLATTEN_BLOCK, node->function_decl.body, 0);
+  } else if (node->type == NODE_VARIABLE_DECLARATION) {
+    ast->variables =
+        flat_reserve(ast->arena, ast->variables, ast->variable_count,
+                     &ast->variable_capacity, sizeof(struct FlatVariable));
+    struct FlatVariable *variable = &ast->variables[ast->variable_count];
+    variable->name = node->var_decl.name;
+    variable->datatype = node->var_decl.datatype;
+    variable->stack_offset = node->var_decl.stack_offset;
+    index = flat_open(ast, NODE_VARIABLE_DECLARATION, ast->variable_count++);
+    flatten_push(stack, FLATTEN_CLOSE, NULL, index);
+    if (node->var_decl.value) {
+      flatten_push(stack, FLATTEN_NODE, node->var_decl.value, 0);
+    }
+  } else if (node->type == NODE_IDENTIFIER) {
+    ast->variables =
+        flat_reserve(ast->arena, ast->variables, ast->variable_count,
+                     &ast->variable_capacity, sizeof(struct FlatVariable));
+    struct FlatVariable *variable = &ast->variables[ast->variable_count];
+    variable->name = node->identifier.name;
+    variable->datatype = node->identifier.datatype;
+    variable->stack_offset = node->identifier.stack_offset;
+    flat_open(ast, NODE_IDENTIFIER, ast->variable_count++);
+  } else if (node->type == NODE_STRING_LITERAL) {
+    ast->strings =
+        flat_reserve(ast->arena, ast->strings, ast->string_count,
+                     &ast->string_capacity, sizeof(char *));
+    ast->strings[ast->string_count] =
+        arena_strdup(ast->arena, node->string_literal.value);
+    flat_open(ast, NODE_STRING_LITERAL, ast->string_count++);
+  } else if (node->type == NODE_INTEGER_LITERAL) {
+    flat_open(ast, NODE_INTEGER_LITERAL, node->int_literal.value);
+  } else if (node->type == NODE_BINARY_OPERATION) {
+    index = flat_open(ast, NODE_BINARY_OPERATION, node->binary_op.operator);
+    flatten_push(stack, FLATTEN_CLOSE, NULL, index);
+    flatten_push(stack, FLATTEN_NODE, node->binary_op.right, 0);
+    flatten_push(stack, FLATTEN_NODE, node->binary_op.left, 0);
+  } else if (node->type == NODE_FUNCTION_CALL) {
+    index = flat_open(ast, NODE_FUNCTION_CALL, node->func_call.name);
+    flatten_push(stack, FLATTEN_CLOSE, NULL, index);
+    flatten_push_list(stack, node->func_call.arguments);
+  } else if (node->type == NODE_RETURN_STATEMENT) {
+    index = flat_open(ast, NODE_RETURN_STATEMENT, 0);
+    flatten_push(stack, FLATTEN_CLOSE, NULL, index);
+    flatten_push(stack, FLATTEN_NODE, node->return_stmt.value, 0);
+  } else if (node->type == NODE_ASSIGNMENT) {
+    index = flat_open(ast, NODE_ASSIGNMENT, 0);
+    flatten_push(stack, FLATTEN_CLOSE, NULL, index);
+    flatten_push(stack, FLATTEN_NODE, node->assignment.value, 0);
+    flatten_push(stack, FLATTEN_NODE, node->assignment.target, 0);
+  } else if (node->type == NODE_IF_STATEMENT) {
+    // The else block is only present if the statement has one
+    index = flat_open(ast, NODE_IF_STATEMENT, 0);
+    flatten_push(stack, FLATTEN_CLOSE, NULL, index);
+    if (node->if_stmt.else_body) {
+      flatten_push(stack, FLATTEN_BLOCK, node->if_stmt.else_body, 0);
+    }
+    flatten_push(stack, FLATTEN_BLOCK, node->if_stmt.body, 0);
+    flatten_push(stack, FLATTEN_NODE, node->if_stmt.condition, 0);
+  } else if (node->type == NODE_WHILE_STATEMENT) {
+    index = flat_open(ast, NODE_WHILE_STATEMENT, 0);
+    flatten_push(stack, FLATTEN_CLOSE, NULL, index);
+    flatten_push(stack, FLATTEN_BLOCK, node->while_stmt.body, 0);
+    flatten_push(stack, FLATTEN_NODE, node->while_stmt.condition, 0);
+  } else {
+    fprintf(stderr, "flatten_node: unhandled node type %d\n", node->type);
+    fail_compilation();
+  }
+}
+
+// Lower the list of functions returned by parse. Everything the flat AST
+// refers to is copied into arena, so the parser's arena can be released
+// afterwards.
+struct FlatAST *flatten_ast(struct ASTNode *program, struct Arena *arena) {
+  struct FlatAST *ast = arena_calloc(arena, sizeof(struct FlatAST));
+  ast->arena = arena;
+  struct FlattenStack stack;
+  stack.items = stack.inline_items;
+  stack.count = 0;
+  stack.capacity = 64;
+
+  int root = flat_open(ast, NODE_PROGRAM, 0);
+  flatten_push(&stack, FLATTEN_CLOSE, NULL, root);
+  flatten_push_list(&stack, program);
+
+  while (stack.count > 0) {
+    struct FlattenItem item = stack.items[--stack.count];
+    if (item.action == FLATTEN_CLOSE) {
+      flat_close(ast, item.index);
+    } else if (item.action == FLATTEN_BLOCK) {
+      // A statement list becomes a NODE_BLOCK whose children are the
+      // statements
+      int block = flat_open(ast, NODE_BLOCK, 0);
+      flatten_push(&stack, FLATTEN_CLOSE, NULL, block);
+      flatten_push_list(&stack, item.node);
+    } else {
+      flatten_node(ast, &stack, item.node);
+    }
+  }
+
+  stack_free(stack.items, stack.inline_items);
+  return ast;
+}
@@ -0,0 +1,350 @@
+#pragma once
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// Cache of compiled assembly on disk, like ccache. An entry is named after
+// the SHA-256 of the compiler's build, the options that change the output
+// and the source text, so a source that was compiled before with the same
+// compiler and options is answered by copying the entry out. Entries are
+// written to a temporary file and renamed into place, so a reader never sees
+// a partial one and compilers can share a directory. The modification time
+// of an entry is its last use; once the entries add up to more than the size
+// limit the least recently used ones are removed.
+
+// Hash of the compiler's sources, set by CMake. A build without it shares
+// its entries with every other such build.
+#ifndef COMPILER_SOURCE_HASH
+#define COMPILER_SOURCE_HASH "unknown"
+#endif
+
+// Changes whenever the compiler's sources do
+#define CACHE_BUILD "selfhost_compiler " COMPILER_SOURCE_HASH
+
+#define CACHE_DEFAULT_LIMIT (256LL << 20) // Bytes the entries may take up
+
+// Seconds after which a temporary file is taken to be left over by a
+// compiler that was killed before renaming it into place
+#define CACHE_STALE_TEMPORARY 600
+
+// Length of an entry's name: the hash in hex and ".s"
+#define CACHE_NAME_LENGTH 66
+
+struct Sha256 {
+  uint32_t state[8];
+  uint64_t length; // Bytes hashed so far
+  unsigned char block[64];
+  int used; // Bytes in block
+};
+
+static const uint32_t sha256_constants[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+#define SHA256_ROTATE(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256_block(struct Sha256 *sha, const unsigned char *block) {
+  uint32_t w[64];
+  int i = 0;
+  while (i < 16) {
+    w[i] = (uint32_t)block[4 * i] << 24 | (uint32_t)block[4 * i + 1] << 16 |
+           (uint32_t)block[4 * i + 2] << 8 | (uint32_t)block[4 * i + 3];
+    i++;
+  }
+  while (i < 64) {
+    uint32_t s0 = SHA256_ROTATE(w[i - 15], 7) ^ SHA256_ROTATE(w[i - 15], 18) ^
+                  (w[i - 15] >> 3);
+    uint32_t s1 = SHA256_ROTATE(w[i - 2], 17) ^ SHA256_ROTATE(w[i - 2], 19) ^
+                  (w[i - 2] >> 10);
+    w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    i++;
+  }
+
+  uint32_t a = sha->state[0], b = sha->state[1], c = sha->state[2],
+           d = sha->state[3], e = sha->state[4], f = sha->state[5],
+           g = sha->state[6], h = sha->state[7];
+  i = 0;
+  while (i < 64) {
+    uint32_t s1 =
+        SHA256_ROTATE(e, 6) ^ SHA256_ROTATE(e, 11) ^ SHA256_ROTATE(e, 25);
+    uint32_t choose = (e & f) ^ (~e & g);
+    uint32_t t1 = h + s1 + choose + sha256_constants[i] + w[i];
+    uint32_t s0 =
+        SHA256_ROTATE(a, 2) ^ SHA256_ROTATE(a, 13) ^ SHA256_ROTATE(a, 22);
+    uint32_t majority = (a & b) ^ (a & c) ^ (b & c);
+    uint32_t t2 = s0 + majority;
+    h = g;
+    g = f;
+    f = e;
+    e = d + t1;
+    d = c;
+    c = b;
+    b = a;
+    a = t1 + t2;
+    i++;
+  }
+  sha->state[0] += a;
+  sha->state[1] += b;
+  sha->state[2] += c;
+  sha->state[3] += d;
+  sha->state[4] += e;
+  sha->state[5] += f;
+  sha->state[6] += g;
+  sha->state[7] += h;
+}
+
+void sha256_init(struct Sha256 *sha) {
+  static const uint32_t initial[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372,
+                                      0xa54ff53a, 0x510e527f, 0x9b05688c,
+                                      0x1f83d9ab, 0x5be0cd19};
+  memcpy(sha->state, initial, sizeof(initial));
+  sha->length = 0;
+  sha->used = 0;
+}
+
+void sha256_update(struct Sha256 *sha, const void *data, size_t length) {
+  const unsigned char *bytes = data;
+  sha->length += length;
+  // Whole blocks are hashed straight from data
+  if (sha->used == 0) {
+    while (length >= 64) {
+      sha256_block(sha, bytes);
+      bytes += 64;
+      length -= 64;
+    }
+  }
+  while (length > 0) {
+    size_t count = 64 - sha->used;
+    if (count > length) {
+      count = length;
+    }
+    memcpy(sha->block + sha->used, bytes, count);
+    sha->used += count;
+    bytes += count;
+    length -= count;
+    if (sha->used == 64) {
+      sha256_block(sha, sha->block);
+      sha->used = 0;
+    }
+  }
+}
+
+void sha256_final(struct Sha256 *sha, unsigned char digest[32]) {
+  uint64_t bits = sha->length * 8;
+  unsigned char padding[72] = {0x80};
+  // Pad to 56 bytes past a block boundary, then add the length in bits
+  size_t count = (sha->used < 56 ? 56 : 120) - sha->used;
+  int i = 0;
+  while (i < 8) {
+    padding[count + i] = bits >> (56 - 8 * i);
+    i++;
+  }
+  sha256_update(sha, padding, count + 8);
+  i = 0;
+  while (i < 8) {
+    digest[4 * i] = sha->state[i] >> 24;
+    digest[4 * i + 1] = sha->state[i] >> 16;
+    digest[4 * i + 2] = sha->state[i] >> 8;
+    digest[4 * i + 3] = sha->state[i];
+    i++;
+  }
+}
+
+// Name of the entry for source compiled with the options described by
+// config, written to name as a NUL terminated string
+void cache_entry_name(const char *config, const char *source, size_t length,
+                      char name[CACHE_NAME_LENGTH + 1]) {
+  struct Sha256 sha;
+  sha256_init(&sha);
+  // The terminators keep the fields apart
+  sha256_update(&sha, CACHE_BUILD, sizeof(CACHE_BUILD));
+  sha256_update(&sha, config, strlen(config) + 1);
+  sha256_update(&sha, source, length);
+  unsigned char digest[32];
+  sha256_final(&sha, digest);
+
+  static const char hex[] = "0123456789abcdef";
+  int i = 0;
+  while (i < 32) {
+    name[2 * i] = hex[digest[i] >> 4];
+    name[2 * i + 1] = hex[digest[i] & 15];
+    i++;
+  }
+  memcpy(name + 64, ".s", 3);
+}
+
+// Write the whole file open as fd to the file descriptor output. Returns 1
+// after reporting an error if it could not be written.
+int cache_copy(int fd, int output) {
+  struct stat info;
+  if (fstat(fd, &info) != 0) {
+    fprintf(stderr, "Error: could not read cache entry: %s\n",
+            strerror(errno));
+    return 1;
+  }
+  if (info.st_size == 0) {
+    return 0;
+  }
+  const char *data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (data == MAP_FAILED) {
+    fprintf(stderr, "Error: could not read cache entry: %s\n",
+            strerror(errno));
+    return 1;
+  }
+  off_t written = 0;
+  int error = 0;
+  while (written < info.st_size && !error) {
+    ssize_t count = write(output, data + written, info.st_size - written);
+    if (count < 0) {
+      if (errno != EINTR) {
+        error = errno;
+      }
+    } else {
+      written = written + count;
+    }
+  }
+  munmap((void *)data, info.st_size);
+  if (error) {
+    fprintf(stderr, "Error: could not write output: %s\n", strerror(error));
+    return 1;
+  }
+  return 0;
+}
+
+// Write the entry named name in the cache directory dir to output and mark
+// it as used. Returns 1 if there was one, 0 if there was none, and -1 after
+// reporting an error if the output could not be written.
+int cache_fetch(const char *dir, const char *name, int output) {
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s/%s", dir, name);
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return 0;
+  }
+  int result = cache_copy(fd, output) ? -1 : 1;
+  futimens(fd, NULL);
+  close(fd);
+  return result;
+}
+
+// Create a temporary file in the cache directory dir for an entry that is
+// being compiled, storing its name in path. Returns the file descriptor, or
+// -1 if the directory cannot be written.
+int cache_create(const char *dir, char path[PATH_MAX]) {
+  snprintf(path, PATH_MAX, "%s/tmp.XXXXXX", dir);
+  int fd = mkstemp(path);
+  if (fd >= 0) {
+    fchmod(fd, 0644);
+  }
+  return fd;
+}
+
+struct CacheEntry {
+  char name[CACHE_NAME_LENGTH + 1];
+  struct timespec used;
+  off_t size;
+};
+
+static int compare_cache_entries(const void *a, const void *b) {
+  const struct CacheEntry *left = a;
+  const struct CacheEntry *right = b;
+  if (left->used.tv_sec != right->used.tv_sec) {
+    return left->used.tv_sec < right->used.tv_sec ? -1 : 1;
+  }
+  return (left->used.tv_nsec > right->used.tv_nsec) -
+         (left->used.tv_nsec < right->used.tv_nsec);
+}
+
+// Remove the least recently used entries of the cache directory dir until
+// the rest take up at most limit bytes, and any stale temporary files
+static void cache_evict(const char *dir, long long limit) {
+  DIR *directory = opendir(dir);
+  if (!directory) {
+    return;
+  }
+  time_t now = time(NULL);
+  int count = 0;
+  int capacity = 64;
+  struct CacheEntry *entries = malloc(capacity * sizeof(struct CacheEntry));
+  if (!entries) {
+    fprintf(stderr, "Error: memory allocation failed\n");
+    exit(1);
+  }
+  long long total = 0;
+  struct dirent *file;
+  while ((file = readdir(directory))) {
+    const char *name = file->d_name;
+    size_t length = strlen(name);
+    struct stat info;
+    if (strncmp(name, "tmp.", 4) == 0) {
+      if (fstatat(dirfd(directory), name, &info, 0) == 0 &&
+          now - info.st_mtime > CACHE_STALE_TEMPORARY) {
+        unlinkat(dirfd(directory), name, 0);
+      }
+      continue;
+    }
+    if (length != CACHE_NAME_LENGTH || strcmp(name + 64, ".s") != 0 ||
+        fstatat(dirfd(directory), name, &info, 0) != 0) {
+      continue;
+    }
+    if (count == capacity) {
+      capacity = capacity * 2;
+      entries = realloc(entries, capacity * sizeof(struct CacheEntry));
+      if (!entries) {
+        fprintf(stderr, "Error: memory allocation failed\n");
+        exit(1);
+      }
+    }
+    memcpy(entries[count].name, name, CACHE_NAME_LENGTH + 1);
+    entries[count].used = info.st_mtim;
+    entries[count].size = info.st_size;
+    total = total + info.st_size;
+    count++;
+  }
+
+  if (total > limit) {
+    qsort(entries, count, sizeof(struct CacheEntry), compare_cache_entries);
+    int i = 0;
+    while (i < count && total > limit) {
+      // Another compiler may have removed it already
+      unlinkat(dirfd(directory), entries[i].name, 0);
+      total = total - entries[i].size;
+      i++;
+    }
+  }
+  free(entries);
+  closedir(directory);
+}
+
+// Move the temporary file at path into place as the entry named name, then
+// keep the cache directory dir within limit bytes. The temporary file is
+// removed if it cannot be renamed.
+void cache_store(const char *dir, const char *path, const char *name,
+                 long long limit) {
+  char entry[PATH_MAX];
+  snprintf(entry, sizeof(entry), "%s/%s", dir, name);
+  if (rename(path, entry) != 0) {
+    unlink(path);
+    return;
+  }
+  cache_evict(dir, limit);
+}
@@ -1,5 +1,12 @@
+#include "arena.h"
+#include "ast.h"
 #include "common.h"
+#include "fail.h"
+#include "intern.h"
+#include "workers.h"
 #include <assert.h>
+#include <setjmp.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -19,50 +26,58 @@ static const int TEMP_REGS[] = {
 };
 
 // Create a new assembly program
-struct Assembly *create_assembly() {
-  struct Assembly *assembly = malloc(sizeof(struct Assembly));
+struct Assembly *create_assembly(struct Arena *arena) {
+  struct Assembly *assembly = arena_alloc(arena, sizeof(struct Assembly));
+  assembly->arena = arena;
   assembly->sections = NULL;
   assembly->extern_symbols = NULL;
   assembly->extern_count = 0;
   assembly->string_literals = NULL;
+  assembly->string_labels = 0;
+  assembly->if_labels = 0;
+  assembly->while_labels = 0;
+  assembly->logic_labels = 0;
   return assembly;
 }
 
 // Add an external symbol
 void add_extern_symbol(struct Assembly *assembly, const char *symbol) {
+  assembly->extern_symbols = arena_realloc(
+      assembly->arena, assembly->extern_symbols,
+      assembly->extern_count * sizeof(char *),
+      (assembly->extern_count + 1) * sizeof(char *));
   assembly->extern_count++;
-  assembly->extern_symbols = realloc(assembly->extern_symbols,
-                                     assembly->extern_count * sizeof(char *));
-  assembly->extern_symbols[assembly->extern_count - 1] = strdup(symbol);
+  assembly->extern_symbols[assembly->extern_count - 1] =
+      arena_strdup(assembly->arena, symbol);
 }
 
 // Create a new section
-struct Section *create_section(const char *name) {
-  struct Section *section = malloc(sizeof(struct Section));
-  section->name = strdup(name);
+struct Section *create_section(struct Arena *arena, const char *name) {
+  struct Section *section = arena_alloc(arena, sizeof(struct Section));
+  section->arena = arena;
+  section->name = arena_strdup(arena, name);
   section->instructions = NULL;
+  section->count = 0;
+  section->capacity = 0;
   section->next = NULL;
   return section;
 }
 
-// Add an instruction to a section
+// Add an instruction to the end of a section
 void add_instruction(struct Section *section, int type, struct Operand op1,
                      struct Operand op2) {
-  struct Instruction *instr = malloc(sizeof(struct Instruction));
+  if (section->count == section->capacity) {
+    int capacity = section->capacity == 0 ? 256 : section->capacity * 2;
+    section->instructions = arena_realloc(
+        section->arena, section->instructions,
+        section->capacity * sizeof(struct Instruction),
+        capacity * sizeof(struct Instruction));
+    section->capacity = capacity;
+  }
+  struct Instruction *instr = &section->instructions[section->count++];
   instr->type = type;
   instr->op1 = op1;
   instr->op2 = op2;
-  instr->next = NULL;
-
-  if (!section->instructions) {
-    section->instructions = instr;
-  } else {
-    struct Instruction *last = section->instructions;
-    while (last->next) {
-      last = last->next;
-    }
-    last->next = instr;
-  }
 }
 
 // Helper functions to create operands
@@ -83,15 +98,23 @@ struct Operand mem_operand(int base_reg, int offset) {
   return op;
 }
 
-struct Operand label_operand(const char *label) {
+// Label operand for label number id of the given LABEL_* kind
+struct Operand label_operand(int kind, int id) {
   struct Operand op = {.type = OPERAND_LABEL};
-  op.label = strdup(label);
+  op.label.kind = kind;
+  op.label.id = id;
   return op;
 }
 
-struct Operand rip_label_operand(const char *label) {
+// Label operand naming an interned identifier, such as a function name
+struct Operand name_operand(int name) {
+  return label_operand(LABEL_NAME, name);
+}
+
+struct Operand rip_label_operand(int kind, int id) {
   struct Operand op = {.type = OPERAND_RIP_LABEL};
-  op.label = strdup(label);
+  op.label.kind = kind;
+  op.label.id = id;
   return op;
 }
 
@@ -100,14 +123,59 @@ struct Operand empty_operand() {
   return op;
 }
 
-char *add_string_literal(struct Assembly *assembly, const char *value) {
-  static int string_counter = 0;
-  char label[32];
-  snprintf(label, sizeof(label), ".LC%d", string_counter++);
+// Low byte of a 64-bit register
+static int byte_register(int reg) {
+  if (reg == REG_RCX)
+    return REG_CL;
+  if (reg == REG_RDX)
+    return REG_DL;
+  if (reg == REG_RSI)
+    return REG_SIL;
+  if (reg == REG_RDI)
+    return REG_DIL;
+  if (reg == REG_R8)
+    return REG_R8B;
+  if (reg == REG_R9)
+    return REG_R9B;
+  if (reg == REG_R10)
+    return REG_R10B;
+  if (reg == REG_R11)
+    return REG_R11B;
+  return REG_AL;
+}
+
+// Load the variable of the given type at offset from RBP into reg. Values
+// narrower than a register are sign extended.
+static void load_variable(struct Section *text, struct Type *type, int offset,
+                          int reg) {
+  if (type && type->size == 1) {
+    add_instruction(text, INSTR_MOVSX, mem_operand(REG_RBP, offset),
+                    reg_operand(reg));
+  } else {
+    add_instruction(text, INSTR_MOV, mem_operand(REG_RBP, offset),
+                    reg_operand(reg));
+  }
+}
 
-  struct StringLiteral *str = malloc(sizeof(struct StringLiteral));
-  str->label = strdup(label);
-  str->value = strdup(value);
+// Store reg into the variable of the given type at offset from RBP, writing
+// only as many bytes as the type has
+static void store_variable(struct Section *text, struct Type *type, int offset,
+                           int reg) {
+  if (type && type->size == 1) {
+    add_instruction(text, INSTR_MOV_BYTE, reg_operand(byte_register(reg)),
+                    mem_operand(REG_RBP, offset));
+  } else {
+    add_instruction(text, INSTR_MOV, reg_operand(reg),
+                    mem_operand(REG_RBP, offset));
+  }
+}
+
+// Add a string to the data section and return the number of its label
+int add_string_literal(struct Assembly *assembly, const char *value) {
+  struct StringLiteral *str =
+      arena_alloc(assembly->arena, sizeof(struct StringLiteral));
+  str->label = assembly->string_labels++;
+  str->value = arena_strdup(assembly->arena, value);
   str->next = assembly->string_literals;
   assembly->string_literals = str;
 
@@ -143,7 +211,7 @@ static int allocate_register(struct CodegenContext *ctx) {
   }
   // Fallback if we run out of registers:
   fprintf(stderr, "Ran out of registers for expression.\n");
-  exit(1);
+  fail_compilation();
 }
 
 // Frees a register so it can be used again.
@@ -153,308 +221,533 @@ static void free_register(struct CodegenContext *ctx, int reg) {
 
 // --------------------- Unified Expression Generation
 // ------------------------------- Instead of special per-node code in each
-// place, we define one function that recursively generates code for any
-// expression and returns the reg holding the final result.
-
-static int generate_expression(struct Section *text, struct ASTNode *node,
-                               struct Symbol *func, struct Assembly *assembly,
-                               struct CodegenContext *ctx);
-
-// Implementation of generate_expression:
-static int generate_expression(struct Section *text, struct ASTNode *node,
-                               struct Symbol *func, struct Assembly *assembly,
-                               struct CodegenContext *ctx) {
-  assert(node && "generate_expression: node cannot be null");
-
-  // Integer literal
-  if (node->type == NODE_INTEGER_LITERAL) {
-    int r = allocate_register(ctx);
-    add_instruction(text, INSTR_MOV, imm_operand(node->int_literal.value),
-                    reg_operand(r));
-    return r;
-  }
-
-  // Identifier
-  else if (node->type == NODE_IDENTIFIER) {
-    // Use the stack offset stored in the AST node during semantic analysis
-    int r = allocate_register(ctx);
-    add_instruction(text, INSTR_MOV,
-                    mem_operand(REG_RBP, node->identifier.stack_offset),
-                    reg_operand(r));
-    return r;
-  }
-
-  // String literal
-  else if (node->type == NODE_STRING_LITERAL) {
-    // Put string in data section, load it with LEA
-    char *label = add_string_literal(assembly, node->string_literal.value);
-    int r = allocate_register(ctx);
-    add_instruction(text, INSTR_LEA, rip_label_operand(label), reg_operand(r));
-    return r;
-  }
+// place, we define one function that generates code for any expression and
+// returns the reg holding the final result.
+
+// Set instruction for each comparison operator
+static const int comparison_set[] = {
+    [OP_EQUAL] = INSTR_SET_EQ,        [OP_NOT_EQUAL] = INSTR_SET_NE,
+    [OP_LESS] = INSTR_SET_LT,         [OP_LESS_EQUAL] = INSTR_SET_LE,
+    [OP_GREATER] = INSTR_SET_GT,      [OP_GREATER_EQUAL] = INSTR_SET_GE,
+};
 
-  // Function call
-  else if (node->type == NODE_FUNCTION_CALL) {
-    // Save the current usage state.
-    int saved_used[REG_COUNT];
-    memcpy(saved_used, ctx->used, sizeof(saved_used));
-
-    // Push only the *actually in-use* scratch registers, and mark them as free.
-    // We only use caller saved registers as scratch, so we can push all of
-    // them.
-    int i = 0;
-    while (i < REG_COUNT) {
-      if (ctx->used[i]) {
-        add_instruction(text, INSTR_PUSH, reg_operand(i + 1), empty_operand());
-        ctx->used[i] = 0;
+// Combine the evaluated operands of an arithmetic or comparison operator and
+// return the register holding the result.
+static int generate_binary(struct Section *text, int op, int left_reg,
+                           int right_reg, struct CodegenContext *ctx) {
+  // Perform the operation
+  switch (op) {
+  case OP_ADD:
+    add_instruction(text, INSTR_ADD, reg_operand(right_reg),
+                    reg_operand(left_reg));
+    break;
+
+  case OP_SUBTRACT:
+    add_instruction(text, INSTR_SUB, reg_operand(right_reg),
+                    reg_operand(left_reg));
+    break;
+
+  case OP_MULTIPLY:
+    add_instruction(text, INSTR_MUL, reg_operand(right_reg),
+                    reg_operand(left_reg));
+    break;
+
+  case OP_DIVIDE: {
+    // 1. If RDX is used for some *other* expression (not left or right),
+    //    then we need to move that occupant out of RDX so we can safely zero
+    //    RDX. We'll check if ctx->used[REG_RDX - 1] == 1 but RDX is NOT
+    //    (left_reg) and NOT (right_reg).
+    if (ctx->used[REG_RDX - 1] == 1) {
+      if (left_reg != REG_RDX && right_reg != REG_RDX) {
+        // Some other temp is in RDX, so we must move it out.
+        int spare = allocate_register(ctx);
+        add_instruction(text, INSTR_MOV, reg_operand(REG_RDX),
+                        reg_operand(spare));
+        // Now we have that occupant in 'spare', so we can free RDX.
+        free_register(ctx, REG_RDX);
       }
-      i++;
     }
 
-    // Evaluate arguments left to right pushing them into reg_args
-    int reg_args[] = {REG_RDI, REG_RSI, REG_RDX, REG_RCX, REG_R8, REG_R9};
-    struct ASTNode *arg = node->func_call.arguments;
-    int arg_count = 0;
-    while (arg && arg_count < 6) {
-      int r = generate_expression(text, arg, func, assembly, ctx);
-      if (reg_args[arg_count] != r) {
-        add_instruction(text, INSTR_MOV, reg_operand(r),
-                        reg_operand(reg_args[arg_count]));
-      }
-      // Free the temporary holding this argument.
-      free_register(ctx, r);
-
-      // Mark this argument register as used so it doesn't get reused when
-      // evaluating the next argument
-      ctx->used[reg_args[arg_count] - 1] = 1;
-      arg = arg->next;
-      arg_count++;
+    // 2. If the left operand is in RDX, we can move it straight to RAX.
+    //    That way, we're not losing its value when we zero RDX.
+    if (left_reg == REG_RDX) {
+      add_instruction(text, INSTR_MOV, reg_operand(REG_RDX),
+                      reg_operand(REG_RAX));
+      free_register(ctx, REG_RDX);
+      left_reg = REG_RAX;
     }
-    // Clear AL for variadic calls
-    add_instruction(text, INSTR_MOV, imm_operand(0), reg_operand(REG_RAX));
 
-    // Call the function
-    add_instruction(text, INSTR_CALL, label_operand(node->func_call.name),
-                    empty_operand());
+    // 3. If the right operand is in RDX, we must move it to another temp
+    //    so as not to lose it when we zero RDX.
+    if (right_reg == REG_RDX) {
+      int tmp = allocate_register(ctx);
+      add_instruction(text, INSTR_MOV, reg_operand(REG_RDX),
+                      reg_operand(tmp));
+      free_register(ctx, REG_RDX);
+      right_reg = tmp;
+    }
 
-    // Pop and restore the usage state for all registers we saved.
-    i = REG_COUNT - 1;
-    while (i >= 0) {
-      if (saved_used[i]) {
-        add_instruction(text, INSTR_POP, reg_operand(i + 1), empty_operand());
-      }
-      // Restore usage state exactly as it was before.
-      ctx->used[i] = saved_used[i];
-      i--;
+    // 4. Move 'left' into RAX if it's not already there.
+    //    Then we can free left_reg from the context.
+    if (left_reg != REG_RAX) {
+      add_instruction(text, INSTR_MOV, reg_operand(left_reg),
+                      reg_operand(REG_RAX));
+      free_register(ctx, left_reg);
+    } else {
+      // If left_reg == RAX, we just free it in the context
+      free_register(ctx, left_reg);
     }
 
-    // The returned value is in RAX. We want it in a fresh temporary register.
-    int result_reg = allocate_register(ctx);
+    // 5. Zero out RDX before idiv (RDX:RAX is the dividend).
+    add_instruction(text, INSTR_MOV, imm_operand(0), reg_operand(REG_RDX));
+
+    // 6. Perform IDIV by the right operand → result appears in RAX.
+    add_instruction(text, INSTR_DIV, reg_operand(right_reg), empty_operand());
+
+    // 7. We no longer need the right_reg operand.
+    free_register(ctx, right_reg);
+
+    // 8. The final result is in RAX. Allocate a fresh scratch reg to hold it.
+    int div_res = allocate_register(ctx);
     add_instruction(text, INSTR_MOV, reg_operand(REG_RAX),
+                    reg_operand(div_res));
+    return div_res;
+  }
+
+  case OP_EQUAL:
+  case OP_NOT_EQUAL:
+  case OP_LESS:
+  case OP_LESS_EQUAL:
+  case OP_GREATER:
+  case OP_GREATER_EQUAL: {
+    // Compare left and right values
+    add_instruction(text, INSTR_CMP, reg_operand(right_reg),
+                    reg_operand(left_reg));
+
+    // Set AL to 1 if the comparison holds, 0 otherwise
+    add_instruction(text, comparison_set[op], reg_operand(REG_AL),
+                    empty_operand());
+
+    // Move zero-extended byte to result register
+    int result_reg = allocate_register(ctx);
+    add_instruction(text, INSTR_MOVZX, reg_operand(REG_AL),
                     reg_operand(result_reg));
 
+    free_register(ctx, left_reg);
+    free_register(ctx, right_reg);
     return result_reg;
   }
+  }
 
-  // Binary operation: left op right
-  else if (node->type == NODE_BINARY_OPERATION) {
-    // Depth-first: evaluate left
-    int left_reg =
-        generate_expression(text, node->binary_op.left, func, assembly, ctx);
-    // Evaluate right
-    int right_reg =
-        generate_expression(text, node->binary_op.right, func, assembly, ctx);
-
-    // Perform the operation
-    if (strcmp(node->binary_op.operator, "+") == 0) {
-      add_instruction(text, INSTR_ADD, reg_operand(right_reg),
-                      reg_operand(left_reg));
-    } else if (strcmp(node->binary_op.operator, "-") == 0) {
-      add_instruction(text, INSTR_SUB, reg_operand(right_reg),
-                      reg_operand(left_reg));
-    } else if (strcmp(node->binary_op.operator, "*") == 0) {
-      add_instruction(text, INSTR_MUL, reg_operand(right_reg),
-                      reg_operand(left_reg));
-    } else if (strcmp(node->binary_op.operator, "/") == 0) {
-      // 1. If RDX is used for some *other* expression (not left or right),
-      //    then we need to move that occupant out of RDX so we can safely zero
-      //    RDX. We'll check if ctx->used[REG_RDX - 1] == 1 but RDX is NOT
-      //    (left_reg) and NOT (right_reg).
-      if (ctx->used[REG_RDX - 1] == 1) {
-        if (left_reg != REG_RDX && right_reg != REG_RDX) {
-          // Some other temp is in RDX, so we must move it out.
-          int spare = allocate_register(ctx);
-          add_instruction(text, INSTR_MOV, reg_operand(REG_RDX),
-                          reg_operand(spare));
-          // Now we have that occupant in 'spare', so we can free RDX.
-          free_register(ctx, REG_RDX);
-        }
-      }
+  // For the other operators left_reg now holds the result.
+  free_register(ctx, right_reg);
+  // We keep left_reg as final result
+  return left_reg;
+}
 
-      // 2. If the left operand is in RDX, we can move it straight to RAX.
-      //    That way, we're not losing its value when we zero RDX.
-      if (left_reg == REG_RDX) {
-        add_instruction(text, INSTR_MOV, reg_operand(REG_RDX),
-                        reg_operand(REG_RAX));
-        free_register(ctx, REG_RDX);
-        left_reg = REG_RAX;
-      }
+// Expression node whose children are being generated
+struct ExpressionFrame {
+  int node;
+  int stage; // Number of children generated so far
+  int child; // Next child to generate
+  int reg;   // Register holding the left operand of a binary operation
+  int label; // Label number of && and ||
+  int saved_used[REG_COUNT]; // Register state before a call
+};
 
-      // 3. If the right operand is in RDX, we must move it to another temp
-      //    so as not to lose it when we zero RDX.
-      if (right_reg == REG_RDX) {
-        int tmp = allocate_register(ctx);
-        add_instruction(text, INSTR_MOV, reg_operand(REG_RDX),
-                        reg_operand(tmp));
-        free_register(ctx, REG_RDX);
-        right_reg = tmp;
-      }
+static struct ExpressionFrame *
+push_expression_frame(struct ExpressionFrame *frames,
+                      struct ExpressionFrame *inline_frames, int *count,
+                      int *capacity, int node) {
+  if (*count == *capacity) {
+    frames = stack_grow(frames, inline_frames, capacity,
+                        sizeof(struct ExpressionFrame));
+  }
+  struct ExpressionFrame *frame = &frames[(*count)++];
+  frame->node = node;
+  frame->stage = 0;
+  frame->child = node + 1;
+  return frames;
+}
 
-      // 4. Move 'left' into RAX if it's not already there.
-      //    Then we can free left_reg from the context.
-      if (left_reg != REG_RAX) {
-        add_instruction(text, INSTR_MOV, reg_operand(left_reg),
-                        reg_operand(REG_RAX));
-        free_register(ctx, left_reg);
+// Generate an expression and return the register holding its value, or -1
+// for an assignment. The tree is walked with an explicit stack: a node's
+// frame is revisited after each of its children, with the child's register
+// in result.
+static int generate_expression(struct Section *text, struct FlatAST *ast,
+                               int node, struct Assembly *assembly,
+                               struct CodegenContext *ctx) {
+  int reg_args[] = {REG_RDI, REG_RSI, REG_RDX, REG_RCX, REG_R8, REG_R9};
+  struct ExpressionFrame inline_frames[16];
+  struct ExpressionFrame *frames = inline_frames;
+  int capacity = 16;
+  int count = 0;
+  int result = -1;
+  frames = push_expression_frame(frames, inline_frames, &count, &capacity,
+                                 node);
+
+  while (count > 0) {
+    struct ExpressionFrame *frame = &frames[count - 1];
+    node = frame->node;
+    assert(node < ast->count && "generate_expression: node out of range");
+    int kind = ast->kinds[node];
+
+    // Integer literal
+    if (kind == NODE_INTEGER_LITERAL) {
+      result = allocate_register(ctx);
+      add_instruction(text, INSTR_MOV, imm_operand(ast->data[node]),
+                      reg_operand(result));
+      count = count - 1;
+    }
+
+    // Identifier
+    else if (kind == NODE_IDENTIFIER) {
+      // Use the stack offset stored in the AST during semantic analysis
+      struct FlatVariable *variable = &ast->variables[ast->data[node]];
+      result = allocate_register(ctx);
+      load_variable(text, variable->datatype, variable->stack_offset, result);
+      count = count - 1;
+    }
+
+    // String literal
+    else if (kind == NODE_STRING_LITERAL) {
+      // Put string in data section, load it with LEA
+      int label = add_string_literal(assembly, ast->strings[ast->data[node]]);
+      result = allocate_register(ctx);
+      add_instruction(text, INSTR_LEA, rip_label_operand(LABEL_STRING, label),
+                      reg_operand(result));
+      count = count - 1;
+    }
+
+    // Function call
+    else if (kind == NODE_FUNCTION_CALL) {
+      if (frame->stage == 0) {
+        // Save the current usage state.
+        memcpy(frame->saved_used, ctx->used, sizeof(frame->saved_used));
+
+        // Push only the *actually in-use* scratch registers, and mark them as
+        // free. We only use caller saved registers as scratch, so we can push
+        // all of them.
+        int i = 0;
+        while (i < REG_COUNT) {
+          if (ctx->used[i]) {
+            add_instruction(text, INSTR_PUSH, reg_operand(i + 1),
+                            empty_operand());
+            ctx->used[i] = 0;
+          }
+          i++;
+        }
       } else {
-        // If left_reg == RAX, we just free it in the context
-        free_register(ctx, left_reg);
+        // Move the argument just evaluated into its register
+        int arg_reg = reg_args[frame->stage - 1];
+        if (arg_reg != result) {
+          add_instruction(text, INSTR_MOV, reg_operand(result),
+                          reg_operand(arg_reg));
+        }
+        // Free the temporary holding this argument.
+        free_register(ctx, result);
+
+        // Mark this argument register as used so it doesn't get reused when
+        // evaluating the next argument
+        ctx->used[arg_reg - 1] = 1;
       }
 
-      // 5. Zero out RDX before idiv (RDX:RAX is the dividend).
-      add_instruction(text, INSTR_MOV, imm_operand(0), reg_operand(REG_RDX));
+      // Evaluate arguments left to right
+      if (frame->child < ast->ends[node] && frame->stage < 6) {
+        int arg = frame->child;
+        frame->child = ast->ends[arg];
+        frame->stage++;
+        frames = push_expression_frame(frames, inline_frames, &count,
+                                       &capacity, arg);
+        continue;
+      }
 
-      // 6. Perform IDIV by the right operand → result appears in RAX.
-      add_instruction(text, INSTR_DIV, reg_operand(right_reg), empty_operand());
+      // Clear AL for variadic calls
+      add_instruction(text, INSTR_MOV, imm_operand(0), reg_operand(REG_RAX));
 
-      // 7. We no longer need the right_reg operand.
-      free_register(ctx, right_reg);
+      // Call the function
+      add_instruction(text, INSTR_CALL, name_operand(ast->data[node]),
+                      empty_operand());
 
-      // 8. The final result is in RAX. Allocate a fresh scratch reg to hold it.
-      int div_res = allocate_register(ctx);
+      // Pop and restore the usage state for all registers we saved.
+      int i = REG_COUNT - 1;
+      while (i >= 0) {
+        if (frame->saved_used[i]) {
+          add_instruction(text, INSTR_POP, reg_operand(i + 1),
+                          empty_operand());
+        }
+        // Restore usage state exactly as it was before.
+        ctx->used[i] = frame->saved_used[i];
+        i--;
+      }
+
+      // The returned value is in RAX. We want it in a fresh temporary
+      // register.
+      result = allocate_register(ctx);
       add_instruction(text, INSTR_MOV, reg_operand(REG_RAX),
-                      reg_operand(div_res));
-      return div_res;
-    } else if (strcmp(node->binary_op.operator, "==") == 0) {
-      // Compare left and right values
-      add_instruction(text, INSTR_CMP, reg_operand(right_reg),
-                      reg_operand(left_reg));
+                      reg_operand(result));
+      count = count - 1;
+    }
 
-      // Set AL to 1 if equal, 0 otherwise
-      add_instruction(text, INSTR_SET_EQ, reg_operand(REG_AL), empty_operand());
+    // && and ||. The left operand decides the result on its own when it is
+    // false for && or true for ||; otherwise the result is whether the right
+    // operand is non-zero. The result ends up in the left operand's register.
+    else if (kind == NODE_BINARY_OPERATION &&
+             (ast->data[node] == OP_LOGICAL_AND ||
+              ast->data[node] == OP_LOGICAL_OR)) {
+      int is_and = ast->data[node] == OP_LOGICAL_AND;
+      if (frame->stage == 0) {
+        frame->label = assembly->logic_labels++;
+      }
+      struct Operand short_label =
+          label_operand(LABEL_LOGIC_SHORT, frame->label);
+      struct Operand end_label = label_operand(LABEL_LOGIC_END, frame->label);
+
+      if (frame->stage == 0) {
+        frame->stage = 1;
+        frames = push_expression_frame(frames, inline_frames, &count,
+                                       &capacity, node + 1);
+        continue;
+      }
 
-      // Move zero-extended byte to result register
-      int result_reg = allocate_register(ctx);
-      add_instruction(text, INSTR_MOVZX, reg_operand(REG_AL),
-                      reg_operand(result_reg));
+      if (frame->stage == 1) {
+        frame->reg = result;
+        add_instruction(text, INSTR_CMP, imm_operand(0), reg_operand(result));
+        add_instruction(text, is_and ? INSTR_JE : INSTR_JNE, short_label,
+                        empty_operand());
+        frame->stage = 2;
+        frames = push_expression_frame(frames, inline_frames, &count,
+                                       &capacity, ast->ends[node + 1]);
+        continue;
+      }
 
-      free_register(ctx, left_reg);
-      free_register(ctx, right_reg);
-      return result_reg;
-    } else if (strcmp(node->binary_op.operator, "!=") == 0) {
-      // Compare left and right values
-      add_instruction(text, INSTR_CMP, reg_operand(right_reg),
+      int left_reg = frame->reg;
+      add_instruction(text, INSTR_CMP, imm_operand(0), reg_operand(result));
+      free_register(ctx, result);
+      add_instruction(text, INSTR_SET_NE, reg_operand(REG_AL),
+                      empty_operand());
+      add_instruction(text, INSTR_MOVZX, reg_operand(REG_AL),
                       reg_operand(left_reg));
+      add_instruction(text, INSTR_JMP, end_label, empty_operand());
 
-      // Set AL to 1 if not equal, 0 otherwise
-      add_instruction(text, INSTR_SET_NE, reg_operand(REG_AL), empty_operand());
-
-      // Move zero-extended byte to result register
-      int result_reg = allocate_register(ctx);
-      add_instruction(text, INSTR_MOVZX, reg_operand(REG_AL),
-                      reg_operand(result_reg));
+      add_instruction(text, INSTR_LABEL, short_label, empty_operand());
+      add_instruction(text, INSTR_MOV, imm_operand(is_and ? 0 : 1),
+                      reg_operand(left_reg));
+      add_instruction(text, INSTR_LABEL, end_label, empty_operand());
+      result = left_reg;
+      count = count - 1;
+    }
 
-      free_register(ctx, left_reg);
-      free_register(ctx, right_reg);
-      return result_reg;
+    // Binary operation: left op right
+    else if (kind == NODE_BINARY_OPERATION) {
+      // Depth-first: evaluate left, then right
+      if (frame->stage == 0) {
+        frame->stage = 1;
+        frames = push_expression_frame(frames, inline_frames, &count,
+                                       &capacity, node + 1);
+        continue;
+      }
+      if (frame->stage == 1) {
+        frame->reg = result;
+        frame->stage = 2;
+        frames = push_expression_frame(frames, inline_frames, &count,
+                                       &capacity, ast->ends[node + 1]);
+        continue;
+      }
+      result = generate_binary(text, ast->data[node], frame->reg, result, ctx);
+      count = count - 1;
     }
 
-    // If it wasn't division, then left_reg now holds the result.
-    free_register(ctx, right_reg);
-    // We keep left_reg as final result
-    return left_reg;
-  }
+    // Assignment: target = value
+    else if (kind == NODE_ASSIGNMENT) {
+      int target = node + 1;
+      // Evaluate the right-hand side
+      if (frame->stage == 0) {
+        frame->stage = 1;
+        frames = push_expression_frame(frames, inline_frames, &count,
+                                       &capacity, ast->ends[target]);
+        continue;
+      }
 
-  // Assignment: target = value
-  else if (node->type == NODE_ASSIGNMENT) {
-    // Evaluate the right-hand side
-    int value_reg =
-        generate_expression(text, node->assignment.value, func, assembly, ctx);
-
-    // target must be an identifier
-    if (node->assignment.target->type == NODE_IDENTIFIER) {
-      // Use the stack offset stored in the identifier node
-      add_instruction(
-          text, INSTR_MOV, reg_operand(value_reg),
-          mem_operand(REG_RBP,
-                      node->assignment.target->identifier.stack_offset));
-    } else {
-      fprintf(stderr, "Assignment to non-identifier is not supported\n");
-      exit(1);
+      // target must be an identifier
+      if (ast->kinds[target] == NODE_IDENTIFIER) {
+        // Use the stack offset stored in the identifier
+        struct FlatVariable *variable = &ast->variables[ast->data[target]];
+        store_variable(text, variable->datatype, variable->stack_offset,
+                       result);
+      } else {
+        fprintf(stderr, "Assignment to non-identifier is not supported\n");
+        fail_compilation();
+      }
+      free_register(ctx, result);
+
+      result = -1;
+      count = count - 1;
     }
-    free_register(ctx, value_reg);
 
-    return -1;
+    else {
+      fprintf(stderr, "generate_expression: unhandled node type %d\n", kind);
+      fail_compilation();
+    }
   }
 
-  fprintf(stderr, "generate_expression: unhandled node type %d\n", node->type);
-  exit(1);
+  stack_free(frames, inline_frames);
+  return result;
 }
 
-// Forward declaration of generate_block
-static int generate_block(struct Section *text, struct ASTNode *block,
-                          struct Symbol *func, struct Assembly *assembly);
-
 // Helper function to output code for an assignment
-static void generate_assignment(struct Section *text, struct ASTNode *target,
-                                struct ASTNode *value, struct Symbol *func,
+static void generate_assignment(struct Section *text, struct FlatAST *ast,
+                                int target, int value,
                                 struct Assembly *assembly,
                                 struct CodegenContext *ctx) {
   // Evaluate the right-hand side
-  int value_reg = generate_expression(text, value, func, assembly, ctx);
+  int value_reg = generate_expression(text, ast, value, assembly, ctx);
 
   // Handle different kinds of targets
-  if (target->type == NODE_IDENTIFIER) {
-    // Use the stack offset stored directly in the identifier node
-    add_instruction(text, INSTR_MOV, reg_operand(value_reg),
-                    mem_operand(REG_RBP, target->identifier.stack_offset));
+  if (ast->kinds[target] == NODE_IDENTIFIER) {
+    // Use the stack offset stored directly in the identifier
+    struct FlatVariable *variable = &ast->variables[ast->data[target]];
+    store_variable(text, variable->datatype, variable->stack_offset,
+                   value_reg);
   } else {
     fprintf(stderr, "Assignment to non-identifier is not supported\n");
-    exit(1);
+    fail_compilation();
   }
 
   // Free the register used for the value
   free_register(ctx, value_reg);
 }
 
+// What a block being generated is the body of
+#define BODY_FUNCTION 0
+#define BODY_THEN 1
+#define BODY_ELSE 2
+#define BODY_WHILE 3
+
+// Block being generated by generate_block
+struct BlockCodegenFrame {
+  int block;
+  int next;        // Next statement to generate
+  int has_return;  // The block is guaranteed to return
+  int body;        // BODY_*
+  int owner;       // If or while statement the block belongs to
+  int label;       // Label number of the owner
+  int then_return; // For an else body, whether the then body returns
+};
+
+static struct BlockCodegenFrame *
+push_block_frame(struct BlockCodegenFrame *frames,
+                 struct BlockCodegenFrame *inline_frames, int *count,
+                 int *capacity, int block, int body, int owner, int label) {
+  if (*count == *capacity) {
+    frames = stack_grow(frames, inline_frames, capacity,
+                        sizeof(struct BlockCodegenFrame));
+  }
+  struct BlockCodegenFrame *frame = &frames[(*count)++];
+  frame->block = block;
+  frame->next = block + 1;
+  frame->has_return = 0;
+  frame->body = body;
+  frame->owner = owner;
+  frame->label = label;
+  frame->then_return = 0;
+  return frames;
+}
+
 // Returns 1 if the block contains a return statement that terminates the block.
-static int generate_block(struct Section *text, struct ASTNode *block,
-                          struct Symbol *func, struct Assembly *assembly) {
+// Nested if and while bodies are generated with an explicit stack of blocks;
+// the code after a body is emitted when its frame is popped.
+static int generate_block(struct Section *text, struct FlatAST *ast, int block,
+                          struct Assembly *assembly) {
+  struct BlockCodegenFrame inline_frames[16];
+  struct BlockCodegenFrame *frames = inline_frames;
+  int capacity = 16;
+  int count = 0;
   int has_return = 0;
-  while (block) {
+  frames = push_block_frame(frames, inline_frames, &count, &capacity, block,
+                            BODY_FUNCTION, -1, 0);
+
+  while (count > 0) {
+    struct BlockCodegenFrame *frame = &frames[count - 1];
+
+    // Finish the statement the block belongs to
+    if (frame->next >= ast->ends[frame->block]) {
+      struct BlockCodegenFrame done = *frame;
+      count = count - 1;
+      if (done.body == BODY_FUNCTION) {
+        has_return = done.has_return;
+      } else if (done.body == BODY_WHILE) {
+        /* Jump back to start label */
+        add_instruction(text, INSTR_JMP,
+                        label_operand(LABEL_WHILE_START, done.label),
+                        empty_operand());
+
+        /* Place end label */
+        add_instruction(text, INSTR_LABEL,
+                        label_operand(LABEL_WHILE_END, done.label),
+                        empty_operand());
+      } else if (done.body == BODY_THEN) {
+        // Jump to end after then block.
+        add_instruction(text, INSTR_JMP,
+                        label_operand(LABEL_IF_END, done.label),
+                        empty_operand());
+
+        // Append the else label.
+        add_instruction(text, INSTR_LABEL,
+                        label_operand(LABEL_ELSE, done.label),
+                        empty_operand());
+
+        // Generate the "else" block.
+        int else_body = ast->ends[done.block];
+        if (else_body < ast->ends[done.owner]) {
+          frames = push_block_frame(frames, inline_frames, &count, &capacity,
+                                    else_body, BODY_ELSE, done.owner,
+                                    done.label);
+          frames[count - 1].then_return = done.has_return;
+        } else {
+          // Append the end label.
+          add_instruction(text, INSTR_LABEL,
+                          label_operand(LABEL_IF_END, done.label),
+                          empty_operand());
+        }
+      } else {
+        // Append the end label.
+        add_instruction(text, INSTR_LABEL,
+                        label_operand(LABEL_IF_END, done.label),
+                        empty_operand());
+
+        // If both branches guarantee a return, then mark the enclosing block
+        // as returning.
+        if (done.then_return && done.has_return) {
+          frames[count - 1].has_return = 1;
+        }
+      }
+      continue;
+    }
+
+    int node = frame->next;
+    frame->next = ast->ends[node];
     struct CodegenContext ctx_stmt;
     init_codegen_context(&ctx_stmt);
-    switch (block->type) {
+    switch (ast->kinds[node]) {
     case NODE_VARIABLE_DECLARATION:
-      if (block->var_decl.value) {
-        int reg = generate_expression(text, block->var_decl.value, func,
-                                      assembly, &ctx_stmt);
-        // Use stored stack offset from var_decl directly
-        add_instruction(text, INSTR_MOV, reg_operand(reg),
-                        mem_operand(REG_RBP, block->var_decl.stack_offset));
+      if (ast->ends[node] > node + 1) {
+        int reg = generate_expression(text, ast, node + 1, assembly, &ctx_stmt);
+        // Use stored stack offset from the declaration directly
+        struct FlatVariable *variable = &ast->variables[ast->data[node]];
+        store_variable(text, variable->datatype, variable->stack_offset, reg);
         free_register(&ctx_stmt, reg);
       }
       break;
 
     case NODE_ASSIGNMENT:
       // Use the helper function for assignments
-      generate_assignment(text, block->assignment.target,
-                          block->assignment.value, func, assembly, &ctx_stmt);
+      generate_assignment(text, ast, node + 1, ast->ends[node + 1], assembly,
+                          &ctx_stmt);
       break;
 
     case NODE_RETURN_STATEMENT: {
-      int reg = generate_expression(text, block->return_stmt.value, func,
-                                    assembly, &ctx_stmt);
+      int reg = generate_expression(text, ast, node + 1, assembly, &ctx_stmt);
       add_instruction(text, INSTR_MOV, reg_operand(reg), reg_operand(REG_RAX));
       free_register(&ctx_stmt, reg);
       // Function epilogue and return
@@ -462,142 +755,61 @@ static int generate_block(struct Section *text, struct ASTNode *block,
                       reg_operand(REG_RSP));
       add_instruction(text, INSTR_POP, reg_operand(REG_RBP), empty_operand());
       add_instruction(text, INSTR_RET, empty_operand(), empty_operand());
-      has_return = 1;
       // A return terminates further code generation for this block.
-      return has_return;
+      frame->has_return = 1;
+      frame->next = ast->ends[frame->block];
+      break;
     }
 
     case NODE_IF_STATEMENT: {
-      static int if_counter = 0;
-      int cond_reg = generate_expression(text, block->if_stmt.condition, func,
-                                         assembly, &ctx_stmt);
+      int condition = node + 1;
+      int cond_reg =
+          generate_expression(text, ast, condition, assembly, &ctx_stmt);
       add_instruction(text, INSTR_CMP, imm_operand(0), reg_operand(cond_reg));
       free_register(&ctx_stmt, cond_reg);
 
-      char else_label[32];
-      char end_label[32];
-      snprintf(else_label, sizeof(else_label), ".Lelse%d", if_counter);
-      snprintf(end_label, sizeof(end_label), ".Lif_end%d", if_counter);
-      if_counter++;
+      int label = assembly->if_labels++;
 
       // Jump to else branch if condition is false.
-      add_instruction(text, INSTR_JE, label_operand(else_label),
+      add_instruction(text, INSTR_JE, label_operand(LABEL_ELSE, label),
                       empty_operand());
 
       // Generate the "if" (then) block.
-      int then_return =
-          generate_block(text, block->if_stmt.body, func, assembly);
-      // Jump to end after then block.
-      add_instruction(text, INSTR_JMP, label_operand(end_label),
-                      empty_operand());
-
-      // Append the else label.
-      struct Instruction *else_instr = malloc(sizeof(struct Instruction));
-      else_instr->type = INSTR_LABEL;
-      else_instr->op1.type = OPERAND_LABEL;
-      else_instr->op1.label = strdup(else_label);
-      else_instr->next = NULL;
-      if (text->instructions) {
-        struct Instruction *last = text->instructions;
-        while (last->next)
-          last = last->next;
-        last->next = else_instr;
-      } else {
-        text->instructions = else_instr;
-      }
-
-      // Generate the "else" block.
-      int else_return =
-          generate_block(text, block->if_stmt.else_body, func, assembly);
-
-      // Append the end label.
-      struct Instruction *end_instr = malloc(sizeof(struct Instruction));
-      end_instr->type = INSTR_LABEL;
-      end_instr->op1.type = OPERAND_LABEL;
-      end_instr->op1.label = strdup(end_label);
-      end_instr->next = NULL;
-      if (text->instructions) {
-        struct Instruction *last = text->instructions;
-        while (last->next)
-          last = last->next;
-        last->next = end_instr;
-      } else {
-        text->instructions = end_instr;
-      }
-
-      // If both branches guarantee a return, then mark this block as returning.
-      if (then_return && else_return) {
-        has_return = 1;
-      }
+      frames = push_block_frame(frames, inline_frames, &count, &capacity,
+                                ast->ends[condition], BODY_THEN, node, label);
       break;
     }
 
     case NODE_WHILE_STATEMENT: {
-      static int while_counter = 0;
-      char start_label[32];
-      char end_label[32];
-      snprintf(start_label, sizeof(start_label), ".Lwhile_start%d",
-               while_counter);
-      snprintf(end_label, sizeof(end_label), ".Lwhile_end%d", while_counter);
-      while_counter++;
+      int label = assembly->while_labels++;
 
       /* Place start label */
-      struct Instruction *start_instr = malloc(sizeof(struct Instruction));
-      start_instr->type = INSTR_LABEL;
-      start_instr->op1.type = OPERAND_LABEL;
-      start_instr->op1.label = strdup(start_label);
-      start_instr->next = NULL;
-      if (text->instructions) {
-        struct Instruction *last = text->instructions;
-        while (last->next)
-          last = last->next;
-        last->next = start_instr;
-      } else {
-        text->instructions = start_instr;
-      }
+      add_instruction(text, INSTR_LABEL,
+                      label_operand(LABEL_WHILE_START, label), empty_operand());
 
       /* Evaluate condition */
-      struct CodegenContext ctx_cond;
-      init_codegen_context(&ctx_cond);
-      int cond_reg = generate_expression(text, block->while_stmt.condition,
-                                         func, assembly, &ctx_cond);
+      int cond_reg =
+          generate_expression(text, ast, node + 1, assembly, &ctx_stmt);
       add_instruction(text, INSTR_CMP, imm_operand(0), reg_operand(cond_reg));
-      free_register(&ctx_cond, cond_reg);
+      free_register(&ctx_stmt, cond_reg);
 
       /* Jump to end if condition is false */
-      add_instruction(text, INSTR_JE, label_operand(end_label),
+      add_instruction(text, INSTR_JE, label_operand(LABEL_WHILE_END, label),
                       empty_operand());
 
       /* Generate while loop body */
-      generate_block(text, block->while_stmt.body, func, assembly);
-
-      /* Jump back to start label */
-      add_instruction(text, INSTR_JMP, label_operand(start_label),
-                      empty_operand());
-
-      /* Place end label */
-      struct Instruction *end_instr = malloc(sizeof(struct Instruction));
-      end_instr->type = INSTR_LABEL;
-      end_instr->op1.type = OPERAND_LABEL;
-      end_instr->op1.label = strdup(end_label);
-      end_instr->next = NULL;
-      if (text->instructions) {
-        struct Instruction *last = text->instructions;
-        while (last->next)
-          last = last->next;
-        last->next = end_instr;
-      } else {
-        text->instructions = end_instr;
-      }
+      frames = push_block_frame(frames, inline_frames, &count, &capacity,
+                                ast->ends[node + 1], BODY_WHILE, node, label);
       break;
     }
 
     default:
       // For expressions (assignments, function calls, binary ops, etc.)
-      generate_expression(text, block, func, assembly, &ctx_stmt);
+      generate_expression(text, ast, node, assembly, &ctx_stmt);
     }
-    block = block->next;
   }
+
+  stack_free(frames, inline_frames);
   return has_return;
 }
 
@@ -608,76 +820,224 @@ static int generate_block(struct Section *text, struct ASTNode *block,
 // remove the old special cases and call generate_expression.
 
 // ...
-struct Assembly *generate_code(struct ASTNode *ast,
-                               struct SemanticContext *context) {
-  struct Assembly *assembly = create_assembly();
-  add_extern_symbol(assembly, "printf");
+// Generate the code of the function declared by node into text
+void generate_function(struct Section *text, struct FlatAST *ast, int node,
+                       struct Assembly *assembly) {
+  struct FlatFunction *function = &ast->functions[ast->data[node]];
+  struct Symbol *func = function->symbol;
+
+  // Add function label
+  add_instruction(text, INSTR_LABEL, name_operand(function->name),
+                  empty_operand());
+
+  // Function prologue
+  add_instruction(text, INSTR_PUSH, reg_operand(REG_RBP), empty_operand());
+  add_instruction(text, INSTR_MOV, reg_operand(REG_RSP), reg_operand(REG_RBP));
+
+  // Reserve stack space for all variables
+  if (func->function.stack_size > 0) {
+    add_instruction(text, INSTR_SUB, imm_operand(func->function.stack_size),
+                    reg_operand(REG_RSP));
+  }
 
-  struct Section *text = create_section(".text");
-  assembly->sections = text;
+  // Save parameters to their stack locations. Sema records the parameters
+  // first in the function's locals.
+  for (int i = 0; i < function->param_count && i < 6; i++) {
+    struct Symbol *param = func->function.locals->symbols[i];
+    int reg_args[] = {REG_RDI, REG_RSI, REG_RDX, REG_RCX, REG_R8, REG_R9};
+    store_variable(text, param->variable.data_type, param->variable.offset,
+                   reg_args[i]);
+  }
 
-  // For each function in the AST
-  struct ASTNode *current = ast;
-  while (current) {
-    if (current->type == NODE_FUNCTION_DECLARATION) {
-      struct Symbol *func =
-          lookup_symbol(context->global_scope, current->function_decl.name);
-      if (!func)
-        continue;
+  // Generate code for the function body using generic block code generation.
+  // The block generator returns a flag indicating if a return was
+  // encountered.
+  int has_return = generate_block(text, ast, node + 1, assembly);
+  if (!has_return) {
+    add_instruction(text, INSTR_MOV, reg_operand(REG_RSP),
+                    reg_operand(REG_RBP));
+    add_instruction(text, INSTR_POP, reg_operand(REG_RBP), empty_operand());
+    add_instruction(text, INSTR_RET, empty_operand(), empty_operand());
+  }
+}
 
-      // Add function label
-      struct Instruction *label = malloc(sizeof(struct Instruction));
-      label->type = INSTR_LABEL;
-      label->op1.type = OPERAND_LABEL;
-      label->op1.label = strdup(current->function_decl.name);
-      label->next = NULL;
+// Code of one function generated by a worker thread. Each function numbers
+// its labels and string literals from zero in an Assembly of its own; once
+// all of them are done they are offset by the counts of the functions before
+// it, which gives the same numbers as generating the functions in order.
+struct FunctionCode {
+  int node;
+  struct Section *text;
+  struct Assembly *assembly;
+};
 
-      if (!text->instructions) {
-        text->instructions = label;
-      } else {
-        struct Instruction *last = text->instructions;
-        while (last->next) {
-          last = last->next;
-        }
-        last->next = label;
-      }
+struct ParallelCodegen {
+  struct FlatAST *ast;
+  struct FunctionCode *functions;
+  int count;
+  atomic_int next;   // Index of the next function to generate
+  atomic_int failed; // Set if a function could not be generated
+};
 
-      // Function prologue
-      add_instruction(text, INSTR_PUSH, reg_operand(REG_RBP), empty_operand());
-      add_instruction(text, INSTR_MOV, reg_operand(REG_RSP),
-                      reg_operand(REG_RBP));
+struct CodegenWorker {
+  struct ParallelCodegen *shared;
+  struct Arena arena; // Adopted by the codegen arena once the worker is done
+};
 
-      // Reserve stack space for all variables
-      if (func->function.stack_size > 0) {
-        add_instruction(text, INSTR_SUB, imm_operand(func->function.stack_size),
-                        reg_operand(REG_RSP));
+static void *codegen_worker(void *arg) {
+  struct CodegenWorker *worker = arg;
+  struct ParallelCodegen *shared = worker->shared;
+
+  // A failed function stops this worker, the caller reports the failure
+  // once every worker has finished
+  jmp_buf *outer_recovery = compilation_recovery;
+  jmp_buf recovery;
+  if (setjmp(recovery)) {
+    atomic_store(&shared->failed, 1);
+    compilation_recovery = outer_recovery;
+    return NULL;
+  }
+  compilation_recovery = &recovery;
+
+  int index;
+  while ((index = atomic_fetch_add(&shared->next, 1)) < shared->count) {
+    struct FunctionCode *function = &shared->functions[index];
+    function->assembly = create_assembly(&worker->arena);
+    function->text = create_section(&worker->arena, ".text");
+    generate_function(function->text, shared->ast, function->node,
+                      function->assembly);
+  }
+  compilation_recovery = outer_recovery;
+  return NULL;
+}
+
+// Add offsets[kind] to every numbered label in text
+static void relocate_labels(struct Section *text, const int *offsets) {
+  int i = 0;
+  while (i < text->count) {
+    struct Operand *op = &text->instructions[i].op1;
+    int j = 0;
+    while (j < 2) {
+      if ((op[j].type == OPERAND_LABEL || op[j].type == OPERAND_RIP_LABEL) &&
+          op[j].label.kind != LABEL_NAME) {
+        op[j].label.id = op[j].label.id + offsets[op[j].label.kind];
       }
+      j = j + 1;
+    }
+    i = i + 1;
+  }
+}
+
+// Generate the functions on jobs threads and join their code in source
+// order, numbered as if they had been generated one after another
+static void generate_parallel(struct Assembly *assembly, struct FlatAST *ast,
+                              int *nodes, int count, int jobs) {
+  struct ParallelCodegen shared;
+  shared.ast = ast;
+  shared.functions =
+      arena_alloc(assembly->arena, count * sizeof(struct FunctionCode));
+  shared.count = count;
+  atomic_init(&shared.next, 0);
+  atomic_init(&shared.failed, 0);
+  int i = 0;
+  while (i < count) {
+    shared.functions[i].node = nodes[i];
+    i = i + 1;
+  }
 
-      // Save parameters to their stack locations
-      for (int i = 0; i < current->function_decl.param_count && i < 6; i++) {
-        struct Symbol *param = lookup_symbol(
-            func->function.locals, current->function_decl.parameters[i].name);
-        if (param) {
-          int reg_args[] = {REG_RDI, REG_RSI, REG_RDX, REG_RCX, REG_R8, REG_R9};
-          add_instruction(text, INSTR_MOV, reg_operand(reg_args[i]),
-                          mem_operand(REG_RBP, param->variable.offset));
+  struct CodegenWorker *workers = malloc(jobs * sizeof(struct CodegenWorker));
+  if (!workers) {
+    fprintf(stderr, "Error: memory allocation failed\n");
+    exit(1);
+  }
+  i = 0;
+  while (i < jobs) {
+    workers[i].shared = &shared;
+    arena_init(&workers[i].arena);
+    i = i + 1;
+  }
+  run_workers(codegen_worker, workers, sizeof(struct CodegenWorker), jobs);
+  i = 0;
+  while (i < jobs) {
+    arena_adopt(assembly->arena, &workers[i].arena);
+    i = i + 1;
+  }
+  free(workers);
+  if (atomic_load(&shared.failed)) {
+    fail_compilation();
+  }
+
+  // Link the sections in source order. String literals are listed newest
+  // first, so the literals of each function go in front of those before it.
+  int offsets[LABEL_KIND_COUNT] = {0};
+  struct Section **link = &assembly->sections;
+  i = 0;
+  while (i < count) {
+    struct FunctionCode *function = &shared.functions[i];
+    relocate_labels(function->text, offsets);
+    *link = function->text;
+    link = &function->text->next;
+
+    struct StringLiteral *str = function->assembly->string_literals;
+    if (str) {
+      while (1) {
+        str->label = str->label + offsets[LABEL_STRING];
+        if (!str->next) {
+          break;
         }
+        str = str->next;
       }
+      str->next = assembly->string_literals;
+      assembly->string_literals = function->assembly->string_literals;
+    }
 
-      // Generate code for the function body using generic block code
-      // generation. The block generator returns a flag indicating if a return
-      // was encountered.
-      int has_return =
-          generate_block(text, current->function_decl.body, func, assembly);
-      if (!has_return) {
-        add_instruction(text, INSTR_MOV, reg_operand(REG_RSP),
-                        reg_operand(REG_RBP));
-        add_instruction(text, INSTR_POP, reg_operand(REG_RBP), empty_operand());
-        add_instruction(text, INSTR_RET, empty_operand(), empty_operand());
-      }
+    offsets[LABEL_STRING] += function->assembly->string_labels;
+    offsets[LABEL_ELSE] += function->assembly->if_labels;
+    offsets[LABEL_IF_END] += function->assembly->if_labels;
+    offsets[LABEL_WHILE_START] += function->assembly->while_labels;
+    offsets[LABEL_WHILE_END] += function->assembly->while_labels;
+    offsets[LABEL_LOGIC_SHORT] += function->assembly->logic_labels;
+    offsets[LABEL_LOGIC_END] += function->assembly->logic_labels;
+    i = i + 1;
+  }
+  assembly->string_labels = offsets[LABEL_STRING];
+  assembly->if_labels = offsets[LABEL_ELSE];
+  assembly->while_labels = offsets[LABEL_WHILE_START];
+  assembly->logic_labels = offsets[LABEL_LOGIC_SHORT];
+}
+
+// Generate the code of every function, on up to jobs threads. The output is
+// the same whatever the number of threads.
+struct Assembly *generate_code(struct FlatAST *ast, struct Arena *arena,
+                               int jobs) {
+  struct Assembly *assembly = create_assembly(arena);
+  add_extern_symbol(assembly, "printf");
+
+  // Find the functions in the AST
+  int count = 0;
+  int *nodes = arena_alloc(arena, (ast->function_count + 1) * sizeof(int));
+  int current = 1;
+  while (current < ast->ends[0]) {
+    if (ast->kinds[current] == NODE_FUNCTION_DECLARATION) {
+      nodes[count++] = current;
     }
-    current = current->next;
+    current = ast->ends[current];
   }
 
+  if (jobs > count) {
+    jobs = count;
+  }
+  if (jobs > 1) {
+    generate_parallel(assembly, ast, nodes, count, jobs);
+    return assembly;
+  }
+
+  struct Section *text = create_section(arena, ".text");
+  assembly->sections = text;
+  int i = 0;
+  while (i < count) {
+    generate_function(text, ast, nodes[i], assembly);
+    i = i + 1;
+  }
   return assembly;
 }
@@ -1,5 +1,7 @@
 #pragma once
 
+struct Arena;
+
 // Token types
 #define TOKEN_LEFT_BRACE 1
 #define TOKEN_RIGHT_BRACE 2
@@ -34,17 +36,27 @@
 #define TOKEN_LOGICAL_AND 31
 #define TOKEN_AMPERSAND 32
 
+// Token flags
+#define TOKEN_FLAG_EXTRA 1 // Length or value is stored in Lexer.extras
+
+// Packed token, 8 bytes. Tokens longer than TOKEN_MAX_LENGTH and constants
+// substituted for a #define keep their length and value in the lexer's side
+// table; other literal values are decoded from the source text on demand.
+// Line numbers are not stored, see source_line in lexer.h.
+#define TOKEN_MAX_LENGTH 0xFFFF
+
 struct Token {
-  int type;
   int start;
-  int end;
-  int line;
+  unsigned short length;
+  unsigned char type;
+  unsigned char flags;
 };
 
-struct TokenArray {
-  struct Token *tokens;
-  int capacity;
-  int count;
+// Side table entry for a token with TOKEN_FLAG_EXTRA
+struct TokenExtra {
+  int start; // Offset of the token
+  int length;
+  int value;
 };
 
 // AST node types
@@ -60,40 +72,77 @@ struct TokenArray {
 #define NODE_ASSIGNMENT 10
 #define NODE_IF_STATEMENT 11
 #define NODE_WHILE_STATEMENT 12
+#define NODE_BLOCK 13 // Statement list, only used in the flat AST
+
+// Binary operators
+#define OP_ADD 1
+#define OP_SUBTRACT 2
+#define OP_MULTIPLY 3
+#define OP_DIVIDE 4
+#define OP_EQUAL 5
+#define OP_NOT_EQUAL 6
+#define OP_LESS 7
+#define OP_LESS_EQUAL 8
+#define OP_GREATER 9
+#define OP_GREATER_EQUAL 10
+#define OP_LOGICAL_AND 11
+#define OP_LOGICAL_OR 12
+
+// Type kinds
+#define TYPE_INT 1
+#define TYPE_CHAR 2
+#define TYPE_POINTER 3
+#define TYPE_ARRAY 4
+#define TYPE_STRUCT 5
+
+// Type descriptor. Types are unique (see type.h), so two types are the same
+// exactly when their pointers are equal.
+struct Type {
+  int kind;          // TYPE_*
+  int size;          // Size in bytes, 0 for incomplete structs
+  int align;         // Alignment in bytes
+  struct Type *base; // Pointed-to or element type
+  int length;        // Element count of arrays
+  int name;          // Interned name of builtin types and struct tags
+  const char *spelling;
+};
 
-// Forward declaration of ASTNode
+// Forward declarations of ASTNode and Symbol
 struct ASTNode;
+struct Symbol;
 
-// Function parameter structure
+// Function parameter structure. Names are interned IDs (see intern.h).
 struct FunctionParameter {
-  char *name;
-  char *type;
+  int name;
+  struct Type *type;
 };
 
-// AST node structure
+// AST node structure. All names are interned IDs.
 struct ASTNode {
   int type;
   union {
     // Function declaration
     struct {
-      char *name;
-      char *return_type;
+      int name;
+      struct Type *return_type;
       struct FunctionParameter *parameters;
       int param_count;
       struct ASTNode *body;
+      int body_start; // Offset after the '{' of the body, see parse_reachable
+      struct Symbol *symbol; // Set when sema runs during parsing
     } function_decl;
 
     // Variable declaration
     struct {
-      char *datatype;
-      char *name;
+      struct Type *datatype;
+      int name;
       struct ASTNode *value;
       int stack_offset;
     } var_decl;
 
     // Binary operation
     struct {
-      char *operator;
+      int operator; // OP_*
       struct ASTNode *left;
       struct ASTNode *right;
     } binary_op;
@@ -105,13 +154,14 @@ struct ASTNode {
 
     // Identifier
     struct {
-      char *name;
+      int name;
       int stack_offset;
+      struct Type *datatype; // Set when sema runs during parsing
     } identifier;
 
     // Function call
     struct {
-      char *name;
+      int name;
       struct ASTNode *arguments;
     } func_call;
 
@@ -147,6 +197,58 @@ struct ASTNode {
   struct ASTNode *next; // For linked list of statements
 };
 
+// Flat AST used by sema and codegen. Nodes are stored in pre-order in
+// parallel arrays indexed by node number, so a node's first child is the
+// next node and end is one past its last descendant; the sibling after n is
+// ends[n]. data holds the node's payload:
+//   NODE_PROGRAM               -        children: functions
+//   NODE_FUNCTION_DECLARATION  index into functions, child: body block
+//   NODE_BLOCK                 -        children: statements
+//   NODE_VARIABLE_DECLARATION  index into variables, child: optional value
+//   NODE_IDENTIFIER            index into variables
+//   NODE_INTEGER_LITERAL       the value
+//   NODE_STRING_LITERAL        index into strings
+//   NODE_BINARY_OPERATION      operator, children: left, right
+//   NODE_FUNCTION_CALL         function name, children: arguments
+//   NODE_RETURN_STATEMENT      -        child: value
+//   NODE_ASSIGNMENT            -        children: target, value
+//   NODE_IF_STATEMENT          -        children: condition, body, else body
+//                                       (only if there is an else)
+//   NODE_WHILE_STATEMENT       -        children: condition, body
+struct FlatFunction {
+  int name;
+  struct Type *return_type;
+  struct FunctionParameter *parameters;
+  int param_count;
+  struct Symbol *symbol; // Filled in by sema
+};
+
+// Declared or referenced variable. Sema fills in the stack offset, and for
+// references the type of the variable referred to.
+struct FlatVariable {
+  int name;
+  struct Type *datatype;
+  int stack_offset;
+};
+
+struct FlatAST {
+  unsigned char *kinds;
+  int *data;
+  int *ends;
+  int count;
+  int capacity;
+  struct FlatFunction *functions;
+  int function_count;
+  int function_capacity;
+  struct FlatVariable *variables;
+  int variable_count;
+  int variable_capacity;
+  char **strings;
+  int string_count;
+  int string_capacity;
+  struct Arena *arena;
+};
+
 // Symbol types
 #define SYMBOL_VARIABLE 1
 #define SYMBOL_FUNCTION 2
@@ -155,21 +257,21 @@ struct ASTNode {
 // Forward declaration of SymbolTable
 struct SymbolTable;
 
-// Symbol information
+// Symbol information. Names are interned IDs.
 struct Symbol {
-  char *name;
+  int name;
   int type;
   union {
     struct {
-      char *data_type;
+      struct Type *data_type;
       int offset; // Stack offset from RBP
       int size;   // Size in bytes
     } variable;
 
     struct {
-      char *return_type;
+      struct Type *return_type;
       int param_count;
-      char **param_types;
+      struct Type **param_types;
       int stack_size;             // Total stack frame size
       struct SymbolTable *locals; // Local variables
     } function;
@@ -182,27 +284,64 @@ struct Symbol {
   };
   struct SymbolTable
       *scope; // Points to nested scope if this symbol creates one
+  struct Symbol *shadowed; // Outer declaration of the same name, if any
+  int depth;               // Scope depth the symbol was declared at
 };
 
-// Symbol table for tracking scopes
+// Ordered list of the symbols declared in a function or at global scope
 struct SymbolTable {
   struct Symbol **symbols;
   int count;
   int capacity;
-  struct SymbolTable *parent; // Parent scope
+  struct Arena *arena;
+};
+
+// Symbols visible at the current point of the analysis. A single open
+// addressing table maps each interned name to its innermost declaration,
+// which links to the declarations it shadows. Every declaration is recorded
+// in an undo log, and each scope remembers the log length at entry, so
+// leaving a scope just unwinds the log back to that mark.
+struct ScopeTable {
+  int *keys;              // Interned names, ID_NONE marks an empty slot
+  struct Symbol **values; // Innermost visible declaration, or NULL
+  int slot_count;
+  int used;
+  struct Symbol **log; // Declarations in the order they were made
+  int log_count;
+  int log_capacity;
+  int *marks; // log_count at the entry of each open scope
+  int depth;
+  int mark_capacity;
+  struct Arena *arena;
 };
 
 // Semantic analysis context
 struct SemanticContext {
-  struct SymbolTable *current_scope;
-  struct SymbolTable *global_scope; // Keep track of global scope
-  char *current_function;           // Name of function being analyzed
+  struct FlatAST *ast; // Program being analyzed
+  struct ScopeTable scopes;
+  struct SymbolTable *global_scope;   // Functions in declaration order
+  struct SymbolTable *current_locals; // Locals of the function being analyzed
+  int current_function;               // Name of function being analyzed
   int had_error;
   int current_stack_offset; // Track current stack offset for variables
+  int lowest_stack_offset;  // Deepest slot of the function, bodies included
+  struct Arena *arena;      // Symbols and scopes are allocated from here
+  // Variables and locals tables, which are not needed once the function's
+  // code is generated
+  struct Arena *locals_arena;
+  // Scopes of the program's functions when a body is analyzed in a context
+  // of its own, see analyze_program. Shared by the threads and only read.
+  struct ScopeTable *globals;
+  // Every function of the program has been declared. Otherwise calls to
+  // functions not seen yet are kept in pending_calls until finish_analysis.
+  int functions_declared;
+  int *pending_calls;
+  int pending_count;
+  int pending_capacity;
 };
 
 // Symbol table functions
-struct Symbol *lookup_symbol(struct SymbolTable *scope, const char *name);
+struct Symbol *lookup_symbol(struct ScopeTable *scopes, int name);
 
 // Represents an operand in an assembly instruction
 struct Operand {
@@ -214,28 +353,46 @@ struct Operand {
       int base_reg; // Base register for memory operands
       int offset;   // Offset for memory operands
     } mem;
-    char *label; // For labels and function names
+    struct {
+      int kind; // LABEL_*
+      int id;   // Interned name for LABEL_NAME, otherwise the label number
+    } label;    // For labels and function names
   };
 };
 
+// Kinds of labels. Generated labels are numbered and only spelled out
+// (".Lelse3") when the assembly is printed.
+#define LABEL_NAME 0 // A function, named by an interned identifier
+#define LABEL_STRING 1
+#define LABEL_ELSE 2
+#define LABEL_IF_END 3
+#define LABEL_WHILE_START 4
+#define LABEL_WHILE_END 5
+#define LABEL_LOGIC_SHORT 6
+#define LABEL_LOGIC_END 7
+#define LABEL_KIND_COUNT 8
+
 // Represents a single assembly instruction
 struct Instruction {
   int type;
   struct Operand op1;
   struct Operand op2;
-  struct Instruction *next;
 };
 
-// Represents a section of assembly code
+// Represents a section of assembly code. Instructions are stored in order in
+// a growable array.
 struct Section {
   char *name;
   struct Instruction *instructions;
+  int count;
+  int capacity;
   struct Section *next;
+  struct Arena *arena; // Instructions are allocated from here
 };
 
 // String literals for the data section
 struct StringLiteral {
-  char *label;
+  int label; // Number of the LABEL_STRING label
   char *value;
   struct StringLiteral *next;
 };
@@ -246,6 +403,13 @@ struct Assembly {
   char **extern_symbols; // Array of external symbols (e.g., printf)
   int extern_count;
   struct StringLiteral *string_literals;
+  // Labels numbered so far. If and while statements number both of their
+  // labels with the same value, as do && and ||.
+  int string_labels;
+  int if_labels;
+  int while_labels;
+  int logic_labels;
+  struct Arena *arena;
 };
 
 // Instruction types
@@ -266,6 +430,13 @@ struct Assembly {
 #define INSTR_MOVZX 15
 #define INSTR_JE 16
 #define INSTR_JMP 17
+#define INSTR_SET_LT 18
+#define INSTR_SET_LE 19
+#define INSTR_SET_GT 20
+#define INSTR_SET_GE 21
+#define INSTR_JNE 22
+#define INSTR_MOVSX 23    // Sign-extending byte load
+#define INSTR_MOV_BYTE 24 // Byte store
 
 // Operand types
 #define OPERAND_EMPTY 0 // For instructions with no operand
@@ -294,4 +465,14 @@ struct Assembly {
 #define REG_R15 16
 #define REG_AL 17
 
+// Low bytes of the registers used for values, see byte_register
+#define REG_CL 18
+#define REG_DL 19
+#define REG_SIL 20
+#define REG_DIL 21
+#define REG_R8B 22
+#define REG_R9B 23
+#define REG_R10B 24
+#define REG_R11B 25
+
 #define REG_COUNT 16
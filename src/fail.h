@@ -0,0 +1,17 @@
+#pragma once
+
+#include <setjmp.h>
+#include <stdlib.h>
+
+// Errors that end a compilation are reported where they are found, which then
+// calls fail_compilation. Unless the driver has set a recovery point this
+// ends the process; the batch driver sets one per file so that only the file
+// being compiled is abandoned and the other workers carry on.
+static _Thread_local jmp_buf *compilation_recovery;
+
+_Noreturn void fail_compilation(void) {
+  if (compilation_recovery) {
+    longjmp(*compilation_recovery, 1);
+  }
+  exit(1);
+}
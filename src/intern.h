@@ -0,0 +1,209 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+// String interning. Every identifier and type name is stored once and
+// referred to by a small integer ID, so names compare with == instead of
+// strcmp. The table is seeded with the names the compiler itself refers to;
+// their IDs are the constants below and must match the order in
+// init_interner.
+
+#define ID_NONE 0
+#define ID_RETURN 1
+#define ID_IF 2
+#define ID_ELSE 3
+#define ID_WHILE 4
+#define ID_STRUCT 5
+#define ID_INT 6
+#define ID_CHAR 7
+#define ID_PRINTF 8
+#define ID_MAIN 9
+
+struct InternEntry {
+  const char *str;
+  int len;
+  unsigned int hash;
+};
+
+// Entries are kept in pages that never move, so an entry can be read while
+// another thread adds one
+#define INTERN_PAGE_BITS 12
+#define INTERN_PAGE_SIZE (1 << INTERN_PAGE_BITS)
+#define INTERN_MAX_PAGES (1 << 16)
+
+// Open addressing table of ID + 1, 0 marks an empty slot. A table that has
+// been replaced by a larger one stays allocated, threads may still be
+// probing it.
+struct InternSlots {
+  atomic_int *slots;
+  int slot_count;
+};
+
+struct Interner {
+  struct InternEntry **pages; // Entry i is pages[i / size][i % size]
+  int count;
+  _Atomic(struct InternSlots *) slots;
+  struct Arena strings; // Strings and slot tables
+  pthread_mutex_t lock; // Held while adding a string
+};
+
+// Table of the compilation running on this thread. Threads that help with a
+// compilation share the table of the thread that started it, see
+// use_interner. Names are looked up without locking; only adding a name
+// takes the lock.
+static _Thread_local struct Interner interner_storage;
+static _Thread_local struct Interner *interner;
+
+// FNV-1a
+static unsigned int intern_hash(const char *str, int len) {
+  unsigned int hash = 2166136261u;
+  int i = 0;
+  while (i < len) {
+    hash = (hash ^ (unsigned char)str[i]) * 16777619u;
+    i++;
+  }
+  return hash;
+}
+
+static struct InternEntry *intern_entry(int id) {
+  return &interner->pages[id >> INTERN_PAGE_BITS][id & (INTERN_PAGE_SIZE - 1)];
+}
+
+// Slot holding the ID of the string, or the empty slot where it would go
+static int intern_slot(struct InternSlots *table, const char *str, int len,
+                       unsigned int hash) {
+  int slot = hash & (table->slot_count - 1);
+  int id;
+  while ((id = atomic_load_explicit(&table->slots[slot],
+                                    memory_order_acquire))) {
+    struct InternEntry *entry = intern_entry(id - 1);
+    if (entry->hash == hash && entry->len == len &&
+        memcmp(entry->str, str, len) == 0) {
+      return slot;
+    }
+    slot = (slot + 1) & (table->slot_count - 1);
+  }
+  return slot;
+}
+
+// Replace the table by one twice as large. Called with the lock held.
+static void intern_grow_slots(void) {
+  struct InternSlots *old =
+      atomic_load_explicit(&interner->slots, memory_order_relaxed);
+  struct InternSlots *table =
+      arena_alloc(&interner->strings, sizeof(struct InternSlots));
+  table->slot_count = old ? old->slot_count * 2 : 1024;
+  table->slots =
+      arena_calloc(&interner->strings, table->slot_count * sizeof(int));
+  int i = 0;
+  while (i < interner->count) {
+    int slot = intern_entry(i)->hash & (table->slot_count - 1);
+    while (atomic_load_explicit(&table->slots[slot], memory_order_relaxed)) {
+      slot = (slot + 1) & (table->slot_count - 1);
+    }
+    atomic_store_explicit(&table->slots[slot], i + 1, memory_order_relaxed);
+    i++;
+  }
+  atomic_store_explicit(&interner->slots, table, memory_order_release);
+}
+
+// Return the ID for the given string, adding it to the table if needed.
+int intern(const char *str, int len) {
+  unsigned int hash = intern_hash(str, len);
+  struct InternSlots *table =
+      atomic_load_explicit(&interner->slots, memory_order_acquire);
+  int slot = intern_slot(table, str, len, hash);
+  int id = atomic_load_explicit(&table->slots[slot], memory_order_acquire);
+  if (id) {
+    return id - 1;
+  }
+
+  // Another thread may have added the string, or replaced the table, before
+  // the lock was taken
+  pthread_mutex_lock(&interner->lock);
+  table = atomic_load_explicit(&interner->slots, memory_order_relaxed);
+  slot = intern_slot(table, str, len, hash);
+  id = atomic_load_explicit(&table->slots[slot], memory_order_relaxed);
+  if (id) {
+    pthread_mutex_unlock(&interner->lock);
+    return id - 1;
+  }
+
+  id = interner->count;
+  if ((id & (INTERN_PAGE_SIZE - 1)) == 0) {
+    if ((id >> INTERN_PAGE_BITS) >= INTERN_MAX_PAGES) {
+      fprintf(stderr, "Error: too many names\n");
+      exit(1);
+    }
+    interner->pages[id >> INTERN_PAGE_BITS] = arena_alloc(
+        &interner->strings, INTERN_PAGE_SIZE * sizeof(struct InternEntry));
+  }
+  struct InternEntry *entry = intern_entry(id);
+  entry->str = arena_strndup(&interner->strings, str, len);
+  entry->len = len;
+  entry->hash = hash;
+  interner->count++;
+
+  // Keep the load factor below one half. The entry is complete before its
+  // ID is stored, which is what makes it visible to other threads.
+  if (interner->count * 2 > table->slot_count) {
+    intern_grow_slots();
+  } else {
+    atomic_store_explicit(&table->slots[slot], id + 1, memory_order_release);
+  }
+  pthread_mutex_unlock(&interner->lock);
+  return id;
+}
+
+int intern_cstr(const char *str) { return intern(str, strlen(str)); }
+
+const char *intern_str(int id) { return intern_entry(id)->str; }
+
+int intern_len(int id) { return intern_entry(id)->len; }
+
+// Number of IDs handed out so far, every ID is below this
+int intern_count(void) { return interner->count; }
+
+void init_interner(void) {
+  interner = &interner_storage;
+  interner->pages = calloc(INTERN_MAX_PAGES, sizeof(struct InternEntry *));
+  if (!interner->pages) {
+    fprintf(stderr, "Error: memory allocation failed\n");
+    exit(1);
+  }
+  interner->count = 0;
+  atomic_init(&interner->slots, NULL);
+  arena_init(&interner->strings);
+  pthread_mutex_init(&interner->lock, NULL);
+  intern_grow_slots();
+
+  static const char *const seeds[] = {"",       "return", "if",  "else",
+                                      "while",  "struct", "int", "char",
+                                      "printf", "main"};
+  size_t i = 0;
+  while (i < sizeof(seeds) / sizeof(seeds[0])) {
+    intern_cstr(seeds[i]);
+    i++;
+  }
+}
+
+// The table of the calling thread, to pass to use_interner
+struct Interner *current_interner(void) { return interner; }
+
+// Make the calling thread use the table of another thread
+void use_interner(struct Interner *shared) { interner = shared; }
+
+void free_interner(void) {
+  free(interner->pages);
+  arena_free(&interner->strings);
+  pthread_mutex_destroy(&interner->lock);
+  interner->pages = NULL;
+  interner->count = 0;
+  atomic_store(&interner->slots, NULL);
+}
@@ -1,302 +1,819 @@
+#pragma once
+
+#include "arena.h"
 #include "common.h"
+#include "intern.h"
+#include "scanner.h"
+#include "workers.h"
 
-#include <ctype.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-// Structure to store defined constants
+// Hashed table of #define constants. Names point into the input and values
+// are evaluated once when the directive is read, so substituting a constant
+// costs one hash lookup per identifier.
 struct Define {
-  char *name;
-  int start;
+  const char *name;
+  int len;
+  unsigned int hash;
+  int start; // Position of the value text in the input
   int end;
+  int value;
 };
 
-struct DefineArray {
+struct DefineTable {
   struct Define *defines;
-  int capacity;
   int count;
+  int capacity;
+  int *slots; // Open addressing table of index + 1, 0 marks an empty slot
+  int slot_count;
+  int redefined; // Some name has been defined more than once
+  struct Arena *arena;
 };
 
-struct DefineArray create_define_array(void) {
-  struct DefineArray arr;
-  arr.capacity = 8;
-  arr.count = 0;
-  arr.defines = malloc(arr.capacity * sizeof(struct Define));
-  return arr;
+static void define_table_grow_slots(struct DefineTable *table) {
+  int slot_count = table->slot_count * 2;
+  int *slots = arena_calloc(table->arena, slot_count * sizeof(int));
+  int i = 0;
+  while (i < table->count) {
+    int slot = table->defines[i].hash & (slot_count - 1);
+    while (slots[slot]) {
+      slot = (slot + 1) & (slot_count - 1);
+    }
+    slots[slot] = i + 1;
+    i = i + 1;
+  }
+  table->slots = slots;
+  table->slot_count = slot_count;
+}
+
+struct DefineTable create_define_table(struct Arena *arena) {
+  struct DefineTable table;
+  table.capacity = 16;
+  table.count = 0;
+  table.redefined = 0;
+  table.arena = arena;
+  table.defines = arena_alloc(arena, table.capacity * sizeof(struct Define));
+  table.slot_count = 32;
+  table.slots = arena_calloc(arena, table.slot_count * sizeof(int));
+  return table;
 }
 
-void add_define(struct DefineArray *arr, const char *name, int start, int end) {
-  if (arr->count >= arr->capacity) {
-    arr->capacity *= 2;
-    arr->defines = realloc(arr->defines, arr->capacity * sizeof(struct Define));
+// Slot holding the define with the given name, or the empty slot where it
+// would go
+static int define_slot(struct DefineTable *table, const char *name, int len,
+                       unsigned int hash) {
+  int slot = hash & (table->slot_count - 1);
+  while (table->slots[slot]) {
+    struct Define *define = &table->defines[table->slots[slot] - 1];
+    if (define->hash == hash && define->len == len &&
+        memcmp(define->name, name, len) == 0) {
+      return slot;
+    }
+    slot = (slot + 1) & (table->slot_count - 1);
   }
-  arr->defines[arr->count].name = strdup(name);
-  arr->defines[arr->count].start = start;
-  arr->defines[arr->count].end = end;
-  arr->count++;
+  return slot;
 }
 
-int get_define_start_end(struct DefineArray *arr, const char *name, int len,
-                         int *start, int *end) {
-  for (int i = 0; i < arr->count; i++) {
-    if (strncmp(arr->defines[i].name, name, len) == 0) {
-      *start = arr->defines[i].start;
-      *end = arr->defines[i].end;
-      return 1;
+struct Define *get_define(struct DefineTable *table, const char *name,
+                          int len) {
+  int slot = define_slot(table, name, len, intern_hash(name, len));
+  if (table->slots[slot]) {
+    return &table->defines[table->slots[slot] - 1];
+  }
+  return NULL;
+}
+
+// Add a define. As in C, a redefinition applies to the tokens after it and
+// the tokens before it keep the earlier value: the entry takes the new value
+// and position, and the lexer only substitutes a define at tokens after its
+// position. Passes that read every define before the bodies they parse must
+// check redefined and fall back to a single pass.
+void add_define(struct DefineTable *table, const char *name, int len,
+                int start, int end, int value) {
+  unsigned int hash = intern_hash(name, len);
+  int slot = define_slot(table, name, len, hash);
+  struct Define *define;
+  if (table->slots[slot]) {
+    define = &table->defines[table->slots[slot] - 1];
+    table->redefined = 1;
+  } else {
+    if (table->count >= table->capacity) {
+      table->defines = arena_realloc(
+          table->arena, table->defines,
+          table->capacity * sizeof(struct Define),
+          table->capacity * 2 * sizeof(struct Define));
+      table->capacity = table->capacity * 2;
+    }
+    define = &table->defines[table->count];
+    table->count = table->count + 1;
+    define->name = name;
+    define->len = len;
+    define->hash = hash;
+    // Keep the load factor below one half
+    if (table->count * 2 > table->slot_count) {
+      define_table_grow_slots(table);
+    } else {
+      table->slots[slot] = table->count;
     }
   }
-  return 0;
+  define->start = start;
+  define->end = end;
+  define->value = value;
+}
+
+// Number of side table entries the lexer keeps, a power of two. The entry of
+// a token is reused once this many more tokens with an entry are scanned, so
+// a caller must not hold on to more tokens than this.
+#define LEXER_EXTRAS 4
+
+// Incremental lexer. next_token scans the input up to the end of the next
+// token, so only the tokens the parser is currently looking at exist at any
+// time.
+struct Lexer {
+  const char *input;
+  int length;
+  int position; // Where the next token is scanned from
+  struct DefineTable defines;
+  scan_function scan;
+  int *line_starts; // Offset of each line, built on first use
+  int line_count;
+  // Side table of the latest tokens with TOKEN_FLAG_EXTRA, entry i is in
+  // extras[i % LEXER_EXTRAS]
+  struct TokenExtra extras[LEXER_EXTRAS];
+  int extra_count;
+  // The defines of the whole input have been read by the lexer this one was
+  // copied from, see parse_parallel. Directives are skipped, and a define
+  // only applies to the tokens after it.
+  int defines_read;
+  struct Arena *arena;
+};
+
+void init_lexer(struct Lexer *lexer, const char *input, int length,
+                struct Arena *arena) {
+  lexer->input = input;
+  lexer->length = length;
+  lexer->position = 0;
+  lexer->defines = create_define_table(arena);
+  lexer->scan = select_scanner();
+  lexer->line_starts = NULL;
+  lexer->line_count = 0;
+  lexer->extra_count = 0;
+  lexer->defines_read = 0;
+  lexer->arena = arena;
 }
 
-void free_define_array(struct DefineArray *arr) {
-  for (int i = 0; i < arr->count; i++) {
-    free(arr->defines[i].name);
+// Decode a character literal body starting after the opening quote
+static int decode_char_literal(const char *text) {
+  if (text[0] != '\\') {
+    return (unsigned char)text[0];
+  }
+  if (text[1] == 'n') {
+    return '\n';
+  } else if (text[1] == 't') {
+    return '\t';
+  } else if (text[1] == 'r') {
+    return '\r';
+  } else if (text[1] == '0') {
+    return 0;
   }
-  free(arr->defines);
+  return (unsigned char)text[1];
 }
 
-struct TokenArray create_token_array(void) {
-  struct TokenArray arr;
-  arr.capacity = 8;
-  arr.count = 0;
-  arr.tokens = malloc(arr.capacity * sizeof(struct Token));
-  return arr;
+// Fill in token, putting a length that does not fit the packed token or a
+// substituted value into the side table
+static void set_token(struct Lexer *lexer, struct Token *token, int type,
+                      int start, int length, int flags, int value) {
+  token->start = start;
+  token->type = type;
+  if (length > TOKEN_MAX_LENGTH || flags) {
+    struct TokenExtra *extra =
+        &lexer->extras[lexer->extra_count % LEXER_EXTRAS];
+    lexer->extra_count++;
+    extra->start = start;
+    extra->length = length;
+    extra->value = value;
+    token->length = length > TOKEN_MAX_LENGTH ? TOKEN_MAX_LENGTH : length;
+    token->flags = TOKEN_FLAG_EXTRA;
+  } else {
+    token->length = length;
+    token->flags = 0;
+  }
+}
+
+// Side table entry of a token with TOKEN_FLAG_EXTRA, searched from the latest
+static const struct TokenExtra *token_extra(const struct Lexer *lexer,
+                                            const struct Token *token) {
+  int i = lexer->extra_count - 1;
+  while (lexer->extras[i % LEXER_EXTRAS].start != token->start) {
+    i--;
+  }
+  return &lexer->extras[i % LEXER_EXTRAS];
 }
 
-void add_token(struct TokenArray *arr, struct Token token) {
-  if (arr->count >= arr->capacity) {
-    arr->capacity *= 2;
-    arr->tokens = realloc(arr->tokens, arr->capacity * sizeof(struct Token));
+int token_length(const struct Lexer *lexer, const struct Token *token) {
+  if (token->flags & TOKEN_FLAG_EXTRA) {
+    return token_extra(lexer, token)->length;
   }
-  arr->tokens[arr->count++] = token;
+  return token->length;
 }
 
-int lex(char *input, int length, struct TokenArray *tokens) {
-  *tokens = create_token_array();
-  struct DefineArray defines = create_define_array();
+// Value of an integer or character literal
+int token_value(const struct Lexer *lexer, const struct Token *token) {
+  if (token->flags & TOKEN_FLAG_EXTRA) {
+    return token_extra(lexer, token)->value;
+  }
+  const char *text = &lexer->input[token->start];
+  if (token->type == TOKEN_LITERAL_CHAR) {
+    return decode_char_literal(text + 1);
+  }
+  unsigned int value = 0;
   int i = 0;
-  int line = 1;
+  while (i < token->length) {
+    value = value * 10 + (text[i] - '0');
+    i++;
+  }
+  return (int)value;
+}
 
-  while (i < length) {
-    // Skip whitespace
-    while (i < length &&
-           (input[i] == ' ' || input[i] == '\n' || input[i] == '\t')) {
-      if (input[i] == '\n')
-        line++;
-      i++;
+// Line number of a source offset. The table of line starts is built the
+// first time a line is needed, which is normally only for a diagnostic.
+int source_line(struct Lexer *lexer, int offset) {
+  if (!lexer->line_starts) {
+    int count = 1;
+    const char *p = lexer->input;
+    const char *end = lexer->input + lexer->length;
+    while ((p = memchr(p, '\n', end - p))) {
+      count++;
+      p++;
     }
-    if (i >= length)
-      break;
+    lexer->line_starts = arena_alloc(lexer->arena, count * sizeof(int));
+    lexer->line_starts[0] = 0;
+    lexer->line_count = 1;
+    p = lexer->input;
+    while ((p = memchr(p, '\n', end - p))) {
+      p++;
+      lexer->line_starts[lexer->line_count++] = p - lexer->input;
+    }
+  }
+  // Last line starting at or before offset
+  int low = 0;
+  int high = lexer->line_count - 1;
+  while (low < high) {
+    int mid = low + (high - low + 1) / 2;
+    if (lexer->line_starts[mid] <= offset) {
+      low = mid;
+    } else {
+      high = mid - 1;
+    }
+  }
+  return low + 1;
+}
 
-    // Handle #define directives
-    if (input[i] == '#') {
-      i++; // Skip #
-      // Skip whitespace after #
-      while (i < length && (input[i] == ' ' || input[i] == '\t')) {
-        i++;
+// Character classes, combined as bit flags in char_class
+#define CHAR_SPACE 1       // ' ' and '\t'
+#define CHAR_DIGIT 4       // '0'-'9'
+#define CHAR_IDENT_START 8 // Letters and '_'
+#define CHAR_IDENT 16      // Letters, digits and '_'
+
+static const unsigned char char_class[256] = {
+    [' '] = CHAR_SPACE,
+    ['\t'] = CHAR_SPACE,
+    ['0'] = CHAR_DIGIT | CHAR_IDENT,
+    ['1'] = CHAR_DIGIT | CHAR_IDENT,
+    ['2'] = CHAR_DIGIT | CHAR_IDENT,
+    ['3'] = CHAR_DIGIT | CHAR_IDENT,
+    ['4'] = CHAR_DIGIT | CHAR_IDENT,
+    ['5'] = CHAR_DIGIT | CHAR_IDENT,
+    ['6'] = CHAR_DIGIT | CHAR_IDENT,
+    ['7'] = CHAR_DIGIT | CHAR_IDENT,
+    ['8'] = CHAR_DIGIT | CHAR_IDENT,
+    ['9'] = CHAR_DIGIT | CHAR_IDENT,
+    ['_'] = CHAR_IDENT_START | CHAR_IDENT,
+    ['a'] = CHAR_IDENT_START | CHAR_IDENT,
+    ['b'] = CHAR_IDENT_START | CHAR_IDENT,
+    ['c'] = CHAR_IDENT_START | CHAR_IDENT,
+    ['d'] = CHAR_IDENT_START | CHAR_IDENT,
+    ['e'] = CHAR_IDENT_START | CHAR_IDENT,
+    ['f'] = CHAR_IDENT_START | CHAR_IDENT,
+    ['g'] = CHAR_IDENT_START | CHAR_IDENT,
+    ['h'] = CHAR_IDENT_START | CHAR_IDENT,
+    ['i'] = CHAR_IDENT_START | CHAR_IDENT,
+    ['j'] = CHAR_IDENT_START | CHAR_IDENT,
+    ['k'] = CHAR_IDENT_START | CHAR_IDENT,
+    ['l'] = CHAR_IDENT_START | CHAR_IDENT,
+    ['m'] = CHAR_IDENT_START | CHAR_IDENT,
+    ['n'] = CHAR_IDENT_START | CHAR_IDENT,
+    ['o'] = CHAR_IDENT_START | CHAR_IDENT,
+    ['p'] = CHAR_IDENT_START | CHAR_IDENT,
+    ['q'] = CHAR_IDENT_START | CHAR_IDENT,
+    ['r'] = CHAR_IDENT_START | CHAR_IDENT,
+    ['s'] = CHAR_IDENT_START | CHAR_IDENT,
+    ['t'] = CHAR_IDENT_START | CHAR_IDENT,
+    ['u'] = CHAR_IDENT_START | CHAR_IDENT,
+    ['v'] = CHAR_IDENT_START | CHAR_IDENT,
+    ['w'] = CHAR_IDENT_START | CHAR_IDENT,
+    ['x'] = CHAR_IDENT_START | CHAR_IDENT,
+    ['y'] = CHAR_IDENT_START | CHAR_IDENT,
+    ['z'] = CHAR_IDENT_START | CHAR_IDENT,
+    ['A'] = CHAR_IDENT_START | CHAR_IDENT,
+    ['B'] = CHAR_IDENT_START | CHAR_IDENT,
+    ['C'] = CHAR_IDENT_START | CHAR_IDENT,
+    ['D'] = CHAR_IDENT_START | CHAR_IDENT,
+    ['E'] = CHAR_IDENT_START | CHAR_IDENT,
+    ['F'] = CHAR_IDENT_START | CHAR_IDENT,
+    ['G'] = CHAR_IDENT_START | CHAR_IDENT,
+    ['H'] = CHAR_IDENT_START | CHAR_IDENT,
+    ['I'] = CHAR_IDENT_START | CHAR_IDENT,
+    ['J'] = CHAR_IDENT_START | CHAR_IDENT,
+    ['K'] = CHAR_IDENT_START | CHAR_IDENT,
+    ['L'] = CHAR_IDENT_START | CHAR_IDENT,
+    ['M'] = CHAR_IDENT_START | CHAR_IDENT,
+    ['N'] = CHAR_IDENT_START | CHAR_IDENT,
+    ['O'] = CHAR_IDENT_START | CHAR_IDENT,
+    ['P'] = CHAR_IDENT_START | CHAR_IDENT,
+    ['Q'] = CHAR_IDENT_START | CHAR_IDENT,
+    ['R'] = CHAR_IDENT_START | CHAR_IDENT,
+    ['S'] = CHAR_IDENT_START | CHAR_IDENT,
+    ['T'] = CHAR_IDENT_START | CHAR_IDENT,
+    ['U'] = CHAR_IDENT_START | CHAR_IDENT,
+    ['V'] = CHAR_IDENT_START | CHAR_IDENT,
+    ['W'] = CHAR_IDENT_START | CHAR_IDENT,
+    ['X'] = CHAR_IDENT_START | CHAR_IDENT,
+    ['Y'] = CHAR_IDENT_START | CHAR_IDENT,
+    ['Z'] = CHAR_IDENT_START | CHAR_IDENT,
+};
+
+// Token type for characters that always form a token on their own
+static const unsigned char single_char_token[256] = {
+    ['{'] = TOKEN_LEFT_BRACE,    ['}'] = TOKEN_RIGHT_BRACE,
+    ['('] = TOKEN_LEFT_PAREN,    [')'] = TOKEN_RIGHT_PAREN,
+    ['['] = TOKEN_LEFT_BRACKET,  [']'] = TOKEN_RIGHT_BRACKET,
+    [';'] = TOKEN_SEMICOLON,     [','] = TOKEN_COMMA,
+    ['.'] = TOKEN_PERIOD,        ['+'] = TOKEN_PLUS,
+    ['-'] = TOKEN_MINUS,         ['*'] = TOKEN_MULTIPLY,
+    ['/'] = TOKEN_DIVIDE,
+};
+
+// Operators that may be followed by a second character: the character that
+// completes the two-character form, the resulting token, and the token for
+// the single character (0 if it is not valid on its own).
+static const unsigned char operator_second_char[256] = {
+    ['='] = '=', ['!'] = '=', ['<'] = '=',
+    ['>'] = '=', ['|'] = '|', ['&'] = '&',
+};
+
+static const unsigned char operator_double_token[256] = {
+    ['='] = TOKEN_EQUAL_EQUAL, ['!'] = TOKEN_NOT_EQUAL,
+    ['<'] = TOKEN_LESS_EQUAL,  ['>'] = TOKEN_GREATER_EQUAL,
+    ['|'] = TOKEN_LOGICAL_OR,  ['&'] = TOKEN_LOGICAL_AND,
+};
+
+static const unsigned char operator_single_token[256] = {
+    ['='] = TOKEN_EQUAL,
+    ['<'] = TOKEN_LESS,
+    ['>'] = TOKEN_GREATER,
+    ['&'] = TOKEN_AMPERSAND,
+};
+
+// Keywords, placed by a perfect hash of their length and first character.
+// keyword_hash maps each keyword to a distinct slot; other identifiers that
+// land on a slot are rejected by the length and text comparison.
+struct Keyword {
+  const char *text;
+  int len;
+  int type;
+};
+
+static const struct Keyword keyword_table[8] = {
+    [1] = {"else", 4, TOKEN_ELSE},     [4] = {"return", 6, TOKEN_RETURN},
+    [5] = {"struct", 6, TOKEN_STRUCT}, [6] = {"while", 5, TOKEN_WHILE},
+    [7] = {"if", 2, TOKEN_IF},
+};
+
+static int keyword_hash(const char *text, int len) {
+  return (len * 3 + (unsigned char)text[0]) & 7;
+}
+
+// Returns the keyword token type for the identifier, or 0
+static int lookup_keyword(const char *text, int len) {
+  if (len < 2 || len > 6) {
+    return 0;
+  }
+  const struct Keyword *keyword = &keyword_table[keyword_hash(text, len)];
+  if (keyword->len == len && memcmp(keyword->text, text, len) == 0) {
+    return keyword->type;
+  }
+  return 0;
+}
+
+// Evaluator for the integer constant expression of a #define. Supports
+// integer and character literals, earlier defines, parentheses, the unary
+// operators - + ! ~ and the binary arithmetic, comparison and logical
+// operators with C precedence. The expression ends at the end of the line or
+// at a comment.
+struct DefineExpr {
+  const char *input;
+  int i;
+  int length;
+  struct DefineTable *defines;
+  struct Lexer *lexer; // For the line of diagnostics
+  int error;
+};
+
+static void define_expr_error(struct DefineExpr *expr, const char *message) {
+  if (!expr->error) {
+    fprintf(stderr, "Line %d: Error: %s in #define at position %d\n",
+            source_line(expr->lexer, expr->i), message, expr->i);
+    expr->error = 1;
+  }
+}
+
+// Skip spaces and tabs, returning the next character or 0 at the end of the
+// expression
+static char define_expr_peek(struct DefineExpr *expr) {
+  while (expr->i < expr->length &&
+         (char_class[(unsigned char)expr->input[expr->i]] & CHAR_SPACE)) {
+    expr->i = expr->i + 1;
+  }
+  if (expr->i >= expr->length || expr->input[expr->i] == '\n') {
+    return 0;
+  }
+  if (expr->input[expr->i] == '/' && expr->i + 1 < expr->length &&
+      (expr->input[expr->i + 1] == '/' || expr->input[expr->i + 1] == '*')) {
+    return 0;
+  }
+  return expr->input[expr->i];
+}
+
+// Consume the operator op (one or two characters) if it comes next. The
+// second character of a one-character operator must not make it a longer
+// one, such as '<' in "<=" or '&' in "&&". Unary operators can be doubled.
+static int define_expr_match(struct DefineExpr *expr, const char *op) {
+  if (define_expr_peek(expr) != op[0]) {
+    return 0;
+  }
+  const char *text = &expr->input[expr->i];
+  int remaining = expr->length - expr->i;
+  if (op[1]) {
+    if (remaining < 2 || text[1] != op[1]) {
+      return 0;
+    }
+    expr->i = expr->i + 2;
+    return 1;
+  }
+  if (remaining >= 2 && op[0] != '(' && op[0] != ')' &&
+      (text[1] == '=' || (text[1] == text[0] && strchr("&|<>=", text[0])))) {
+    return 0;
+  }
+  expr->i = expr->i + 1;
+  return 1;
+}
+
+static long long define_expr_logical_or(struct DefineExpr *expr);
+
+static long long define_expr_primary(struct DefineExpr *expr) {
+  char c = define_expr_peek(expr);
+  int cls = char_class[(unsigned char)c];
+  if (cls & CHAR_DIGIT) {
+    long long value = 0;
+    while (expr->i < expr->length &&
+           (char_class[(unsigned char)expr->input[expr->i]] & CHAR_DIGIT)) {
+      value = (value * 10 + (expr->input[expr->i] - '0')) & 0xFFFFFFFF;
+      expr->i = expr->i + 1;
+    }
+    return (int)value;
+  } else if (cls & CHAR_IDENT_START) {
+    int start = expr->i;
+    while (expr->i < expr->length &&
+           (char_class[(unsigned char)expr->input[expr->i]] & CHAR_IDENT)) {
+      expr->i = expr->i + 1;
+    }
+    struct Define *define =
+        get_define(expr->defines, &expr->input[start], expr->i - start);
+    if (!define) {
+      expr->i = start;
+      define_expr_error(expr, "Undefined constant");
+      return 0;
+    }
+    return define->value;
+  } else if (c == '\'') {
+    const char *text = &expr->input[expr->i + 1];
+    int len = expr->i + 1 < expr->length && text[0] == '\\' ? 2 : 1;
+    if (expr->i + len + 2 > expr->length || text[len] != '\'') {
+      define_expr_error(expr, "Unterminated character literal");
+      return 0;
+    }
+    expr->i = expr->i + len + 2;
+    return decode_char_literal(text);
+  } else if (define_expr_match(expr, "(")) {
+    long long value = define_expr_logical_or(expr);
+    if (!define_expr_match(expr, ")")) {
+      define_expr_error(expr, "Expected ')'");
+    }
+    return value;
+  }
+  define_expr_error(expr, "Expected constant expression");
+  return 0;
+}
+
+static long long define_expr_unary(struct DefineExpr *expr) {
+  if (define_expr_match(expr, "-")) {
+    return (int)-define_expr_unary(expr);
+  } else if (define_expr_match(expr, "+")) {
+    return define_expr_unary(expr);
+  } else if (define_expr_match(expr, "!")) {
+    return !define_expr_unary(expr);
+  } else if (define_expr_match(expr, "~")) {
+    return ~define_expr_unary(expr);
+  }
+  return define_expr_primary(expr);
+}
+
+static long long define_expr_multiplicative(struct DefineExpr *expr) {
+  long long value = define_expr_unary(expr);
+  while (!expr->error) {
+    if (define_expr_match(expr, "*")) {
+      value = (int)(value * define_expr_unary(expr));
+    } else if (define_expr_match(expr, "/") || define_expr_match(expr, "%")) {
+      int is_divide = expr->input[expr->i - 1] == '/';
+      long long rhs = define_expr_unary(expr);
+      if (rhs == 0) {
+        define_expr_error(expr, "Division by zero");
+        return 0;
       }
+      value = (int)(is_divide ? value / rhs : value % rhs);
+    } else {
+      break;
+    }
+  }
+  return value;
+}
 
-      // Check if it's a define directive
-      if (i + 5 < length && strncmp(&input[i], "define", 6) == 0) {
-        i += 6; // Skip "define"
+static long long define_expr_additive(struct DefineExpr *expr) {
+  long long value = define_expr_multiplicative(expr);
+  while (!expr->error) {
+    if (define_expr_match(expr, "+")) {
+      value = (int)(value + define_expr_multiplicative(expr));
+    } else if (define_expr_match(expr, "-")) {
+      value = (int)(value - define_expr_multiplicative(expr));
+    } else {
+      break;
+    }
+  }
+  return value;
+}
 
-        // Skip whitespace after define
-        while (i < length && (input[i] == ' ' || input[i] == '\t')) {
-          i++;
-        }
+static long long define_expr_relational(struct DefineExpr *expr) {
+  long long value = define_expr_additive(expr);
+  while (!expr->error) {
+    if (define_expr_match(expr, "<=")) {
+      value = value <= define_expr_additive(expr);
+    } else if (define_expr_match(expr, ">=")) {
+      value = value >= define_expr_additive(expr);
+    } else if (define_expr_match(expr, "<")) {
+      value = value < define_expr_additive(expr);
+    } else if (define_expr_match(expr, ">")) {
+      value = value > define_expr_additive(expr);
+    } else {
+      break;
+    }
+  }
+  return value;
+}
 
-        // Get constant name
-        int name_start = i;
-        while (i < length && (isalnum(input[i]) || input[i] == '_')) {
-          i++;
-        }
-        int name_len = i - name_start;
-        char *name = strndup(&input[name_start], name_len);
+static long long define_expr_equality(struct DefineExpr *expr) {
+  long long value = define_expr_relational(expr);
+  while (!expr->error) {
+    if (define_expr_match(expr, "==")) {
+      value = value == define_expr_relational(expr);
+    } else if (define_expr_match(expr, "!=")) {
+      value = value != define_expr_relational(expr);
+    } else {
+      break;
+    }
+  }
+  return value;
+}
 
-        // Skip whitespace between name and value
-        while (i < length && (input[i] == ' ' || input[i] == '\t')) {
-          i++;
-        }
+static long long define_expr_logical_and(struct DefineExpr *expr) {
+  long long value = define_expr_equality(expr);
+  while (!expr->error && define_expr_match(expr, "&&")) {
+    long long rhs = define_expr_equality(expr);
+    value = value && rhs;
+  }
+  return value;
+}
 
-        // Get position of constant value
-        int value_start = i;
-        while (i < length && isdigit(input[i])) {
-          i++;
-        }
+static long long define_expr_logical_or(struct DefineExpr *expr) {
+  long long value = define_expr_logical_and(expr);
+  while (!expr->error && define_expr_match(expr, "||")) {
+    long long rhs = define_expr_logical_and(expr);
+    value = value || rhs;
+  }
+  return value;
+}
 
-        // Add to defines array
-        add_define(&defines, name, value_start, i);
-        free(name);
+// Evaluate the expression starting at *i, leaving *i after its last
+// character. Returns 0 and reports an error if it is not a valid constant
+// expression.
+static int evaluate_define(const char *input, int *i, int length,
+                           struct DefineTable *defines, struct Lexer *lexer,
+                           int *value) {
+  struct DefineExpr expr = {input, *i, length, defines, lexer, 0};
+  *value = (int)define_expr_logical_or(&expr);
+  int end = expr.i;
+  while (end > *i && (char_class[(unsigned char)input[end - 1]] & CHAR_SPACE)) {
+    end = end - 1;
+  }
+  if (!expr.error && define_expr_peek(&expr)) {
+    define_expr_error(&expr, "Unexpected character");
+  }
+  *i = end;
+  return !expr.error;
+}
 
-        // Skip to end of line
-        while (i < length && input[i] != '\n') {
-          i++;
-        }
-        if (i < length && input[i] == '\n') {
-          line++;
-          i++;
-        }
+// Read the directive whose '#' is at *position. Returns 1 after a #define,
+// with *position after it, 0 if it is not a #define, with *position after
+// the '#' and the spaces that follow it, and -1 after reporting an error.
+static int read_directive(struct Lexer *lexer, int *position) {
+  const char *input = lexer->input;
+  int length = lexer->length;
+  int i = *position + 1; // Skip #
+  // Skip whitespace after #
+  while (i < length && (char_class[(unsigned char)input[i]] & CHAR_SPACE)) {
+    i++;
+  }
+  *position = i;
+
+  // Check if it's a define directive, "define" being followed by a space
+  if (i + 6 >= length || strncmp(&input[i], "define", 6) != 0 ||
+      !(char_class[(unsigned char)input[i + 6]] & CHAR_SPACE)) {
+    return 0;
+  }
+  i += 6; // Skip "define"
+
+  // Skip whitespace after define
+  while (i < length && (char_class[(unsigned char)input[i]] & CHAR_SPACE)) {
+    i++;
+  }
+
+  // Get constant name
+  int name_start = i;
+  while (i < length && (char_class[(unsigned char)input[i]] & CHAR_IDENT)) {
+    i++;
+  }
+  int name_len = i - name_start;
+  if (name_len == 0) {
+    fprintf(stderr, "Line %d: Error: Expected name after #define\n",
+            source_line(lexer, i));
+    return -1;
+  }
+
+  // Already read by the lexer this one was copied from
+  if (lexer->defines_read) {
+    struct Define *define =
+        get_define(&lexer->defines, &input[name_start], name_len);
+    if (define) {
+      *position = define->end;
+      return 1;
+    }
+  }
+
+  // Skip whitespace between name and value
+  while (i < length && (char_class[(unsigned char)input[i]] & CHAR_SPACE)) {
+    i++;
+  }
+
+  // Evaluate the value once, substitutions reuse it
+  int value_start = i;
+  int value;
+  if (!evaluate_define(input, &i, length, &lexer->defines, lexer, &value)) {
+    return -1;
+  }
+  add_define(&lexer->defines, &input[name_start], name_len, value_start, i,
+             value);
+  *position = i;
+  return 1;
+}
+
+// Scan the next token into token. Returns 1 if there is one, 0 at the end of
+// the input and -1 after reporting a lexical error.
+int next_token(struct Lexer *lexer, struct Token *token) {
+  const char *input = lexer->input;
+  int length = lexer->length;
+  scan_function scan = lexer->scan;
+  int i = lexer->position;
+
+  while (i < length) {
+    // Skip whitespace
+    if (input[i] == ' ' || input[i] == '\t' || input[i] == '\n') {
+      i = scan(input, i, length, SCAN_WHITESPACE);
+      if (i >= length)
+        break;
+    }
+
+    unsigned char c = input[i];
+
+    // Handle #define directives
+    if (c == '#') {
+      int status = read_directive(lexer, &i);
+      if (status < 0) {
+        return -1;
+      } else if (status > 0) {
+        // A trailing comment and the newline are skipped as usual
         continue;
       }
     }
 
     // Handle comments
-    if (i + 1 < length && input[i] == '/') {
+    if (c == '/' && i + 1 < length) {
       if (input[i + 1] == '/') {
-        // Single-line comment
-        while (i < length && input[i] != '\n') {
-          i++;
-        }
-        if (i < length && input[i] == '\n')
-          line++;
+        // Single-line comment, the newline is left for the whitespace skip
+        i = scan(input, i + 2, length, SCAN_LINE_COMMENT);
         continue;
       } else if (input[i + 1] == '*') {
         // Multi-line comment
-        i += 2; // Skip /*
-        while (i + 1 < length && !(input[i] == '*' && input[i + 1] == '/')) {
-          if (input[i] == '\n')
-            line++;
-          i++;
-        }
-        if (i + 1 >= length) {
+        int comment_start = i;
+        i = scan(input, i + 2, length, SCAN_BLOCK_COMMENT);
+        if (i >= length) {
           fprintf(stderr, "Line %d: Error: Unterminated multi-line comment\n",
-                  line);
-          return 1;
+                  source_line(lexer, comment_start));
+          return -1;
         }
         i += 2; // Skip */
         continue;
       }
     }
 
-    // Create token with current position
-    struct Token token;
-    token.start = i;
-    token.line = line;
+    // Token starting at the current position
+    int start = i;
+    int type;
 
-    // Single character tokens
-    if (input[i] == '{') {
-      token.type = TOKEN_LEFT_BRACE;
-      i++;
-    } else if (input[i] == '}') {
-      token.type = TOKEN_RIGHT_BRACE;
-      i++;
-    } else if (input[i] == '(') {
-      token.type = TOKEN_LEFT_PAREN;
-      i++;
-    } else if (input[i] == ')') {
-      token.type = TOKEN_RIGHT_PAREN;
-      i++;
-    } else if (input[i] == ';') {
-      token.type = TOKEN_SEMICOLON;
-      i++;
-    } else if (input[i] == ',') {
-      token.type = TOKEN_COMMA;
-      i++;
-    } else if (input[i] == '.') {
-      token.type = TOKEN_PERIOD;
-      i++;
-    } else if (input[i] == '[') {
-      token.type = TOKEN_LEFT_BRACKET;
-      i++;
-    } else if (input[i] == ']') {
-      token.type = TOKEN_RIGHT_BRACKET;
-      i++;
-    }
-    // Arithmetic operators
-    else if (input[i] == '+') {
-      token.type = TOKEN_PLUS;
-      i++;
-    } else if (input[i] == '-') {
-      token.type = TOKEN_MINUS;
-      i++;
-    } else if (input[i] == '*') {
-      token.type = TOKEN_MULTIPLY;
-      i++;
-    } else if (input[i] == '/') {
-      token.type = TOKEN_DIVIDE;
-      i++;
-    }
-    // Comparison operators
-    else if (input[i] == '=') {
-      i++;
-      if (i < length && input[i] == '=') {
-        token.type = TOKEN_EQUAL_EQUAL;
-        i++;
-      } else {
-        token.type = TOKEN_EQUAL;
-      }
-    } else if (input[i] == '!') {
-      i++;
-      if (i < length && input[i] == '=') {
-        token.type = TOKEN_NOT_EQUAL;
-        i++;
-      } else {
-        fprintf(stderr,
-                "Line %d: Error: Expected '=' after '!' at position %d\n", line,
-                i);
-        return 1;
+    int cls = char_class[c];
+    if (cls & CHAR_IDENT_START) {
+      // Identifiers and keywords
+      i = scan(input, i + 1, length, SCAN_IDENTIFIER);
+
+      type = lookup_keyword(&input[start], i - start);
+      if (!type) {
+        struct Define *define =
+            get_define(&lexer->defines, &input[start], i - start);
+        if (define && define->start < start) {
+          // Replace the constant with its value, keeping the position of
+          // the name for diagnostics
+          set_token(lexer, token, TOKEN_LITERAL_INT, start, i - start,
+                    TOKEN_FLAG_EXTRA, define->value);
+          lexer->position = i;
+          return 1;
+        }
+        type = TOKEN_IDENTIFIER;
       }
-    } else if (input[i] == '<') {
-      i++;
-      if (i < length && input[i] == '=') {
-        token.type = TOKEN_LESS_EQUAL;
+    } else if (cls & CHAR_DIGIT) {
+      // Numbers, the value is decoded from the text when needed
+      type = TOKEN_LITERAL_INT;
+      while (i < length && (char_class[(unsigned char)input[i]] & CHAR_DIGIT)) {
         i++;
-      } else {
-        token.type = TOKEN_LESS;
       }
-    } else if (input[i] == '>') {
+    } else if (single_char_token[c]) {
+      type = single_char_token[c];
       i++;
-      if (i < length && input[i] == '=') {
-        token.type = TOKEN_GREATER_EQUAL;
-        i++;
-      } else {
-        token.type = TOKEN_GREATER;
-      }
-    } else if (input[i] == '|') {
+    } else if (operator_second_char[c]) {
+      // Comparison and logical operators
       i++;
-      if (i < length && input[i] == '|') {
-        token.type = TOKEN_LOGICAL_OR;
+      if (i < length && input[i] == operator_second_char[c]) {
+        type = operator_double_token[c];
         i++;
+      } else if (operator_single_token[c]) {
+        type = operator_single_token[c];
       } else {
         fprintf(stderr,
-                "Line %d: Error: Expected '|' after '|' at position %d\n", line,
-                i);
-        return 1;
-      }
-    } else if (input[i] == '&') {
-      i++;
-      if (i < length && input[i] == '&') {
-        token.type = TOKEN_LOGICAL_AND;
-        i++;
-      } else {
-        token.type = TOKEN_AMPERSAND;
+                "Line %d: Error: Expected '%c' after '%c' at position %d\n",
+                source_line(lexer, i), operator_second_char[c], c, i);
+        return -1;
       }
     }
     // String literals
-    else if (input[i] == '"') {
-      token.type = TOKEN_LITERAL_STRING;
-      i++;
-      while (i < length && input[i] != '"') {
-        if (input[i] == '\n')
-          line++;
-        if (input[i] == '\\' && i + 1 < length) {
-          i += 2;
-        } else {
-          i++;
-        }
+    else if (c == '"') {
+      type = TOKEN_LITERAL_STRING;
+      i = scan(input, i + 1, length, SCAN_STRING);
+      while (i < length && input[i] == '\\') {
+        // Skip the escaped character and continue scanning
+        i = scan(input, i + 2, length, SCAN_STRING);
       }
       if (i < length && input[i] == '"') {
         i++;
       } else {
         fprintf(stderr, "Line %d: Error: Unterminated string at position %d\n",
-                line, token.start);
-        return 1;
+                source_line(lexer, start), start);
+        return -1;
       }
     }
     // Character literals
-    else if (input[i] == '\'') {
-      token.type = TOKEN_LITERAL_CHAR;
+    else if (c == '\'') {
+      type = TOKEN_LITERAL_CHAR;
       i++;
       if (i < length && input[i] == '\\') {
         i += 2;
@@ -309,53 +826,313 @@ int lex(char *input, int length, struct TokenArray *tokens) {
         fprintf(
             stderr,
             "Line %d: Error: Unterminated character literal at position %d\n",
-            line, token.start);
-        return 1;
+            source_line(lexer, start), start);
+        return -1;
       }
     }
-    // Numbers
-    else if (isdigit(input[i])) {
-      token.type = TOKEN_LITERAL_INT;
-      while (i < length && isdigit(input[i])) {
-        i++;
+    // Unexpected characters
+    else {
+      fprintf(stderr,
+              "Line %d: Error: Unexpected character '%c' at position %d\n",
+              source_line(lexer, i), input[i], i);
+      return -1;
+    }
+
+    set_token(lexer, token, type, start, i - start, 0, 0);
+    lexer->position = i;
+    return 1;
+  }
+
+  lexer->position = length;
+  return 0;
+}
+
+// Outline of the input: where the top-level blocks, which are the function
+// bodies, open and close, and where the directives are. Finding it only needs
+// the comments, strings and character literals to be skipped, not the tokens,
+// so chunks of the input are scanned on several threads. A chunk starts at
+// the beginning of a line, which is either code, inside a block comment or
+// inside a string; each chunk is scanned once for each of those states and
+// the scans that match are joined up afterwards.
+
+#define OUTLINE_CODE 0
+#define OUTLINE_COMMENT 1 // Inside a block comment
+#define OUTLINE_STRING 2  // Inside a string literal
+#define OUTLINE_STATES 3
+
+// Chunks are at least this large
+#define OUTLINE_CHUNK_SIZE 65536
+
+struct Outline {
+  int *bodies; // Offsets of the '{' and the '}' of each top-level block
+  int body_count;
+  int *directives; // Offsets of the '#' of each directive
+  int directive_count;
+};
+
+// Result of scanning a chunk from one state
+struct OutlineRun {
+  int *braces; // Offset of each '{', and -1 - offset of each '}'
+  int brace_count;
+  int brace_capacity;
+  int *directives;
+  int directive_count;
+  int directive_capacity;
+  int state; // State where the scan stopped
+  int stop;  // Offset where the scan stopped
+};
+
+struct OutlineChunk {
+  int start;
+  int end; // Just after a newline, or the end of the input
+  struct OutlineRun runs[OUTLINE_STATES];
+};
+
+struct OutlineScan {
+  const struct Lexer *lexer;
+  struct OutlineChunk *chunks;
+  int count;
+  atomic_int next; // Index of the next chunk and state to scan
+};
+
+// Characters that can start a comment, string, character literal, block or
+// directive
+static const char outline_stop[256] = {['/'] = 1, ['"'] = 1, ['\''] = 1,
+                                       ['{'] = 1, ['}'] = 1, ['#'] = 1};
+
+static void outline_push(int **values, int *count, int *capacity, int value) {
+  if (*count == *capacity) {
+    *capacity = *capacity == 0 ? 64 : *capacity * 2;
+    *values = realloc(*values, *capacity * sizeof(int));
+    if (!*values) {
+      fprintf(stderr, "Error: memory allocation failed\n");
+      exit(1);
+    }
+  }
+  (*values)[(*count)++] = value;
+}
+
+// Scan input[start, end) starting in the given state. The lexer's rules for
+// comments, strings and character literals are followed exactly, errors are
+// left for the lexer to report. The scan stops at end, or after an escape or
+// character literal that crosses it.
+static void scan_outline(const struct Lexer *lexer, int start, int end,
+                         int state, struct OutlineRun *run) {
+  const char *input = lexer->input;
+  int length = lexer->length;
+  scan_function scan = lexer->scan;
+  int i = start;
+  run->brace_count = 0;
+  run->directive_count = 0;
+
+  while (i < end) {
+    if (state == OUTLINE_COMMENT) {
+      i = scan(input, i, length, SCAN_BLOCK_COMMENT);
+      if (i >= end) {
+        i = end; // The comment goes on into the next chunk
+        break;
+      }
+      i += 2; // Skip */
+      state = OUTLINE_CODE;
+      continue;
+    } else if (state == OUTLINE_STRING) {
+      i = scan(input, i, length, SCAN_STRING);
+      if (i >= end) {
+        i = end;
+        break;
+      }
+      if (input[i] == '\\') {
+        i += 2; // Skip the escaped character
+      } else {
+        i++; // Closing quote
+        state = OUTLINE_CODE;
       }
+      continue;
     }
-    // Identifiers and keywords
-    else if (isalpha(input[i]) || input[i] == '_') {
-      while (i < length && (isalnum(input[i]) || input[i] == '_')) {
+
+    while (i < end && !outline_stop[(unsigned char)input[i]]) {
+      i++;
+    }
+    if (i >= end) {
+      break;
+    }
+    char c = input[i];
+    if (c == '/' && i + 1 < length && input[i + 1] == '/') {
+      i = scan(input, i + 2, length, SCAN_LINE_COMMENT);
+    } else if (c == '/' && i + 1 < length && input[i + 1] == '*') {
+      i += 2;
+      state = OUTLINE_COMMENT;
+    } else if (c == '"') {
+      i++;
+      state = OUTLINE_STRING;
+    } else if (c == '\'') {
+      i++;
+      if (i < length && input[i] == '\\') {
+        i += 2;
+      } else {
+        i++;
+      }
+      if (i < length && input[i] == '\'') {
         i++;
       }
+    } else if (c == '{') {
+      outline_push(&run->braces, &run->brace_count, &run->brace_capacity, i);
+      i++;
+    } else if (c == '}') {
+      outline_push(&run->braces, &run->brace_count, &run->brace_capacity,
+                   -1 - i);
+      i++;
+    } else if (c == '#') {
+      outline_push(&run->directives, &run->directive_count,
+                   &run->directive_capacity, i);
+      i++;
+    } else {
+      i++;
+    }
+  }
+
+  run->state = state;
+  run->stop = i;
+}
+
+static void *outline_worker(void *arg) {
+  struct OutlineScan *scan = arg;
+  int task;
+  while ((task = atomic_fetch_add(&scan->next, 1)) <
+         scan->count * OUTLINE_STATES) {
+    struct OutlineChunk *chunk = &scan->chunks[task / OUTLINE_STATES];
+    int state = task % OUTLINE_STATES;
+    // The input starts in code
+    if (chunk->start > 0 || state == OUTLINE_CODE) {
+      scan_outline(scan->lexer, chunk->start, chunk->end, state,
+                   &chunk->runs[state]);
+    }
+  }
+  return NULL;
+}
+
+// Find the outline of the input on jobs threads. The arrays of the outline
+// are allocated from arena. Returns 0 if the braces are not balanced or a
+// comment or string is not terminated, which the lexer and parser report.
+int outline_input(const struct Lexer *lexer, int jobs, struct Arena *arena,
+                  struct Outline *outline) {
+  const char *input = lexer->input;
+  int length = lexer->length;
+
+  // Cut the input after the newline closest to each even share
+  int count = length / OUTLINE_CHUNK_SIZE + 1;
+  if (count > jobs * 4) {
+    count = jobs * 4;
+  }
+  struct OutlineChunk *chunks = calloc(count, sizeof(struct OutlineChunk));
+  if (!chunks) {
+    fprintf(stderr, "Error: memory allocation failed\n");
+    exit(1);
+  }
+  int start = 0;
+  int i = 0;
+  while (i < count) {
+    int end = (int)((long long)length * (i + 1) / count);
+    if (end < start) {
+      end = start;
+    }
+    const char *newline = memchr(input + end, '\n', length - end);
+    end = i + 1 < count && newline ? newline - input + 1 : length;
+    chunks[i].start = start;
+    chunks[i].end = end;
+    start = end;
+    i++;
+  }
+
+  struct OutlineScan scan;
+  scan.lexer = lexer;
+  scan.chunks = chunks;
+  scan.count = count;
+  atomic_init(&scan.next, 0);
+  run_workers(outline_worker, &scan, 0, jobs);
 
-      int len = i - token.start;
-      if (strncmp(&input[token.start], "return", len) == 0 && len == 6) {
-        token.type = TOKEN_RETURN;
-      } else if (strncmp(&input[token.start], "if", len) == 0 && len == 2) {
-        token.type = TOKEN_IF;
-      } else if (strncmp(&input[token.start], "else", len) == 0 && len == 4) {
-        token.type = TOKEN_ELSE;
-      } else if (strncmp(&input[token.start], "while", len) == 0 && len == 5) {
-        token.type = TOKEN_WHILE;
-      } else if (strncmp(&input[token.start], "struct", len) == 0 && len == 6) {
-        token.type = TOKEN_STRUCT;
-      } else if (get_define_start_end(&defines, &input[token.start], len,
-                                      &token.start, &token.end)) {
-        token.type = TOKEN_LITERAL_INT;
+  // Follow the chunks from the start, taking the scan of each chunk that
+  // starts in the state the one before it ended in. When an escape or
+  // character literal runs into the next chunk, that chunk is scanned again
+  // from where it ended.
+  struct OutlineRun joined = {NULL, 0, 0, NULL, 0, 0, 0, 0};
+  struct OutlineRun rescan = {NULL, 0, 0, NULL, 0, 0, 0, 0};
+  int state = OUTLINE_CODE;
+  int position = 0;
+  int depth = 0;
+  int balanced = 1;
+  i = 0;
+  while (i < count && balanced) {
+    struct OutlineChunk *chunk = &chunks[i];
+    i++;
+    struct OutlineRun *run = &chunk->runs[state];
+    if (position > chunk->start) {
+      if (position >= chunk->end) {
+        continue;
+      }
+      scan_outline(lexer, position, chunk->end, state, &rescan);
+      run = &rescan;
+    }
+
+    // Keep the braces of the top-level blocks
+    int j = 0;
+    while (j < run->brace_count) {
+      int brace = run->braces[j];
+      if (brace >= 0) {
+        if (depth == 0) {
+          outline_push(&joined.braces, &joined.brace_count,
+                       &joined.brace_capacity, brace);
+        }
+        depth++;
+      } else if (depth == 0) {
+        balanced = 0;
+        break;
       } else {
-        token.type = TOKEN_IDENTIFIER;
+        depth--;
+        if (depth == 0) {
+          outline_push(&joined.braces, &joined.brace_count,
+                       &joined.brace_capacity, -1 - brace);
+        }
       }
+      j++;
     }
-    // Unexpected characters
-    else {
-      fprintf(stderr,
-              "Line %d: Error: Unexpected character '%c' at position %d\n",
-              line, input[i], i);
-      return 1;
+    j = 0;
+    while (j < run->directive_count) {
+      outline_push(&joined.directives, &joined.directive_count,
+                   &joined.directive_capacity, run->directives[j]);
+      j++;
     }
+    state = run->state;
+    position = run->stop;
+  }
 
-    token.end = i;
-    add_token(tokens, token);
+  outline->body_count = joined.brace_count / 2;
+  outline->bodies = arena_alloc(arena, (joined.brace_count + 1) * sizeof(int));
+  outline->directive_count = joined.directive_count;
+  outline->directives =
+      arena_alloc(arena, (joined.directive_count + 1) * sizeof(int));
+  if (joined.brace_count) {
+    memcpy(outline->bodies, joined.braces, joined.brace_count * sizeof(int));
+  }
+  if (joined.directive_count) {
+    memcpy(outline->directives, joined.directives,
+           joined.directive_count * sizeof(int));
   }
 
-  free_define_array(&defines);
-  return 0;
+  i = 0;
+  while (i < count) {
+    int s = 0;
+    while (s < OUTLINE_STATES) {
+      free(chunks[i].runs[s].braces);
+      free(chunks[i].runs[s].directives);
+      s++;
+    }
+    i++;
+  }
+  free(chunks);
+  free(joined.braces);
+  free(joined.directives);
+  free(rescan.braces);
+  free(rescan.directives);
+  return balanced && depth == 0 && state == OUTLINE_CODE;
 }
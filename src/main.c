@@ -1,9 +1,20 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <setjmp.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
+#include "arena.h"
+#include "ast.h"
+#include "cache.h"
 #include "codegen.h"
+#include "fail.h"
+#include "intern.h"
 #include "lexer.h"
 #include "parser.h"
 #include "print_assembly.h"
@@ -11,134 +22,727 @@
 #include "print_sema.h"
 #include "print_tokens.h"
 #include "sema.h"
+#include "source.h"
+#include "type.h"
+#include "workers.h"
 
-int main(int argc, char *argv[]) {
-  char *input = NULL;
-  size_t length = 0;
+// Command line options that apply to every input
+struct Options {
+  bool print_tokens;
+  bool print_ast;
+  bool print_sema;
+  bool only_reachable;
+  bool single_pass;
+  bool stream;
+  int jobs; // Threads for each phase or --stream stage, or for a batch
+  const char *cache;     // Directory of the compile cache, or NULL
+  long long cache_limit; // Bytes the cache entries may take up
+};
 
-  bool print_tokens_flag = false;
-  bool print_ast_flag = false;
-  bool print_sema_flag = false;
-  char *filename = NULL;
-  int flag_count = 0;
+// Functions that can be in the pipeline at once, see run_pipeline
+#define PIPELINE_DEPTH 8
 
-  // Parse command line arguments
-  for (int i = 1; i < argc; i++) {
-    if (strcmp(argv[i], "--print-tokens") == 0) {
-      print_tokens_flag = true;
-      flag_count++;
-    } else if (strcmp(argv[i], "--print-ast") == 0) {
-      print_ast_flag = true;
-      flag_count++;
-    } else if (strcmp(argv[i], "--print-sema") == 0) {
-      print_sema_flag = true;
-      flag_count++;
+// Stages of the pipeline, in the order each function goes through them
+#define STAGE_PARSE 0
+#define STAGE_ANALYZE 1
+#define STAGE_GENERATE 2
+#define STAGE_EMIT 3
+#define STAGE_COUNT 4
+
+// A function on its way through the pipeline
+struct PipelineItem {
+  struct Arena arena; // Everything allocated for the function
+  struct FlatAST *ast;
+  struct Section *text;
+  bool generate; // No errors so far, so the code is generated
+};
+
+struct Pipeline {
+  // Function n is in items[n % PIPELINE_DEPTH]
+  struct PipelineItem items[PIPELINE_DEPTH];
+  atomic_int done[STAGE_COUNT]; // Number of functions each stage finished
+  atomic_int busy[STAGE_COUNT]; // Set while a thread runs the stage
+  atomic_int count;             // Number of functions, or -1 until all parsed
+  atomic_int failed;            // Set by a syntax or code generation error
+  atomic_int stop;              // Set by a code generation error
+  // Idle workers wait on progress until a stage has run again
+  pthread_mutex_t lock;
+  pthread_cond_t progress;
+  atomic_int generation; // Number of stages run, changes under lock
+  struct Parser *parser;
+  struct SemanticContext *context;
+  struct Assembly *assembly;
+  struct Emitter *out;
+  bool single_pass;
+  struct Interner *interner;
+  struct TypeTable *types;
+};
+
+// Run stage on function n
+static void run_stage(struct Pipeline *pipeline, int stage, int n) {
+  struct PipelineItem *item = &pipeline->items[n % PIPELINE_DEPTH];
+  struct SemanticContext *context = pipeline->context;
+  if (stage == STAGE_PARSE) {
+    // With --single-pass the function is also analyzed here
+    pipeline->parser->arena = &item->arena;
+    if (pipeline->single_pass) {
+      context->locals_arena = &item->arena;
+    }
+    struct ASTNode *function = parse_next_function(pipeline->parser);
+    if (!function) {
+      atomic_store(&pipeline->count, n);
+      return;
+    }
+    item->ast = flatten_ast(function, &item->arena);
+    if (pipeline->single_pass) {
+      item->generate = !context->had_error;
+    }
+  } else if (stage == STAGE_ANALYZE) {
+    if (!pipeline->single_pass) {
+      context->locals_arena = &item->arena;
+      analyze_functions(context, item->ast);
+      // After an error the remaining functions are only checked
+      item->generate = !context->had_error;
+    }
+  } else if (stage == STAGE_GENERATE) {
+    if (item->generate) {
+      item->text = create_section(&item->arena, ".text");
+      generate_function(item->text, item->ast, 1, pipeline->assembly);
+    }
+  } else {
+    if (item->generate) {
+      emit_section(pipeline->out, item->text);
+    }
+    arena_reset(&item->arena);
+  }
+  atomic_store_explicit(&pipeline->done[stage], n + 1, memory_order_release);
+}
+
+// Run stage on its next function if no other thread is running it and the
+// function is ready for it. Returns whether it ran.
+static bool try_stage(struct Pipeline *pipeline, int stage) {
+  int idle = 0;
+  if (!atomic_compare_exchange_strong(&pipeline->busy[stage], &idle, 1)) {
+    return false;
+  }
+  int n = atomic_load_explicit(&pipeline->done[stage], memory_order_relaxed);
+  bool ready;
+  if (stage == STAGE_PARSE) {
+    // The function's item must have been emitted
+    ready = atomic_load(&pipeline->count) < 0 &&
+            n - atomic_load_explicit(&pipeline->done[STAGE_EMIT],
+                                     memory_order_acquire) <
+                PIPELINE_DEPTH;
+  } else {
+    ready = n < atomic_load_explicit(&pipeline->done[stage - 1],
+                                     memory_order_acquire);
+  }
+
+  if (ready) {
+    jmp_buf *outer_recovery = compilation_recovery;
+    jmp_buf recovery;
+    if (setjmp(recovery)) {
+      // A syntax error ends the input, the functions before it still go
+      // through the other stages. Anything else stops the pipeline.
+      atomic_store(&pipeline->failed, 1);
+      if (stage == STAGE_PARSE) {
+        atomic_store(&pipeline->count, n);
+      } else {
+        atomic_store(&pipeline->stop, 1);
+      }
     } else {
-      if (filename != NULL) {
-        fprintf(stderr, "Error: Multiple input files specified\n");
-        return 1;
+      compilation_recovery = &recovery;
+      run_stage(pipeline, stage, n);
+    }
+    compilation_recovery = outer_recovery;
+  }
+  atomic_store_explicit(&pipeline->busy[stage], 0, memory_order_release);
+  if (ready) {
+    // A stage moving on can make the next one ready, wake the idle workers
+    pthread_mutex_lock(&pipeline->lock);
+    atomic_fetch_add(&pipeline->generation, 1);
+    pthread_cond_broadcast(&pipeline->progress);
+    pthread_mutex_unlock(&pipeline->lock);
+  }
+  return ready;
+}
+
+static void *pipeline_worker(void *arg) {
+  struct Pipeline *pipeline = arg;
+  use_interner(pipeline->interner);
+  use_types(pipeline->types);
+  while (!atomic_load(&pipeline->stop)) {
+    int count = atomic_load(&pipeline->count);
+    if (count >= 0 && atomic_load(&pipeline->done[STAGE_EMIT]) >= count) {
+      break;
+    }
+    // Read before looking for work, so that progress made while looking
+    // keeps the worker from waiting
+    int generation = atomic_load(&pipeline->generation);
+    // Later stages go first, so that the functions in flight move on
+    int stage = STAGE_COUNT - 1;
+    while (stage >= 0 && !try_stage(pipeline, stage)) {
+      stage--;
+    }
+    if (stage < 0) {
+      pthread_mutex_lock(&pipeline->lock);
+      while (atomic_load(&pipeline->generation) == generation) {
+        pthread_cond_wait(&pipeline->progress, &pipeline->lock);
       }
-      filename = argv[i];
+      pthread_mutex_unlock(&pipeline->lock);
     }
   }
+  // Wake the others, so that they see the pipeline is finished
+  pthread_mutex_lock(&pipeline->lock);
+  atomic_fetch_add(&pipeline->generation, 1);
+  pthread_cond_broadcast(&pipeline->progress);
+  pthread_mutex_unlock(&pipeline->lock);
+  return NULL;
+}
 
-  if (filename == NULL) {
-    fprintf(stderr,
-            "Usage: %s [--print-tokens] [--print-ast] [--print-sema] <file>\n",
-            argv[0]);
-    return 1;
+// Compile the functions read by parser with the stages overlapping on up to
+// jobs threads: while one function is parsed, the one before it is analyzed,
+// the one before that generated and the one before that written out. Each
+// function keeps an item of the pipeline from being parsed to being written
+// out, so at most PIPELINE_DEPTH functions are in flight, and the item's
+// arena is reset for the next one. A stage runs on one thread at a time and
+// takes the functions in order, so every function goes through the stages
+// as it would one at a time. The threads are not tied to a stage: each one
+// runs whichever stage has work, preferring the later ones, and waits for
+// another stage to finish when none has.
+static void run_pipeline(struct Parser *parser,
+                         struct SemanticContext *context,
+                         struct Assembly *assembly, struct Emitter *out,
+                         bool single_pass, int jobs) {
+  struct Pipeline *pipeline = malloc(sizeof(struct Pipeline));
+  if (!pipeline) {
+    fprintf(stderr, "Error: memory allocation failed\n");
+    exit(1);
+  }
+  int i = 0;
+  while (i < PIPELINE_DEPTH) {
+    arena_init(&pipeline->items[i].arena);
+    i++;
   }
+  i = 0;
+  while (i < STAGE_COUNT) {
+    atomic_init(&pipeline->done[i], 0);
+    atomic_init(&pipeline->busy[i], 0);
+    i++;
+  }
+  atomic_init(&pipeline->count, -1);
+  atomic_init(&pipeline->failed, 0);
+  atomic_init(&pipeline->stop, 0);
+  pthread_mutex_init(&pipeline->lock, NULL);
+  pthread_cond_init(&pipeline->progress, NULL);
+  atomic_init(&pipeline->generation, 0);
+  pipeline->parser = parser;
+  pipeline->context = context;
+  pipeline->assembly = assembly;
+  pipeline->out = out;
+  pipeline->single_pass = single_pass;
+  pipeline->interner = current_interner();
+  pipeline->types = current_types();
 
-  if (flag_count > 1) {
-    fprintf(stderr, "Error: Only one print flag can be specified\n");
-    return 1;
+  // A thread for each stage is enough
+  if (jobs > STAGE_COUNT) {
+    jobs = STAGE_COUNT;
   }
+  run_workers(pipeline_worker, pipeline, 0, jobs);
 
-  // Open the file specified by the user
-  FILE *file = fopen(filename, "r");
-  if (!file) {
-    fprintf(stderr, "Error: could not open file '%s'\n", filename);
-    return 1;
+  bool failed = atomic_load(&pipeline->failed);
+  pthread_mutex_destroy(&pipeline->lock);
+  pthread_cond_destroy(&pipeline->progress);
+  i = 0;
+  while (i < PIPELINE_DEPTH) {
+    arena_free(&pipeline->items[i].arena);
+    i++;
   }
+  free(pipeline);
+  if (failed) {
+    fail_compilation();
+  }
+}
 
-  // Determine the file size
-  fseek(file, 0, SEEK_END);
-  length = ftell(file);
-  rewind(file);
+// Compile the program one function at a time: each function is parsed,
+// analyzed, generated and written out before the next one is read, and
+// everything allocated for it is released. Only the function symbols, string
+// literals and externs are kept until the end, where the data section
+// follows the code. With more than one job the stages overlap, see
+// run_pipeline. The assembly is written to the file descriptor output.
+// Returns the exit status.
+static int compile_streaming(struct Lexer *lexer, const char *input,
+                             struct CompilerArenas *arenas, bool single_pass,
+                             int jobs, int output) {
+  struct SemanticContext *context = create_semantic_context(&arenas->sema);
+  context->locals_arena = &arenas->function;
+  struct Assembly *assembly = create_assembly(&arenas->codegen);
+  add_extern_symbol(assembly, "printf");
 
-  // Allocate memory for the file content
-  input = malloc(length + 1);
-  if (!input) {
-    fprintf(stderr, "Error: memory allocation failed\n");
-    fclose(file);
-    return 1;
+  struct Parser parser;
+  init_parser(&parser, lexer, input, &arenas->function);
+  if (single_pass) {
+    parser.sema = context;
   }
 
-  // Read the file content into the input buffer
-  size_t read_length = fread(input, 1, length, file);
-  input[read_length] = '\0';
-  fclose(file);
+  struct Emitter out;
+  init_emitter(&out, output);
+  emit_text_header(&out);
 
-  struct TokenArray tokens;
-  int status = lex(input, strlen(input), &tokens);
-  if (status != 0) {
-    free(input);
-    return 1;
+  struct ASTNode *function;
+  if (jobs > 1) {
+    run_pipeline(&parser, context, assembly, &out, single_pass, jobs);
+  } else {
+    while ((function = parse_next_function(&parser))) {
+      struct FlatAST *flat_ast = flatten_ast(function, &arenas->function);
+      if (!single_pass) {
+        analyze_functions(context, flat_ast);
+      }
+
+      // After an error the remaining functions are only checked
+      if (!context->had_error) {
+        struct Section *text = create_section(&arenas->function, ".text");
+        generate_function(text, flat_ast, 1, assembly);
+        emit_section(&out, text);
+      }
+      arena_reset(&arenas->function);
+    }
+  }
+
+  emit_bytes(&out, "\n", 1);
+  emit_data(&out, assembly);
+  emit_externs(&out, assembly);
+  int result = finish_emitter(&out);
+  if (!finish_analysis(context)) {
+    fprintf(stderr, "Semantic analysis failed\n");
+    result = 1;
+  }
+  return result;
+}
+
+// Compile source and write the assembly to the file descriptor output. The
+// print flags write to stdout instead. Returns the exit status.
+static int compile_source(struct SourceFile *source,
+                          const struct Options *options, int output) {
+  const char *input = source->data;
+
+  // Every phase allocates from its own arena; all of them are released in
+  // one go once the compilation is finished.
+  struct CompilerArenas arenas;
+  init_compiler_arenas(&arenas);
+  init_interner();
+  init_types();
+  int result = 0;
+
+  // Errors that abandon the compilation resume here, see fail_compilation
+  jmp_buf recovery;
+  if (setjmp(recovery)) {
+    result = 1;
+    goto cleanup;
+  }
+  compilation_recovery = &recovery;
+
+  // Tokens are scanned as the parser asks for them
+  struct Lexer lexer;
+  init_lexer(&lexer, input, source->length, &arenas.lex);
+
+  if (options->print_tokens) {
+    result = print_tokens(&lexer, input);
+    goto cleanup;
   }
 
-  if (print_tokens_flag) {
-    print_tokens(tokens, input);
-    free(input);
-    free(tokens.tokens);
-    return 0;
+  // The printing flags need the whole program, so --stream only applies when
+  // generating code
+  if (options->stream && !options->print_ast && !options->print_sema) {
+    result = compile_streaming(&lexer, input, &arenas, options->single_pass,
+                               options->jobs, output);
+    goto cleanup;
   }
 
-  // Call the parser
-  struct ASTNode *ast = parse(&tokens, input);
+  // Call the parser. With --only-reachable, functions that main can never
+  // call are skipped without being parsed or analyzed. With --single-pass,
+  // semantic analysis is done by the parser as it goes. With -j the function
+  // bodies are parsed on several threads.
+  struct SemanticContext *sema_context = NULL;
+  struct ASTNode *ast;
+  if (options->only_reachable) {
+    ast = parse_reachable(&lexer, input, &arenas.parse);
+  } else if (options->single_pass) {
+    sema_context = create_semantic_context(&arenas.sema);
+    ast = parse_and_analyze(&lexer, input, &arenas.parse, sema_context);
+  } else if (options->jobs > 1) {
+    ast = parse_parallel(&lexer, input, &arenas.parse, options->jobs);
+  } else {
+    ast = parse(&lexer, input, &arenas.parse);
+  }
   if (!ast) {
     fprintf(stderr, "Parsing failed\n");
-    free(tokens.tokens);
-    free(input);
-    return 1;
+    result = 1;
+    goto cleanup;
   }
 
-  if (print_ast_flag) {
+  if (options->print_ast) {
     print_ast(ast, 0);
-    free_ast(ast);
-    free(tokens.tokens);
-    free(input);
-    return 0;
+    goto cleanup;
   }
 
-  // Perform semantic analysis
-  struct SemanticContext *sema_context = analyze_program(ast);
+  // Lower to the flat AST used by the later phases, the pointer AST is not
+  // needed any more
+  struct FlatAST *flat_ast = flatten_ast(ast, &arenas.ast);
+  arena_free(&arenas.parse);
+
+  // Perform semantic analysis on options->jobs threads, or finish the
+  // analysis done while parsing
+  if (sema_context) {
+    sema_context = finish_analysis(sema_context);
+    if (sema_context) {
+      sema_context->ast = flat_ast;
+    }
+  } else {
+    sema_context = analyze_program(flat_ast, &arenas.sema, options->jobs);
+  }
   if (!sema_context) {
     fprintf(stderr, "Semantic analysis failed\n");
-    free_ast(ast);
-    free(tokens.tokens);
-    free(input);
-    return 1;
+    result = 1;
+    goto cleanup;
   }
 
-  if (print_sema_flag) {
+  if (options->print_sema) {
     print_semantic_context(sema_context);
-    free_ast(ast);
-    free(tokens.tokens);
-    free(input);
-    // Note: Should properly free sema_context here - requires additional
-    // cleanup functions
-    return 0;
+    goto cleanup;
+  }
+
+  // Generate assembly code, on options->jobs threads
+  struct Assembly *assembly =
+      generate_code(flat_ast, &arenas.codegen, options->jobs);
+  result = print_assembly(output, assembly);
+
+cleanup:
+  compilation_recovery = NULL;
+  free_compiler_arenas(&arenas);
+  free_types();
+  free_interner();
+  return result;
+}
+
+// Compile the file named filename, or standard input if it is "-", and write
+// the assembly to the file descriptor output. With a cache, a source that
+// was compiled before is not compiled again, see cache.h. Returns the exit
+// status.
+static int compile_file(const char *filename, const struct Options *options,
+                        int output) {
+  // Map the file, or read it if it is a pipe or standard input
+  struct SourceFile source;
+  if (read_source(&source, filename)) {
+    return 1;
+  }
+
+  int result;
+  if (options->cache && !options->print_tokens && !options->print_ast &&
+      !options->print_sema) {
+    // -j does not change the output
+    char config[64];
+    snprintf(config, sizeof(config),
+             "only_reachable=%d single_pass=%d stream=%d",
+             options->only_reachable, options->single_pass, options->stream);
+    char name[CACHE_NAME_LENGTH + 1];
+    cache_entry_name(config, source.data, source.length, name);
+    int found = cache_fetch(options->cache, name, output);
+    if (found) {
+      release_source(&source);
+      return found < 0;
+    }
+
+    // Compile into a new entry, which is only added once it is complete. If
+    // the cache cannot be written the source is compiled without it.
+    char path[PATH_MAX];
+    int fd = cache_create(options->cache, path);
+    if (fd >= 0) {
+      result = compile_source(&source, options, fd);
+      if (result == 0) {
+        result = cache_copy(fd, output);
+      }
+      close(fd);
+      if (result == 0) {
+        cache_store(options->cache, path, name, options->cache_limit);
+      } else {
+        unlink(path);
+      }
+      release_source(&source);
+      return result;
+    }
+  }
+  result = compile_source(&source, options, output);
+  release_source(&source);
+  return result;
+}
+
+// Inputs of a batch compilation, which are handed out to the workers one at
+// a time. Each input is compiled to a file of the same name ending in .s.
+struct Batch {
+  char **inputs;
+  int count;
+  const struct Options *options;
+  atomic_int next;   // Index of the next input to compile
+  atomic_int failed; // Set once any input fails
+};
+
+// Name of the assembly file for input: a trailing .c is replaced by .s,
+// anything else gets .s appended
+static char *output_name(const char *input) {
+  size_t length = strlen(input);
+  if (length > 2 && strcmp(input + length - 2, ".c") == 0) {
+    length = length - 2;
   }
+  char *name = malloc(length + 3);
+  if (!name) {
+    fprintf(stderr, "Error: memory allocation failed\n");
+    exit(1);
+  }
+  memcpy(name, input, length);
+  memcpy(name + length, ".s", 3);
+  return name;
+}
+
+static void *batch_worker(void *arg) {
+  struct Batch *batch = arg;
+  int index;
+  while ((index = atomic_fetch_add(&batch->next, 1)) < batch->count) {
+    const char *input = batch->inputs[index];
+    char *output = output_name(input);
+    int fd = open(output, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    int result = 1;
+    if (fd < 0) {
+      fprintf(stderr, "Error: could not create file '%s'\n", output);
+    } else {
+      result = compile_file(input, batch->options, fd);
+      close(fd);
+    }
+    if (result) {
+      // Don't leave a partial output behind
+      if (fd >= 0) {
+        unlink(output);
+      }
+      fprintf(stderr, "Error: compiling '%s' failed\n", input);
+      atomic_store(&batch->failed, 1);
+    }
+    free(output);
+  }
+  return NULL;
+}
 
-  // Generate assembly code
-  struct Assembly *assembly = generate_code(ast, sema_context);
+// Compile every input on options->jobs threads, each input on one thread.
+// Returns the exit status, which is 1 if any input failed.
+static int compile_batch(char **inputs, int count,
+                         const struct Options *options) {
+  struct Options file_options = *options;
+  file_options.jobs = 1;
+  int jobs = options->jobs;
 
-  // Write assembly to stdout
-  print_assembly(stdout, assembly);
+  struct Batch batch;
+  batch.inputs = inputs;
+  batch.count = count;
+  batch.options = &file_options;
+  atomic_init(&batch.next, 0);
+  atomic_init(&batch.failed, 0);
 
-  // Free resources
-  free_ast(ast);
-  free(tokens.tokens);
-  free(input);
+  if (jobs > count) {
+    jobs = count;
+  }
+  run_workers(batch_worker, &batch, 0, jobs);
+  return atomic_load(&batch.failed);
+}
+
+// Add the files listed in a manifest, one name per line, to the inputs.
+// Returns 1 after reporting an error.
+static int read_manifest(const char *filename, struct Arena *arena,
+                         char ***inputs, int *count, int *capacity) {
+  struct SourceFile manifest;
+  if (read_source(&manifest, filename)) {
+    return 1;
+  }
+  size_t i = 0;
+  while (i < manifest.length) {
+    size_t start = i;
+    while (i < manifest.length && manifest.data[i] != '\n') {
+      i++;
+    }
+    size_t end = i;
+    i++;
+    // Blank lines and trailing spaces are ignored
+    while (end > start && (manifest.data[end - 1] == ' ' ||
+                           manifest.data[end - 1] == '\t' ||
+                           manifest.data[end - 1] == '\r')) {
+      end--;
+    }
+    if (end == start) {
+      continue;
+    }
+    if (*count == *capacity) {
+      *inputs = arena_realloc(arena, *inputs, *capacity * sizeof(char *),
+                              *capacity * 2 * sizeof(char *));
+      *capacity = *capacity * 2;
+    }
+    (*inputs)[(*count)++] =
+        arena_strndup(arena, manifest.data + start, end - start);
+  }
+  release_source(&manifest);
   return 0;
 }
+
+int main(int argc, char *argv[]) {
+  struct Options options = {false, false, false, false, false, false, 1, NULL,
+                            CACHE_DEFAULT_LIMIT};
+  int flag_count = 0;
+  bool manifest = false;
+
+  // Input file names, and the names read from manifests
+  struct Arena arena;
+  arena_init(&arena);
+  int input_count = 0;
+  int input_capacity = 16;
+  char **inputs = arena_alloc(&arena, input_capacity * sizeof(char *));
+  int result = 1;
+
+  // Parse command line arguments
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--print-tokens") == 0) {
+      options.print_tokens = true;
+      flag_count++;
+    } else if (strcmp(argv[i], "--print-ast") == 0) {
+      options.print_ast = true;
+      flag_count++;
+    } else if (strcmp(argv[i], "--print-sema") == 0) {
+      options.print_sema = true;
+      flag_count++;
+    } else if (strcmp(argv[i], "--only-reachable") == 0) {
+      options.only_reachable = true;
+    } else if (strcmp(argv[i], "--single-pass") == 0) {
+      options.single_pass = true;
+    } else if (strcmp(argv[i], "--stream") == 0) {
+      options.stream = true;
+    } else if (strcmp(argv[i], "--scanner") == 0) {
+      // Force the lexer's scanning loops, see scanner.h
+      const char *name = i + 1 < argc ? argv[++i] : "";
+      int scanner = SCANNER_AUTO;
+      if (strcmp(name, "scalar") == 0) {
+        scanner = SCANNER_SCALAR;
+      } else if (strcmp(name, "sse2") == 0) {
+        scanner = SCANNER_SSE2;
+      } else if (strcmp(name, "avx2") == 0) {
+        scanner = SCANNER_AVX2;
+      } else {
+        fprintf(stderr, "Error: --scanner expects scalar, sse2 or avx2\n");
+        goto done;
+      }
+      if (!set_scanner(scanner)) {
+        fprintf(stderr, "Error: scanner '%s' is not supported\n", name);
+        goto done;
+      }
+    } else if (strcmp(argv[i], "--cache") == 0) {
+      if (i + 1 >= argc) {
+        fprintf(stderr, "Error: --cache expects a directory\n");
+        goto done;
+      }
+      options.cache = argv[++i];
+    } else if (strcmp(argv[i], "--cache-size") == 0) {
+      // In megabytes
+      const char *size = i + 1 < argc ? argv[++i] : "";
+      char *end;
+      long value = strtol(size, &end, 10);
+      if (*size == '\0' || *end != '\0' || value < 1 || value > (1 << 20)) {
+        fprintf(stderr, "Error: --cache-size expects a number of megabytes\n");
+        goto done;
+      }
+      options.cache_limit = (long long)value << 20;
+    } else if (strncmp(argv[i], "-j", 2) == 0) {
+      // -j N or -jN
+      const char *count = argv[i] + 2;
+      if (*count == '\0' && i + 1 < argc) {
+        count = argv[++i];
+      }
+      char *end;
+      long value = strtol(count, &end, 10);
+      if (*count == '\0' || *end != '\0' || value < 1 || value > 1024) {
+        fprintf(stderr, "Error: -j expects a number of jobs\n");
+        goto done;
+      }
+      options.jobs = value;
+    } else if (argv[i][0] == '@') {
+      // @file reads the names of the inputs from file
+      manifest = true;
+      if (read_manifest(argv[i] + 1, &arena, &inputs, &input_count,
+                        &input_capacity)) {
+        goto done;
+      }
+    } else {
+      if (input_count == input_capacity) {
+        inputs = arena_realloc(&arena, inputs, input_capacity * sizeof(char *),
+                               input_capacity * 2 * sizeof(char *));
+        input_capacity = input_capacity * 2;
+      }
+      inputs[input_count++] = argv[i];
+    }
+  }
+
+  if (input_count == 0 && !manifest) {
+    fprintf(stderr,
+            "Usage: %s [--print-tokens] [--print-ast] [--print-sema] "
+            "[--only-reachable] [--single-pass] [--stream] [-j N] "
+            "[--scanner scalar|sse2|avx2] [--cache DIR] [--cache-size MB] "
+            "<file | - | @manifest>...\n",
+            argv[0]);
+    goto done;
+  }
+
+  if (flag_count > 1) {
+    fprintf(stderr, "Error: Only one print flag can be specified\n");
+    goto done;
+  }
+
+  // Lazily parsed bodies are not parsed in source order, which analysis
+  // during parsing relies on
+  if (options.only_reachable && options.single_pass) {
+    fprintf(stderr,
+            "Error: --only-reachable and --single-pass cannot be combined\n");
+    goto done;
+  }
+
+  // Only the functions reachable from main are known once all of them have
+  // been read
+  if (options.only_reachable && options.stream) {
+    fprintf(stderr,
+            "Error: --only-reachable and --stream cannot be combined\n");
+    goto done;
+  }
+
+  if (options.cache && mkdir(options.cache, 0777) != 0 && errno != EEXIST) {
+    fprintf(stderr, "Error: could not create cache directory '%s': %s\n",
+            options.cache, strerror(errno));
+    goto done;
+  }
+
+  // A single input is compiled to stdout. Several inputs, or the inputs of a
+  // manifest, are each compiled to their own .s file.
+  if (input_count == 1 && !manifest) {
+    result = compile_file(inputs[0], &options, STDOUT_FILENO);
+    goto done;
+  }
+  if (flag_count > 0) {
+    fprintf(stderr, "Error: Print flags take a single input file\n");
+    goto done;
+  }
+  int i = 0;
+  while (i < input_count) {
+    if (strcmp(inputs[i], "-") == 0) {
+      fprintf(stderr, "Error: Standard input cannot be part of a batch\n");
+      goto done;
+    }
+    i++;
+  }
+  result = compile_batch(inputs, input_count, &options);
+
+done:
+  arena_free(&arena);
+  return result;
+}
@@ -1,12 +1,42 @@
+#include <setjmp.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "arena.h"
+#include "fail.h"
+#include "intern.h"
+#include "lexer.h"
+#include "sema.h"
+#include "type.h"
+#include "workers.h"
+
+// Number of tokens the parser keeps, a power of two. It never looks further
+// back than the previous token or further ahead than the one after the
+// current token.
+#define PARSER_WINDOW 4
+
+// The side table entries of the tokens in the window must still be there
+_Static_assert(PARSER_WINDOW <= LEXER_EXTRAS,
+               "the lexer's side table must cover the parser's window");
+
 // Parser state
 struct Parser {
-  struct TokenArray *tokens;
-  int position;
-  const char *input; // Source code input string
+  struct Lexer *lexer; // Tokens are pulled from here as they are needed
+  struct Token window[PARSER_WINDOW]; // Token i is in window[i % size]
+  int position;            // Index of the current token
+  int lexed;               // Number of tokens pulled from the lexer so far
+  int at_end;              // The lexer has no more tokens
+  const char *input;       // Source code input string
+  struct Arena *arena;     // AST nodes and names are allocated from here
+  int lazy;                // Skip function bodies, see parse_reachable
+  struct Outline *outline; // Where skipped bodies end, see parse_parallel
+  int next_body;           // Index of the next body in outline
+  int *calls;              // Names called by the body being parsed, if lazy
+  int call_count;
+  int call_capacity;
+  struct SemanticContext *sema; // Analyze while parsing, or NULL
 };
 
 // Forward declarations
@@ -14,45 +44,336 @@ static struct ASTNode *parse_program(struct Parser *parser);
 static struct ASTNode *parse_function_declaration(struct Parser *parser);
 static struct ASTNode *parse_statement(struct Parser *parser);
 static struct ASTNode *parse_expression(struct Parser *parser);
-static struct ASTNode *parse_term(struct Parser *parser);
-static struct ASTNode *parse_factor(struct Parser *parser);
 static struct ASTNode *parse_primary(struct Parser *parser);
 static int match(struct Parser *parser, int token_type);
 static struct Token *peek(struct Parser *parser);
+static struct Token *peek_next(struct Parser *parser);
 static struct Token *previous(struct Parser *parser);
 static struct Token *advance(struct Parser *parser);
 static int is_at_end(struct Parser *parser);
 static void expect(struct Parser *parser, int token_type, const char *message);
 static struct ASTNode *parse_arguments(struct Parser *parser);
-static struct ASTNode *parse_equality(struct Parser *parser);
-static struct ASTNode *parse_additive(struct Parser *parser);
+static struct ASTNode *parse_binary(struct Parser *parser,
+                                    int min_precedence);
 static struct ASTNode *parse_block(struct Parser *parser);
+static void skip_block(struct Parser *parser);
+static void record_call(struct Parser *parser, int name);
+static int intern_token(struct Parser *parser, struct Token *token);
+static int token_line(struct Parser *parser, struct Token *token);
+
+// Set up parser to read the program from lexer, see parse_next_function
+void init_parser(struct Parser *parser, struct Lexer *lexer, const char *input,
+                 struct Arena *arena) {
+  parser->lexer = lexer;
+  parser->position = 0;
+  parser->lexed = 0;
+  parser->at_end = 0;
+  parser->input = input;
+  parser->arena = arena;
+  parser->lazy = 0;
+  parser->outline = NULL;
+  parser->next_body = 0;
+  parser->calls = NULL;
+  parser->call_count = 0;
+  parser->call_capacity = 0;
+  parser->sema = NULL;
+}
 
 // Implement the parse function
-struct ASTNode *parse(struct TokenArray *tokens, char *input) {
+struct ASTNode *parse(struct Lexer *lexer, const char *input,
+                      struct Arena *arena) {
+  struct Parser parser;
+  init_parser(&parser, lexer, input, arena);
+  return parse_program(&parser);
+}
+
+// Parse and run semantic analysis in the same pass. Scopes are entered and
+// left as the parser opens and closes blocks, and every name is resolved when
+// its node is created, so the nodes come out with their stack offsets and
+// function symbols filled in and analyze_program is not needed. The checks
+// are the same as analyze_program's, but analyze_program declares every
+// function before it looks at the bodies, so errors can come in a different
+// order.
+struct ASTNode *parse_and_analyze(struct Lexer *lexer, const char *input,
+                                  struct Arena *arena,
+                                  struct SemanticContext *context) {
   struct Parser parser;
-  parser.tokens = tokens;
-  parser.position = 0;
-  parser.input = input;
+  init_parser(&parser, lexer, input, arena);
+  parser.sema = context;
   return parse_program(&parser);
 }
 
+// Parse the next function declaration, or return NULL at the end of the
+// input. The parser's arena may be changed or reset between calls, nothing
+// allocated for one function is used by the next.
+struct ASTNode *parse_next_function(struct Parser *parser) {
+  if (is_at_end(parser)) {
+    return NULL;
+  }
+  struct ASTNode *func_decl = parse_function_declaration(parser);
+  if (!func_decl) {
+    struct Token *current_token = peek(parser);
+    fprintf(stderr, "Error on line %d: Expected function declaration.\n",
+            token_line(parser, current_token));
+    fail_compilation();
+  }
+  return func_decl;
+}
+
+// Parse the body of a function skipped by the first pass of parse_reachable,
+// recording the names it calls
+static void parse_skipped_body(struct Parser *parser, struct ASTNode *func) {
+  parser->lexer->position = func->function_decl.body_start;
+  parser->position = 0;
+  parser->lexed = 0;
+  parser->at_end = 0;
+  parser->call_count = 0;
+  func->function_decl.body = parse_block(parser);
+  expect(parser, TOKEN_RIGHT_BRACE, "Expected '}' after function body.");
+}
+
+// Parse only the functions reachable from main. The first pass parses the
+// function headers and skips each body by brace matching, keeping the offset
+// where it starts. Bodies are then parsed on demand, starting with main and
+// following the calls in every body parsed. Functions that are never reached
+// are left out of the program, so sema and codegen don't see them either.
+// Input that redefines a constant is parsed whole.
+struct ASTNode *parse_reachable(struct Lexer *lexer, const char *input,
+                                struct Arena *arena) {
+  struct Parser parser;
+  init_parser(&parser, lexer, input, arena);
+  parser.lazy = 1;
+  parser.call_capacity = 64;
+  parser.call_count = 0;
+  parser.calls = arena_alloc(arena, parser.call_capacity * sizeof(int));
+  struct ASTNode *program = parse_program(&parser);
+
+  // The first pass has read every define, so a body parsed now would see the
+  // last value of a redefined constant. Only a single pass can follow it.
+  if (lexer->defines.redefined) {
+    init_lexer(lexer, input, lexer->length, lexer->arena);
+    return parse(lexer, input, arena);
+  }
+
+  // Index the functions by name. Declarations of the same name are chained
+  // through same_name so they are all reached together.
+  int function_count = 0;
+  struct ASTNode *func = program;
+  while (func) {
+    function_count++;
+    func = func->next;
+  }
+  int name_count = intern_count();
+  struct ASTNode **functions =
+      arena_alloc(arena, function_count * sizeof(struct ASTNode *));
+  int *first_with_name = arena_alloc(arena, name_count * sizeof(int));
+  int *same_name = arena_alloc(arena, function_count * sizeof(int));
+  char *reached = arena_calloc(arena, function_count);
+  int i = 0;
+  while (i < name_count) {
+    first_with_name[i] = -1;
+    i++;
+  }
+  i = 0;
+  func = program;
+  while (func) {
+    int name = func->function_decl.name;
+    functions[i] = func;
+    same_name[i] = first_with_name[name];
+    first_with_name[name] = i;
+    i++;
+    func = func->next;
+  }
+
+  // Functions whose body still has to be parsed
+  int *worklist = arena_alloc(arena, function_count * sizeof(int));
+  int pending = 0;
+  int index = first_with_name[ID_MAIN];
+  while (index >= 0) {
+    reached[index] = 1;
+    worklist[pending++] = index;
+    index = same_name[index];
+  }
+
+  while (pending > 0) {
+    parse_skipped_body(&parser, functions[worklist[--pending]]);
+    int call = 0;
+    while (call < parser.call_count) {
+      // Names first seen inside a body cannot be declared functions
+      int name = parser.calls[call];
+      index = name < name_count ? first_with_name[name] : -1;
+      while (index >= 0) {
+        if (!reached[index]) {
+          reached[index] = 1;
+          worklist[pending++] = index;
+        }
+        index = same_name[index];
+      }
+      call++;
+    }
+  }
+
+  // Keep the reached functions in declaration order
+  struct ASTNode *result = NULL;
+  struct ASTNode **tail = &result;
+  i = 0;
+  while (i < function_count) {
+    if (reached[i]) {
+      *tail = functions[i];
+      tail = &functions[i]->next;
+    }
+    i++;
+  }
+  *tail = NULL;
+  return result;
+}
+
+// Function bodies parsed by worker threads, see parse_parallel
+struct ParallelParse {
+  struct Lexer *lexer; // After the first pass, copied by every worker
+  const char *input;
+  struct ASTNode **functions;
+  int count;
+  struct Interner *interner;
+  struct TypeTable *types;
+  atomic_int next;   // Index of the next body to parse
+  atomic_int failed; // Set once a body has a syntax error
+};
+
+struct ParseWorker {
+  struct ParallelParse *shared;
+  struct Arena arena; // Adopted by the parser's arena once done
+};
+
+static void *parse_worker(void *arg) {
+  struct ParseWorker *worker = arg;
+  struct ParallelParse *shared = worker->shared;
+  use_interner(shared->interner);
+  use_types(shared->types);
+
+  struct Lexer lexer = *shared->lexer;
+  lexer.line_starts = NULL;
+  lexer.line_count = 0;
+  lexer.defines_read = 1;
+  lexer.arena = &worker->arena;
+  struct Parser parser;
+  init_parser(&parser, &lexer, shared->input, &worker->arena);
+
+  // The first error stops every worker, the caller fails once all are done
+  jmp_buf *outer_recovery = compilation_recovery;
+  jmp_buf recovery;
+  if (setjmp(recovery)) {
+    atomic_store(&shared->failed, 1);
+    compilation_recovery = outer_recovery;
+    return NULL;
+  }
+  compilation_recovery = &recovery;
+
+  int index;
+  while (!atomic_load(&shared->failed) &&
+         (index = atomic_fetch_add(&shared->next, 1)) < shared->count) {
+    parse_skipped_body(&parser, shared->functions[index]);
+  }
+  compilation_recovery = outer_recovery;
+  return NULL;
+}
+
+// Parse the program with the function bodies spread over jobs threads. The
+// input is first outlined on jobs threads, see outline_input, which finds
+// where every body starts and ends and where the directives are. The
+// directives are read in source order, then a first pass parses the function
+// headers and jumps over each body, and every body is parsed by its own
+// parser and lexer, starting at its opening brace. Input that cannot be
+// outlined has an error somewhere, which a single pass reports.
+struct ASTNode *parse_parallel(struct Lexer *lexer, const char *input,
+                               struct Arena *arena, int jobs) {
+  struct Outline outline;
+  if (!outline_input(lexer, jobs, arena, &outline)) {
+    return parse(lexer, input, arena);
+  }
+  int i = 0;
+  while (i < outline.directive_count) {
+    int position = outline.directives[i];
+    if (read_directive(lexer, &position) < 0) {
+      fail_compilation();
+    }
+    i++;
+  }
+  // A redefined constant has a different value on either side of the
+  // redefinition, which only a single pass can follow
+  if (lexer->defines.redefined) {
+    init_lexer(lexer, input, lexer->length, lexer->arena);
+    return parse(lexer, input, arena);
+  }
+  lexer->defines_read = 1;
+
+  struct Parser parser;
+  init_parser(&parser, lexer, input, arena);
+  parser.lazy = 1;
+  parser.outline = &outline;
+  struct ASTNode *program = parse_program(&parser);
+
+  struct ParallelParse shared;
+  shared.lexer = lexer;
+  shared.input = input;
+  shared.count = 0;
+  shared.interner = current_interner();
+  shared.types = current_types();
+  atomic_init(&shared.next, 0);
+  atomic_init(&shared.failed, 0);
+  struct ASTNode *func = program;
+  while (func) {
+    shared.count++;
+    func = func->next;
+  }
+  shared.functions =
+      arena_alloc(arena, shared.count * sizeof(struct ASTNode *));
+  i = 0;
+  func = program;
+  while (func) {
+    shared.functions[i++] = func;
+    func = func->next;
+  }
+
+  if (jobs > shared.count) {
+    jobs = shared.count;
+  }
+  if (jobs < 1) {
+    return program;
+  }
+  struct ParseWorker *workers = malloc(jobs * sizeof(struct ParseWorker));
+  if (!workers) {
+    fprintf(stderr, "Error: memory allocation failed\n");
+    exit(1);
+  }
+  i = 0;
+  while (i < jobs) {
+    workers[i].shared = &shared;
+    arena_init(&workers[i].arena);
+    i++;
+  }
+  run_workers(parse_worker, workers, sizeof(struct ParseWorker), jobs);
+  i = 0;
+  while (i < jobs) {
+    arena_adopt(arena, &workers[i].arena);
+    i++;
+  }
+  free(workers);
+  if (atomic_load(&shared.failed)) {
+    fail_compilation();
+  }
+  return program;
+}
+
 // Parse a program (list of functions)
 static struct ASTNode *parse_program(struct Parser *parser) {
   struct ASTNode *node = NULL;
   struct ASTNode **current = &node;
 
-  while (!is_at_end(parser)) {
-    struct ASTNode *func_decl = parse_function_declaration(parser);
-    if (func_decl) {
-      *current = func_decl;
-      current = &((*current)->next);
-    } else if (!is_at_end(parser)) {
-      struct Token *current_token = peek(parser);
-      fprintf(stderr, "Error on line %d: Expected function declaration.\n",
-              current_token ? current_token->line : 0);
-      exit(1);
-    }
+  struct ASTNode *func_decl;
+  while ((func_decl = parse_next_function(parser))) {
+    *current = func_decl;
+    current = &((*current)->next);
   }
 
   return node;
@@ -65,14 +386,12 @@ static struct ASTNode *parse_function_declaration(struct Parser *parser) {
     return NULL;
   }
   struct Token *type_token = advance(parser);
-  char *return_type = strndup(&parser->input[type_token->start],
-                              type_token->end - type_token->start);
+  struct Type *return_type = type_for_name(intern_token(parser, type_token));
 
   // Match function name (e.g., 'main')
   expect(parser, TOKEN_IDENTIFIER, "Expected function name.");
   struct Token *name_token = previous(parser);
-  char *func_name = strndup(&parser->input[name_token->start],
-                            name_token->end - name_token->start);
+  int func_name = intern_token(parser, name_token);
 
   // Match '('
   expect(parser, TOKEN_LEFT_PAREN, "Expected '(' after function name.");
@@ -94,17 +413,17 @@ static struct ASTNode *parse_function_declaration(struct Parser *parser) {
 
       // Add parameter to array
       if (param_count >= param_capacity) {
-        param_capacity = param_capacity == 0 ? 4 : param_capacity * 2;
-        parameters = realloc(parameters,
-                             param_capacity * sizeof(struct FunctionParameter));
+        int new_capacity = param_capacity == 0 ? 4 : param_capacity * 2;
+        parameters = arena_realloc(
+            parser->arena, parameters,
+            param_capacity * sizeof(struct FunctionParameter),
+            new_capacity * sizeof(struct FunctionParameter));
+        param_capacity = new_capacity;
       }
 
       parameters[param_count].type =
-          strndup(&parser->input[param_type_token->start],
-                  param_type_token->end - param_type_token->start);
-      parameters[param_count].name =
-          strndup(&parser->input[param_name_token->start],
-                  param_name_token->end - param_name_token->start);
+          type_for_name(intern_token(parser, param_type_token));
+      parameters[param_count].name = intern_token(parser, param_name_token);
       param_count++;
     } while (match(parser, TOKEN_COMMA) && advance(parser));
   }
@@ -114,124 +433,150 @@ static struct ASTNode *parse_function_declaration(struct Parser *parser) {
 
   // Match '{'
   expect(parser, TOKEN_LEFT_BRACE, "Expected '{' before function body.");
+  int body_start = previous(parser)->start + 1;
+
+  // Declare the function. The body of a duplicate is not analyzed.
+  struct Symbol *symbol = NULL;
+  struct SemanticContext *sema = parser->sema;
+  if (sema) {
+    struct FlatFunction function = {func_name, return_type, parameters,
+                                    param_count, NULL};
+    symbol = begin_function(sema, &function);
+    if (!symbol) {
+      parser->sema = NULL;
+    }
+  }
 
-  // Parse function body
-  struct ASTNode *body = parse_block(parser);
+  // Parse function body, or only find its end if it is parsed on demand
+  struct ASTNode *body = NULL;
+  if (parser->lazy) {
+    skip_block(parser);
+  } else {
+    body = parse_block(parser);
+  }
+  if (symbol) {
+    end_function(sema, symbol);
+  }
+  parser->sema = sema;
 
   // Match '}'
   expect(parser, TOKEN_RIGHT_BRACE, "Expected '}' after function body.");
 
   // Create function declaration node
-  struct ASTNode *node = malloc(sizeof(struct ASTNode));
+  struct ASTNode *node = arena_alloc(parser->arena, sizeof(struct ASTNode));
   node->type = NODE_FUNCTION_DECLARATION;
   node->function_decl.name = func_name;
   node->function_decl.return_type = return_type;
   node->function_decl.parameters = parameters;
   node->function_decl.param_count = param_count;
   node->function_decl.body = body;
+  node->function_decl.body_start = body_start;
+  node->function_decl.symbol = symbol;
   node->next = NULL;
 
   return node;
 }
 
-// Parse a statement
-static struct ASTNode *parse_statement(struct Parser *parser) {
-  if (match(parser, TOKEN_WHILE)) {
-    advance(parser); // Consume 'while'
-    expect(parser, TOKEN_LEFT_PAREN, "Expected '(' after 'while'.");
-    struct ASTNode *condition = parse_expression(parser);
-    expect(parser, TOKEN_RIGHT_PAREN, "Expected ')' after while condition.");
-    expect(parser, TOKEN_LEFT_BRACE, "Expected '{' before while body.");
-    struct ASTNode *body = parse_block(parser);
-    expect(parser, TOKEN_RIGHT_BRACE, "Expected '}' after while body.");
-    struct ASTNode *node = malloc(sizeof(struct ASTNode));
-    node->type = NODE_WHILE_STATEMENT;
-    node->while_stmt.condition = condition;
-    node->while_stmt.body = body;
-    node->next = NULL;
-    return node;
-  }
-
-  // If statement
-  if (match(parser, TOKEN_IF)) {
-    advance(parser); // Consume 'if'
-    expect(parser, TOKEN_LEFT_PAREN, "Expected '(' after 'if'.");
-    struct ASTNode *condition = parse_expression(parser);
-    expect(parser, TOKEN_RIGHT_PAREN, "Expected ')' after if condition.");
-    expect(parser, TOKEN_LEFT_BRACE, "Expected '{' after if condition.");
-    struct ASTNode *body = parse_block(parser);
-    expect(parser, TOKEN_RIGHT_BRACE, "Expected '}' after if body.");
-
-    // Parse else block with support for "else if"
-    struct ASTNode *else_body = NULL;
-    if (match(parser, TOKEN_ELSE)) {
-      advance(parser); // Consume 'else'
-      if (match(parser, TOKEN_IF)) {
-        // "else if" chain: recursively parse the if-statement
-        else_body = parse_statement(parser);
-      } else {
-        // Regular else block: expect a block in braces
-        expect(parser, TOKEN_LEFT_BRACE, "Expected '{' after else.");
-        else_body = parse_block(parser);
-        expect(parser, TOKEN_RIGHT_BRACE, "Expected '}' after else body.");
-      }
-    }
+// Parse "while (condition) {", leaving the body to parse_block
+static struct ASTNode *parse_while_header(struct Parser *parser) {
+  advance(parser); // Consume 'while'
+  expect(parser, TOKEN_LEFT_PAREN, "Expected '(' after 'while'.");
+  struct ASTNode *condition = parse_expression(parser);
+  expect(parser, TOKEN_RIGHT_PAREN, "Expected ')' after while condition.");
+  expect(parser, TOKEN_LEFT_BRACE, "Expected '{' before while body.");
+  struct ASTNode *node = arena_alloc(parser->arena, sizeof(struct ASTNode));
+  node->type = NODE_WHILE_STATEMENT;
+  node->while_stmt.condition = condition;
+  node->while_stmt.body = NULL;
+  node->next = NULL;
+  return node;
+}
 
-    // Create if statement node
-    struct ASTNode *node = malloc(sizeof(struct ASTNode));
-    node->type = NODE_IF_STATEMENT;
-    node->if_stmt.condition = condition;
-    node->if_stmt.body = body;
-    node->if_stmt.else_body = else_body;
-    node->next = NULL;
-    return node;
-  }
+// Parse "if (condition) {", leaving the bodies to parse_block
+static struct ASTNode *parse_if_header(struct Parser *parser) {
+  advance(parser); // Consume 'if'
+  expect(parser, TOKEN_LEFT_PAREN, "Expected '(' after 'if'.");
+  struct ASTNode *condition = parse_expression(parser);
+  expect(parser, TOKEN_RIGHT_PAREN, "Expected ')' after if condition.");
+  expect(parser, TOKEN_LEFT_BRACE, "Expected '{' after if condition.");
+  struct ASTNode *node = arena_alloc(parser->arena, sizeof(struct ASTNode));
+  node->type = NODE_IF_STATEMENT;
+  node->if_stmt.condition = condition;
+  node->if_stmt.body = NULL;
+  node->if_stmt.else_body = NULL;
+  node->next = NULL;
+  return node;
+}
 
+// Parse a statement that does not contain a block
+static struct ASTNode *parse_statement(struct Parser *parser) {
   // Variable declaration or expression statement
   if (match(parser, TOKEN_IDENTIFIER)) {
     struct Token *first_token = peek(parser);
 
     // Check if next token is an identifier (variable name)
-    if (parser->position + 1 < parser->tokens->count &&
-        parser->tokens->tokens[parser->position + 1].type == TOKEN_IDENTIFIER) {
+    struct Token *lookahead = peek_next(parser);
+    if (lookahead && lookahead->type == TOKEN_IDENTIFIER) {
       // Variable declaration
       advance(parser); // Consume datatype
       struct Token *datatype_token = first_token;
-      char *datatype = strndup(&parser->input[datatype_token->start],
-                               datatype_token->end - datatype_token->start);
+      struct Type *datatype =
+          type_for_name(intern_token(parser, datatype_token));
 
       // Variable name
       expect(parser, TOKEN_IDENTIFIER, "Expected variable name.");
       struct Token *name_token = previous(parser);
-      char *var_name = strndup(&parser->input[name_token->start],
-                               name_token->end - name_token->start);
+      int var_name = intern_token(parser, name_token);
+
+      // Allocate the variable's slot. The initializer of a duplicate is not
+      // analyzed.
+      struct SemanticContext *sema = parser->sema;
+      struct Symbol *var_sym = NULL;
+      int stack_offset = 0;
+      if (sema) {
+        var_sym = begin_variable(sema, var_name, datatype, &stack_offset);
+        if (!var_sym) {
+          parser->sema = NULL;
+        }
+      }
 
       // Match '='
       expect(parser, TOKEN_EQUAL, "Expected '=' after variable name.");
 
       // Parse expression
       struct ASTNode *value = parse_expression(parser);
+      parser->sema = sema;
 
       // Match ';'
       expect(parser, TOKEN_SEMICOLON,
              "Expected ';' after variable declaration.");
 
       // Create variable declaration node
-      struct ASTNode *node = malloc(sizeof(struct ASTNode));
+      struct ASTNode *node = arena_alloc(parser->arena, sizeof(struct ASTNode));
       node->type = NODE_VARIABLE_DECLARATION;
       node->var_decl.datatype = datatype;
       node->var_decl.name = var_name;
       node->var_decl.value = value;
+      node->var_decl.stack_offset = stack_offset;
       node->next = NULL;
 
+      // The variable is visible from the next statement on
+      if (var_sym) {
+        end_variable(sema, var_sym);
+      }
+
       return node;
-    } else if (parser->position + 1 < parser->tokens->count &&
-               parser->tokens->tokens[parser->position + 1].type ==
-                   TOKEN_EQUAL) {
+    } else if (lookahead && lookahead->type == TOKEN_EQUAL) {
       // Assignment statement
       advance(parser); // Consume identifier
-      char *var_name = strndup(&parser->input[first_token->start],
-                               first_token->end - first_token->start);
+      int var_name = intern_token(parser, first_token);
+      int stack_offset = 0;
+      struct Type *datatype = NULL;
+      if (parser->sema) {
+        stack_offset =
+            resolve_variable(parser->sema, var_name, &datatype,
+                             "Error: Assignment to undefined variable %s\n");
+      }
 
       // Match '='
       expect(parser, TOKEN_EQUAL, "Expected '=' after variable name.");
@@ -243,12 +588,15 @@ static struct ASTNode *parse_statement(struct Parser *parser) {
       expect(parser, TOKEN_SEMICOLON, "Expected ';' after assignment.");
 
       // Create identifier node for target
-      struct ASTNode *target = malloc(sizeof(struct ASTNode));
+      struct ASTNode *target =
+          arena_alloc(parser->arena, sizeof(struct ASTNode));
       target->type = NODE_IDENTIFIER;
       target->identifier.name = var_name;
+      target->identifier.stack_offset = stack_offset;
+      target->identifier.datatype = datatype;
 
       // Create assignment node
-      struct ASTNode *node = malloc(sizeof(struct ASTNode));
+      struct ASTNode *node = arena_alloc(parser->arena, sizeof(struct ASTNode));
       node->type = NODE_ASSIGNMENT;
       node->assignment.target = target;
       node->assignment.value = value;
@@ -269,7 +617,7 @@ static struct ASTNode *parse_statement(struct Parser *parser) {
     expect(parser, TOKEN_SEMICOLON, "Expected ';' after return statement.");
 
     // Create return statement node
-    struct ASTNode *node = malloc(sizeof(struct ASTNode));
+    struct ASTNode *node = arena_alloc(parser->arena, sizeof(struct ASTNode));
     node->type = NODE_RETURN_STATEMENT;
     node->return_stmt.value = value;
     node->next = NULL;
@@ -287,71 +635,59 @@ static struct ASTNode *parse_statement(struct Parser *parser) {
   return expr;
 }
 
-// Modified expression parsing with proper precedence
-static struct ASTNode *parse_expression(struct Parser *parser) {
-  return parse_equality(parser);
-}
-
-// Handles == and !=
-static struct ASTNode *parse_equality(struct Parser *parser) {
-  struct ASTNode *node = parse_additive(parser);
-
-  while (match(parser, TOKEN_EQUAL_EQUAL) || match(parser, TOKEN_NOT_EQUAL)) {
-    struct Token *op_token = advance(parser);
-    char *operator= strndup(&parser->input[op_token->start],
-                            op_token->end - op_token->start);
-
-    struct ASTNode *right = parse_additive(parser);
-
-    struct ASTNode *bin_node = malloc(sizeof(struct ASTNode));
-    bin_node->type = NODE_BINARY_OPERATION;
-    bin_node->binary_op.operator= operator;
-    bin_node->binary_op.left = node;
-    bin_node->binary_op.right = right;
-    bin_node->next = NULL;
-
-    node = bin_node;
-  }
-  return node;
-}
-
-// Renamed from original parse_expression
-static struct ASTNode *parse_additive(struct Parser *parser) {
-  struct ASTNode *node = parse_term(parser);
-
-  while (match(parser, TOKEN_PLUS) || match(parser, TOKEN_MINUS)) {
-    struct Token *op_token = advance(parser);
-    char operator= parser->input[op_token->start];
-
-    struct ASTNode *right = parse_term(parser);
-
-    struct ASTNode *bin_node = malloc(sizeof(struct ASTNode));
-    bin_node->type = NODE_BINARY_OPERATION;
-    bin_node->binary_op.operator= strndup(&operator, 1);
-    bin_node->binary_op.left = node;
-    bin_node->binary_op.right = right;
-    bin_node->next = NULL;
+// Precedence and operator of each binary operator token, indexed by token
+// type. Higher precedence binds tighter; 0 means the token does not continue
+// an expression.
+static const unsigned char binary_precedence[256] = {
+    [TOKEN_LOGICAL_OR] = 1,    [TOKEN_LOGICAL_AND] = 2,
+    [TOKEN_EQUAL_EQUAL] = 3,   [TOKEN_NOT_EQUAL] = 3,
+    [TOKEN_LESS] = 4,          [TOKEN_LESS_EQUAL] = 4,
+    [TOKEN_GREATER] = 4,       [TOKEN_GREATER_EQUAL] = 4,
+    [TOKEN_PLUS] = 5,          [TOKEN_MINUS] = 5,
+    [TOKEN_MULTIPLY] = 6,      [TOKEN_DIVIDE] = 6,
+};
 
-    node = bin_node;
-  }
+static const unsigned char binary_operator[256] = {
+    [TOKEN_LOGICAL_OR] = OP_LOGICAL_OR,
+    [TOKEN_LOGICAL_AND] = OP_LOGICAL_AND,
+    [TOKEN_EQUAL_EQUAL] = OP_EQUAL,
+    [TOKEN_NOT_EQUAL] = OP_NOT_EQUAL,
+    [TOKEN_LESS] = OP_LESS,
+    [TOKEN_LESS_EQUAL] = OP_LESS_EQUAL,
+    [TOKEN_GREATER] = OP_GREATER,
+    [TOKEN_GREATER_EQUAL] = OP_GREATER_EQUAL,
+    [TOKEN_PLUS] = OP_ADD,
+    [TOKEN_MINUS] = OP_SUBTRACT,
+    [TOKEN_MULTIPLY] = OP_MULTIPLY,
+    [TOKEN_DIVIDE] = OP_DIVIDE,
+};
 
-  return node;
+static struct ASTNode *parse_expression(struct Parser *parser) {
+  return parse_binary(parser, 1);
 }
 
-// Parse a term (handles *, /)
-static struct ASTNode *parse_term(struct Parser *parser) {
-  struct ASTNode *node = parse_factor(parser);
+// Precedence climbing: parse an operand, then fold in every following
+// operator that binds at least as tightly as min_precedence. The right
+// operand only takes operators that bind tighter, which makes all binary
+// operators left associative.
+static struct ASTNode *parse_binary(struct Parser *parser,
+                                    int min_precedence) {
+  struct ASTNode *node = parse_primary(parser);
 
-  while (match(parser, TOKEN_MULTIPLY) || match(parser, TOKEN_DIVIDE)) {
-    struct Token *op_token = advance(parser);
-    char operator= parser->input[op_token->start];
+  while (!is_at_end(parser)) {
+    int type = peek(parser)->type;
+    int precedence = binary_precedence[type];
+    if (precedence < min_precedence) {
+      break;
+    }
+    advance(parser); // Consume the operator
 
-    struct ASTNode *right = parse_factor(parser);
+    struct ASTNode *right = parse_binary(parser, precedence + 1);
 
-    // Create binary operation node
-    struct ASTNode *bin_node = malloc(sizeof(struct ASTNode));
+    struct ASTNode *bin_node =
+        arena_alloc(parser->arena, sizeof(struct ASTNode));
     bin_node->type = NODE_BINARY_OPERATION;
-    bin_node->binary_op.operator= strndup(&operator, 1);
+    bin_node->binary_op.operator= binary_operator[type];
     bin_node->binary_op.left = node;
     bin_node->binary_op.right = right;
     bin_node->next = NULL;
@@ -362,22 +698,14 @@ static struct ASTNode *parse_term(struct Parser *parser) {
   return node;
 }
 
-// Parse a factor (primary expressions)
-static struct ASTNode *parse_factor(struct Parser *parser) {
-  return parse_primary(parser);
-}
-
 // Parse primary expressions
 static struct ASTNode *parse_primary(struct Parser *parser) {
   if (match(parser, TOKEN_LITERAL_INT)) {
     // Integer literal
     struct Token *int_token = advance(parser);
-    int len = int_token->end - int_token->start;
-    char *value_str = strndup(&parser->input[int_token->start], len);
-    int value = atoi(value_str);
-    free(value_str);
+    int value = token_value(parser->lexer, int_token);
 
-    struct ASTNode *node = malloc(sizeof(struct ASTNode));
+    struct ASTNode *node = arena_alloc(parser->arena, sizeof(struct ASTNode));
     node->type = NODE_INTEGER_LITERAL;
     node->int_literal.value = value;
     node->next = NULL;
@@ -385,10 +713,11 @@ static struct ASTNode *parse_primary(struct Parser *parser) {
     return node;
   } else if (match(parser, TOKEN_LITERAL_STRING)) {
     struct Token *str_token = advance(parser);
-    int len = str_token->end - str_token->start;
-    char *value = strndup(&parser->input[str_token->start], len);
+    char *value = arena_strndup(
+        parser->arena, &parser->input[str_token->start],
+        token_length(parser->lexer, str_token));
 
-    struct ASTNode *node = malloc(sizeof(struct ASTNode));
+    struct ASTNode *node = arena_alloc(parser->arena, sizeof(struct ASTNode));
     node->type = NODE_STRING_LITERAL;
     node->string_literal.value = value;
     node->next = NULL;
@@ -396,12 +725,14 @@ static struct ASTNode *parse_primary(struct Parser *parser) {
     return node;
   } else if (match(parser, TOKEN_IDENTIFIER)) {
     struct Token *ident_token = advance(parser);
-    int len = ident_token->end - ident_token->start;
-    char *name = strndup(&parser->input[ident_token->start], len);
+    int name = intern_token(parser, ident_token);
 
     // Check if function call
     if (match(parser, TOKEN_LEFT_PAREN)) {
       advance(parser); // Consume '('
+      if (parser->sema) {
+        check_call(parser->sema, name);
+      }
 
       // Parse arguments
       struct ASTNode *arguments = NULL;
@@ -412,18 +743,28 @@ static struct ASTNode *parse_primary(struct Parser *parser) {
       expect(parser, TOKEN_RIGHT_PAREN,
              "Expected ')' after function arguments.");
 
-      struct ASTNode *node = malloc(sizeof(struct ASTNode));
+      struct ASTNode *node = arena_alloc(parser->arena, sizeof(struct ASTNode));
       node->type = NODE_FUNCTION_CALL;
       node->func_call.name = name;
+      if (parser->lazy) {
+        record_call(parser, name);
+      }
       node->func_call.arguments = arguments;
       node->next = NULL;
 
       return node;
     } else {
       // Identifier
-      struct ASTNode *node = malloc(sizeof(struct ASTNode));
+      struct ASTNode *node = arena_alloc(parser->arena, sizeof(struct ASTNode));
       node->type = NODE_IDENTIFIER;
       node->identifier.name = name;
+      node->identifier.stack_offset = 0;
+      node->identifier.datatype = NULL;
+      if (parser->sema) {
+        node->identifier.stack_offset =
+            resolve_variable(parser->sema, name, &node->identifier.datatype,
+                             "Error: Undefined variable %s\n");
+      }
       node->next = NULL;
 
       return node;
@@ -432,16 +773,36 @@ static struct ASTNode *parse_primary(struct Parser *parser) {
     struct Token *current_token = peek(parser);
     fprintf(stderr,
             "Error on line %d: Unexpected token in primary expression.\n",
-            current_token ? current_token->line : 0);
-    exit(1);
+            token_line(parser, current_token));
+    fail_compilation();
   }
 }
 
 // Utility functions
+
+// The token with the given index, pulling tokens from the lexer up to it.
+// Returns NULL past the end of the input.
+static struct Token *token_at(struct Parser *parser, int index) {
+  while (parser->lexed <= index && !parser->at_end) {
+    struct Token *token = &parser->window[parser->lexed % PARSER_WINDOW];
+    int status = next_token(parser->lexer, token);
+    if (status < 0) {
+      fail_compilation();
+    } else if (status == 0) {
+      parser->at_end = 1;
+    } else {
+      parser->lexed++;
+    }
+  }
+  if (index >= parser->lexed) {
+    return NULL;
+  }
+  return &parser->window[index % PARSER_WINDOW];
+}
+
 static int match(struct Parser *parser, int token_type) {
-  if (is_at_end(parser))
-    return 0;
-  return parser->tokens->tokens[parser->position].type == token_type;
+  struct Token *token = token_at(parser, parser->position);
+  return token && token->type == token_type;
 }
 
 static struct Token *advance(struct Parser *parser) {
@@ -451,17 +812,31 @@ static struct Token *advance(struct Parser *parser) {
 }
 
 static struct Token *peek(struct Parser *parser) {
-  if (is_at_end(parser))
-    return NULL;
-  return &parser->tokens->tokens[parser->position];
+  return token_at(parser, parser->position);
+}
+
+// The token after the current one, or NULL
+static struct Token *peek_next(struct Parser *parser) {
+  return token_at(parser, parser->position + 1);
 }
 
 static struct Token *previous(struct Parser *parser) {
-  return &parser->tokens->tokens[parser->position - 1];
+  return &parser->window[(parser->position - 1) % PARSER_WINDOW];
+}
+
+// Intern the source text of a token
+static int intern_token(struct Parser *parser, struct Token *token) {
+  return intern(&parser->input[token->start],
+                token_length(parser->lexer, token));
+}
+
+// Line of a token for diagnostics, 0 past the end of the input
+static int token_line(struct Parser *parser, struct Token *token) {
+  return token ? source_line(parser->lexer, token->start) : 0;
 }
 
 static int is_at_end(struct Parser *parser) {
-  return parser->position >= parser->tokens->count;
+  return token_at(parser, parser->position) == NULL;
 }
 
 static void expect(struct Parser *parser, int token_type, const char *message) {
@@ -469,57 +844,48 @@ static void expect(struct Parser *parser, int token_type, const char *message) {
     advance(parser);
   } else {
     struct Token *current = peek(parser);
-    fprintf(stderr, "Error on line %d: %s\n", current ? current->line : 0,
+    fprintf(stderr, "Error on line %d: %s\n", token_line(parser, current),
             message);
-    exit(1);
+    fail_compilation();
   }
 }
 
-void free_ast(struct ASTNode *node) {
-  while (node) {
-    struct ASTNode *next = node->next;
-
-    if (node->type == NODE_FUNCTION_DECLARATION) {
-      free(node->function_decl.name);
-      free(node->function_decl.return_type);
-      for (int i = 0; i < node->function_decl.param_count; i++) {
-        free(node->function_decl.parameters[i].name);
-        free(node->function_decl.parameters[i].type);
-      }
-      free(node->function_decl.parameters);
-      free_ast(node->function_decl.body);
-    } else if (node->type == NODE_VARIABLE_DECLARATION) {
-      free(node->var_decl.datatype);
-      free(node->var_decl.name);
-      if (node->var_decl.value) {
-        free_ast(node->var_decl.value);
-      }
-    } else if (node->type == NODE_BINARY_OPERATION) {
-      free(node->binary_op.operator);
-      free_ast(node->binary_op.left);
-      free_ast(node->binary_op.right);
-    } else if (node->type == NODE_IDENTIFIER) {
-      free(node->identifier.name);
-    } else if (node->type == NODE_FUNCTION_CALL) {
-      free(node->func_call.name);
-      free_ast(node->func_call.arguments);
-    } else if (node->type == NODE_RETURN_STATEMENT) {
-      if (node->return_stmt.value) {
-        free_ast(node->return_stmt.value);
-      }
-    } else if (node->type == NODE_STRING_LITERAL) {
-      free(node->string_literal.value);
-    } else if (node->type == NODE_IF_STATEMENT) {
-      free_ast(node->if_stmt.condition);
-      free_ast(node->if_stmt.body);
-      if (node->if_stmt.else_body) {
-        free_ast(node->if_stmt.else_body);
+// Skip the statements of a block by matching braces, leaving its closing
+// brace to the caller. A block whose end is in the outline is not lexed.
+static void skip_block(struct Parser *parser) {
+  struct Outline *outline = parser->outline;
+  if (outline && parser->next_body < outline->body_count &&
+      outline->bodies[2 * parser->next_body] == previous(parser)->start) {
+    parser->lexer->position = outline->bodies[2 * parser->next_body + 1];
+    parser->position = 0;
+    parser->lexed = 0;
+    parser->at_end = 0;
+    parser->next_body++;
+    return;
+  }
+  int depth = 1;
+  while (!is_at_end(parser)) {
+    if (match(parser, TOKEN_LEFT_BRACE)) {
+      depth++;
+    } else if (match(parser, TOKEN_RIGHT_BRACE)) {
+      depth--;
+      if (depth == 0) {
+        return;
       }
     }
+    advance(parser);
+  }
+}
 
-    free(node);
-    node = next;
+// Remember that the body being parsed calls name
+static void record_call(struct Parser *parser, int name) {
+  if (parser->call_count >= parser->call_capacity) {
+    parser->calls = arena_realloc(parser->arena, parser->calls,
+                                  parser->call_capacity * sizeof(int),
+                                  parser->call_capacity * 2 * sizeof(int));
+    parser->call_capacity = parser->call_capacity * 2;
   }
+  parser->calls[parser->call_count++] = name;
 }
 
 static struct ASTNode *parse_arguments(struct Parser *parser) {
@@ -536,22 +902,117 @@ static struct ASTNode *parse_arguments(struct Parser *parser) {
   return first_arg;
 }
 
+// Which body of its statement a block is
+#define BLOCK_OUTERMOST 0
+#define BLOCK_WHILE_BODY 1
+#define BLOCK_THEN_BODY 2
+#define BLOCK_ELSE_BODY 3
+
+// A block whose statements are being parsed
+struct BlockFrame {
+  struct ASTNode *owner; // while or if statement, NULL for the outermost
+  struct ASTNode **tail; // Where the next statement of the block goes
+  int part;              // BLOCK_*
+  int saved_offset;      // For parser->sema, see enter_body
+};
+
+// Parse the statements of a block up to its closing brace, which is left to
+// the caller. Nested while and if bodies, and else-if chains, are parsed with
+// an explicit stack of open blocks instead of recursion, so the nesting depth
+// does not affect the native stack.
 static struct ASTNode *parse_block(struct Parser *parser) {
+  struct BlockFrame inline_frames[16];
+  struct BlockFrame *frames = inline_frames;
+  int capacity = 16;
+  int count = 1;
   struct ASTNode *body = NULL;
-  struct ASTNode **current = &body;
+  frames[0].owner = NULL;
+  frames[0].tail = &body;
+  frames[0].part = BLOCK_OUTERMOST;
+
+  while (1) {
+    struct BlockFrame *frame = &frames[count - 1];
+    struct ASTNode *stmt = NULL;
+    struct BlockFrame opened;
+
+    if (is_at_end(parser) || match(parser, TOKEN_RIGHT_BRACE)) {
+      if (frame->part == BLOCK_OUTERMOST) {
+        break;
+      }
 
-  while (!is_at_end(parser) && !match(parser, TOKEN_RIGHT_BRACE)) {
-    struct ASTNode *stmt = parse_statement(parser);
-    if (stmt) {
-      *current = stmt;
-      current = &((*current)->next);
+      // Close the innermost block
+      struct ASTNode *owner = frame->owner;
+      int part = frame->part;
+      count--;
+      if (parser->sema) {
+        leave_body(parser->sema, frame->saved_offset);
+      }
+      if (part == BLOCK_WHILE_BODY) {
+        expect(parser, TOKEN_RIGHT_BRACE, "Expected '}' after while body.");
+        continue;
+      } else if (part == BLOCK_ELSE_BODY) {
+        expect(parser, TOKEN_RIGHT_BRACE, "Expected '}' after else body.");
+        continue;
+      }
+      expect(parser, TOKEN_RIGHT_BRACE, "Expected '}' after if body.");
+      if (!match(parser, TOKEN_ELSE)) {
+        continue;
+      }
+
+      // Parse else block with support for "else if"
+      advance(parser); // Consume 'else'
+      if (match(parser, TOKEN_IF)) {
+        // "else if" chain: the next if statement is the else body
+        struct ASTNode *next_if = parse_if_header(parser);
+        owner->if_stmt.else_body = next_if;
+        opened.owner = next_if;
+        opened.tail = &next_if->if_stmt.body;
+        opened.part = BLOCK_THEN_BODY;
+      } else {
+        // Regular else block: expect a block in braces
+        expect(parser, TOKEN_LEFT_BRACE, "Expected '{' after else.");
+        opened.owner = owner;
+        opened.tail = &owner->if_stmt.else_body;
+        opened.part = BLOCK_ELSE_BODY;
+      }
+    } else if (match(parser, TOKEN_WHILE)) {
+      stmt = parse_while_header(parser);
+      opened.owner = stmt;
+      opened.tail = &stmt->while_stmt.body;
+      opened.part = BLOCK_WHILE_BODY;
+    } else if (match(parser, TOKEN_IF)) {
+      stmt = parse_if_header(parser);
+      opened.owner = stmt;
+      opened.tail = &stmt->if_stmt.body;
+      opened.part = BLOCK_THEN_BODY;
     } else {
-      struct Token *current_token = peek(parser);
-      fprintf(stderr, "Error on line %d: Invalid statement in block.\n",
-              current_token ? current_token->line : 0);
-      exit(1);
+      stmt = parse_statement(parser);
+      if (!stmt) {
+        struct Token *current_token = peek(parser);
+        fprintf(stderr, "Error on line %d: Invalid statement in block.\n",
+                token_line(parser, current_token));
+        fail_compilation();
+      }
+      *frame->tail = stmt;
+      frame->tail = &stmt->next;
+      continue;
+    }
+
+    // Append the statement that opened a block, then start on the block
+    if (stmt) {
+      *frame->tail = stmt;
+      frame->tail = &stmt->next;
+    }
+    if (parser->sema) {
+      opened.saved_offset = enter_body(parser->sema);
+    }
+    if (count == capacity) {
+      frames = stack_grow(frames, inline_frames, &capacity,
+                          sizeof(struct BlockFrame));
     }
+    frames[count++] = opened;
   }
 
+  stack_free(frames, inline_frames);
   return body;
 }
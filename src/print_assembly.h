@@ -1,156 +1,278 @@
 #include "common.h"
+#include "intern.h"
+#include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
-// Convert register number to string
-const char *reg_to_str(int reg) {
-  if (reg == REG_RAX)
-    return "rax";
-  if (reg == REG_RBX)
-    return "rbx";
-  if (reg == REG_RCX)
-    return "rcx";
-  if (reg == REG_RDX)
-    return "rdx";
-  if (reg == REG_RSP)
-    return "rsp";
-  if (reg == REG_RBP)
-    return "rbp";
-  if (reg == REG_RDI)
-    return "rdi";
-  if (reg == REG_RSI)
-    return "rsi";
-  if (reg == REG_R8)
-    return "r8";
-  if (reg == REG_R9)
-    return "r9";
-  if (reg == REG_R10)
-    return "r10";
-  if (reg == REG_R11)
-    return "r11";
-  if (reg == REG_R12)
-    return "r12";
-  if (reg == REG_R13)
-    return "r13";
-  if (reg == REG_R14)
-    return "r14";
-  if (reg == REG_R15)
-    return "r15";
-  if (reg == REG_AL)
-    return "al";
-  return "unknown";
-}
-
-// Convert instruction type to string
-const char *instr_to_str(int type) {
-  if (type == INSTR_MOV)
-    return "movq";
-  if (type == INSTR_ADD)
-    return "addq";
-  if (type == INSTR_SUB)
-    return "subq";
-  if (type == INSTR_PUSH)
-    return "pushq";
-  if (type == INSTR_POP)
-    return "popq";
-  if (type == INSTR_CALL)
-    return "call";
-  if (type == INSTR_RET)
-    return "ret";
-  if (type == INSTR_LEA)
-    return "leaq";
-  if (type == INSTR_MUL)
-    return "imulq";
-  if (type == INSTR_DIV)
-    return "idivq";
-  if (type == INSTR_LABEL)
-    return "label";
-  if (type == INSTR_CMP)
-    return "cmpq";
-  if (type == INSTR_SET_EQ)
-    return "sete";
-  if (type == INSTR_SET_NE)
-    return "setne";
-  if (type == INSTR_MOVZX)
-    return "movzbq";
-  if (type == INSTR_JE)
-    return "je";
-  if (type == INSTR_JMP)
-    return "jmp";
-  return "unknown";
+// Text of a register or instruction, with its length so that it can be
+// copied without scanning for the terminator
+struct Spelling {
+  const char *text;
+  int length;
+};
+
+#define SPELLING(text) {text, sizeof(text) - 1}
+
+// Register operands, indexed by REG_*
+static const struct Spelling register_spelling[] = {
+    [REG_RAX] = SPELLING("%rax"),   [REG_RBX] = SPELLING("%rbx"),
+    [REG_RCX] = SPELLING("%rcx"),   [REG_RDX] = SPELLING("%rdx"),
+    [REG_RSP] = SPELLING("%rsp"),   [REG_RBP] = SPELLING("%rbp"),
+    [REG_RDI] = SPELLING("%rdi"),   [REG_RSI] = SPELLING("%rsi"),
+    [REG_R8] = SPELLING("%r8"),     [REG_R9] = SPELLING("%r9"),
+    [REG_R10] = SPELLING("%r10"),   [REG_R11] = SPELLING("%r11"),
+    [REG_R12] = SPELLING("%r12"),   [REG_R13] = SPELLING("%r13"),
+    [REG_R14] = SPELLING("%r14"),   [REG_R15] = SPELLING("%r15"),
+    [REG_AL] = SPELLING("%al"),     [REG_CL] = SPELLING("%cl"),
+    [REG_DL] = SPELLING("%dl"),     [REG_SIL] = SPELLING("%sil"),
+    [REG_DIL] = SPELLING("%dil"),   [REG_R8B] = SPELLING("%r8b"),
+    [REG_R9B] = SPELLING("%r9b"),   [REG_R10B] = SPELLING("%r10b"),
+    [REG_R11B] = SPELLING("%r11b"),
+};
+
+// Indented mnemonic and the space before the operands, indexed by INSTR_*
+static const struct Spelling instruction_spelling[] = {
+    [INSTR_MOV] = SPELLING("    movq "),
+    [INSTR_ADD] = SPELLING("    addq "),
+    [INSTR_SUB] = SPELLING("    subq "),
+    [INSTR_PUSH] = SPELLING("    pushq "),
+    [INSTR_POP] = SPELLING("    popq "),
+    [INSTR_CALL] = SPELLING("    call "),
+    [INSTR_RET] = SPELLING("    ret "),
+    [INSTR_LEA] = SPELLING("    leaq "),
+    [INSTR_MUL] = SPELLING("    imulq "),
+    [INSTR_DIV] = SPELLING("    idivq "),
+    [INSTR_LABEL] = SPELLING("    label "),
+    [INSTR_CMP] = SPELLING("    cmpq "),
+    [INSTR_SET_EQ] = SPELLING("    sete "),
+    [INSTR_SET_NE] = SPELLING("    setne "),
+    [INSTR_MOVZX] = SPELLING("    movzbq "),
+    [INSTR_JE] = SPELLING("    je "),
+    [INSTR_JMP] = SPELLING("    jmp "),
+    [INSTR_SET_LT] = SPELLING("    setl "),
+    [INSTR_SET_LE] = SPELLING("    setle "),
+    [INSTR_SET_GT] = SPELLING("    setg "),
+    [INSTR_SET_GE] = SPELLING("    setge "),
+    [INSTR_JNE] = SPELLING("    jne "),
+    [INSTR_MOVSX] = SPELLING("    movsbq "),
+    [INSTR_MOV_BYTE] = SPELLING("    movb "),
+};
+
+// Prefix of the numbered labels, indexed by LABEL_*
+static const struct Spelling label_prefix[] = {
+    [LABEL_STRING] = SPELLING(".LC"),
+    [LABEL_ELSE] = SPELLING(".Lelse"),
+    [LABEL_IF_END] = SPELLING(".Lif_end"),
+    [LABEL_WHILE_START] = SPELLING(".Lwhile_start"),
+    [LABEL_WHILE_END] = SPELLING(".Lwhile_end"),
+    [LABEL_LOGIC_SHORT] = SPELLING(".Llogic_short"),
+    [LABEL_LOGIC_END] = SPELLING(".Llogic_end"),
+};
+
+// Output is formatted into a buffer that is written out with write() when
+// it fills up, so printing an instruction is a few copies into memory.
+#define EMIT_BUFFER_SIZE (1 << 20)
+
+struct Emitter {
+  int fd;
+  char *buffer;
+  int length;
+  int error; // errno of a failed write, the rest of the output is dropped
+};
+
+// Write all of text to the output file
+static void emit_write(struct Emitter *out, const char *text, int length) {
+  int written = 0;
+  while (written < length && !out->error) {
+    ssize_t count = write(out->fd, text + written, length - written);
+    if (count < 0) {
+      if (errno != EINTR) {
+        out->error = errno;
+      }
+    } else {
+      written = written + count;
+    }
+  }
 }
 
-// Print an operand
-void print_operand(FILE *out, struct Operand op) {
-  if (op.type == OPERAND_EMPTY) {
-    return;
+static void emit_flush(struct Emitter *out) {
+  emit_write(out, out->buffer, out->length);
+  out->length = 0;
+}
+
+static void emit_bytes(struct Emitter *out, const char *text, int length) {
+  if (out->length + length > EMIT_BUFFER_SIZE) {
+    emit_flush(out);
+    // Text longer than the whole buffer bypasses it
+    if (length > EMIT_BUFFER_SIZE) {
+      emit_write(out, text, length);
+      return;
+    }
+  }
+  memcpy(out->buffer + out->length, text, length);
+  out->length = out->length + length;
+}
+
+static void emit_spelling(struct Emitter *out, struct Spelling spelling) {
+  emit_bytes(out, spelling.text, spelling.length);
+}
+
+static void emit_string(struct Emitter *out, const char *text) {
+  emit_bytes(out, text, strlen(text));
+}
+
+// Decimal text of value
+static void emit_int(struct Emitter *out, int value) {
+  char digits[12];
+  int i = sizeof(digits);
+  unsigned int magnitude = value;
+  if (value < 0) {
+    magnitude = -magnitude;
+  }
+  do {
+    digits[--i] = '0' + magnitude % 10;
+    magnitude = magnitude / 10;
+  } while (magnitude);
+  if (value < 0) {
+    digits[--i] = '-';
   }
+  emit_bytes(out, digits + i, sizeof(digits) - i);
+}
+
+static void emit_label(struct Emitter *out, int kind, int id) {
+  if (kind == LABEL_NAME) {
+    emit_string(out, intern_str(id));
+  } else {
+    emit_spelling(out, label_prefix[kind]);
+    emit_int(out, id);
+  }
+}
+
+// Print an operand
+static void emit_operand(struct Emitter *out, struct Operand op) {
   if (op.type == OPERAND_REGISTER) {
-    fprintf(out, "%%%s", reg_to_str(op.reg));
+    emit_spelling(out, register_spelling[op.reg]);
   } else if (op.type == OPERAND_IMMEDIATE) {
-    fprintf(out, "$%d", op.immediate);
+    emit_bytes(out, "$", 1);
+    emit_int(out, op.immediate);
   } else if (op.type == OPERAND_MEMORY) {
     if (op.mem.offset) {
-      fprintf(out, "%d(%%%s)", op.mem.offset, reg_to_str(op.mem.base_reg));
-    } else {
-      fprintf(out, "(%%%s)", reg_to_str(op.mem.base_reg));
+      emit_int(out, op.mem.offset);
     }
+    emit_bytes(out, "(", 1);
+    emit_spelling(out, register_spelling[op.mem.base_reg]);
+    emit_bytes(out, ")", 1);
   } else if (op.type == OPERAND_LABEL) {
-    fprintf(out, "%s", op.label);
+    emit_label(out, op.label.kind, op.label.id);
   } else if (op.type == OPERAND_RIP_LABEL) {
-    fprintf(out, "%s(%%rip)", op.label);
+    emit_label(out, op.label.kind, op.label.id);
+    emit_bytes(out, "(%rip)", 6);
   }
 }
 
 // Print an instruction
-void print_instruction(FILE *out, struct Instruction *instr) {
-  fprintf(out, "    %s ", instr_to_str(instr->type));
+static void emit_instruction(struct Emitter *out, struct Instruction *instr) {
+  emit_spelling(out, instruction_spelling[instr->type]);
 
   // Print first operand if it exists
-  print_operand(out, instr->op1);
+  emit_operand(out, instr->op1);
 
   // Print second operand if it exists and first operand wasn't empty
   if (instr->op2.type != OPERAND_EMPTY && instr->op1.type != OPERAND_EMPTY) {
-    fprintf(out, ", ");
-    print_operand(out, instr->op2);
+    emit_bytes(out, ", ", 2);
+    emit_operand(out, instr->op2);
   }
 
-  fprintf(out, "\n");
+  emit_bytes(out, "\n", 1);
+}
+
+void init_emitter(struct Emitter *out, int fd) {
+  out->fd = fd;
+  out->buffer = malloc(EMIT_BUFFER_SIZE);
+  out->length = 0;
+  out->error = 0;
+  if (!out->buffer) {
+    fprintf(stderr, "Error: memory allocation failed\n");
+    exit(1);
+  }
+}
+
+// Write out what is left in the buffer. Returns 1 after reporting an error if
+// any of the output could not be written.
+int finish_emitter(struct Emitter *out) {
+  emit_flush(out);
+  free(out->buffer);
+  out->buffer = NULL;
+  if (out->error) {
+    fprintf(stderr, "Error: could not write output: %s\n",
+            strerror(out->error));
+    return 1;
+  }
+  return 0;
 }
 
-// Print the complete assembly program
-void print_assembly(FILE *out, struct Assembly *assembly) {
-  // Print extern declarations
+// Print extern declarations
+void emit_externs(struct Emitter *out, struct Assembly *assembly) {
   for (int i = 0; i < assembly->extern_count; i++) {
-    fprintf(out, ".extern %s\n", assembly->extern_symbols[i]);
+    emit_bytes(out, ".extern ", 8);
+    emit_string(out, assembly->extern_symbols[i]);
+    emit_bytes(out, "\n", 1);
   }
-  fprintf(out, "\n");
+}
 
-  // Print data section with all string literals
-  fprintf(out, ".section .data\n");
+// Print data section with all string literals
+void emit_data(struct Emitter *out, struct Assembly *assembly) {
+  emit_string(out, ".section .data\n");
   struct StringLiteral *str = assembly->string_literals;
   while (str) {
-    fprintf(out, "%s:\n", str->label);
-    fprintf(out, "    .string %s\n", str->value);
+    emit_label(out, LABEL_STRING, str->label);
+    emit_bytes(out, ":\n    .string ", 14);
+    emit_string(out, str->value);
+    emit_bytes(out, "\n", 1);
     str = str->next;
   }
-  fprintf(out, "\n");
+  emit_bytes(out, "\n", 1);
+}
 
-  // Print text section
-  fprintf(out, ".section .text\n");
-  fprintf(out, ".globl main\n");
+// Print the header of the text section, which the code of every function
+// goes into
+void emit_text_header(struct Emitter *out) {
+  emit_string(out, ".section .text\n");
+  emit_string(out, ".globl main\n");
+}
+
+// Print the instructions of a section
+void emit_section(struct Emitter *out, struct Section *section) {
+  int i = 0;
+  while (i < section->count) {
+    struct Instruction *instr = &section->instructions[i];
+    if (instr->type == INSTR_LABEL) {
+      emit_label(out, instr->op1.label.kind, instr->op1.label.id);
+      emit_bytes(out, ":\n", 2);
+    } else {
+      emit_instruction(out, instr);
+    }
+    i = i + 1;
+  }
+}
+
+// Write the complete assembly program to the file descriptor fd. Returns 1
+// after reporting an error if it could not be written.
+int print_assembly(int fd, struct Assembly *assembly) {
+  struct Emitter out;
+  init_emitter(&out, fd);
+  emit_externs(&out, assembly);
+  emit_bytes(&out, "\n", 1);
+  emit_data(&out, assembly);
+  emit_text_header(&out);
 
   // Print each section
   struct Section *section = assembly->sections;
   while (section) {
-    struct Instruction *instr = section->instructions;
-    while (instr) {
-      if (instr->type == INSTR_LABEL) {
-        fprintf(out, "%s:\n", instr->op1.label);
-      } else {
-        print_instruction(out, instr);
-      }
-      instr = instr->next;
-    }
+    emit_section(&out, section);
     section = section->next;
   }
+  return finish_emitter(&out);
 }
@@ -1,6 +1,17 @@
 #include <stdio.h>
 
 #include "common.h"
+#include "intern.h"
+
+// Source text of each OP_* operator
+static const char *const operator_text[] = {
+    [OP_ADD] = "+",          [OP_SUBTRACT] = "-",
+    [OP_MULTIPLY] = "*",     [OP_DIVIDE] = "/",
+    [OP_EQUAL] = "==",       [OP_NOT_EQUAL] = "!=",
+    [OP_LESS] = "<",         [OP_LESS_EQUAL] = "<=",
+    [OP_GREATER] = ">",      [OP_GREATER_EQUAL] = ">=",
+    [OP_LOGICAL_AND] = "&&", [OP_LOGICAL_OR] = "||",
+};
 
 static void print_indent(int level) {
   for (int i = 0; i < level; i++)
@@ -12,24 +23,26 @@ void print_ast(struct ASTNode *node, int indent) {
     print_indent(indent);
 
     if (node->type == NODE_FUNCTION_DECLARATION) {
-      printf("FunctionDeclaration: %s\n", node->function_decl.name);
+      printf("FunctionDeclaration: %s\n",
+             intern_str(node->function_decl.name));
       print_ast(node->function_decl.body, indent + 1);
     } else if (node->type == NODE_VARIABLE_DECLARATION) {
-      printf("VariableDeclaration: %s %s\n", node->var_decl.datatype,
-             node->var_decl.name);
+      printf("VariableDeclaration: %s %s\n",
+             node->var_decl.datatype->spelling,
+             intern_str(node->var_decl.name));
       if (node->var_decl.value) {
         print_ast(node->var_decl.value, indent + 1);
       }
     } else if (node->type == NODE_BINARY_OPERATION) {
-      printf("BinaryOperation: %s\n", node->binary_op.operator);
+      printf("BinaryOperation: %s\n", operator_text[node->binary_op.operator]);
       print_ast(node->binary_op.left, indent + 1);
       print_ast(node->binary_op.right, indent + 1);
     } else if (node->type == NODE_INTEGER_LITERAL) {
       printf("IntegerLiteral: %d\n", node->int_literal.value);
     } else if (node->type == NODE_IDENTIFIER) {
-      printf("Identifier: %s\n", node->identifier.name);
+      printf("Identifier: %s\n", intern_str(node->identifier.name));
     } else if (node->type == NODE_FUNCTION_CALL) {
-      printf("FunctionCall: %s\n", node->func_call.name);
+      printf("FunctionCall: %s\n", intern_str(node->func_call.name));
       if (node->func_call.arguments) {
         print_indent(indent + 1);
         printf("Arguments:\n");
@@ -1,4 +1,5 @@
 #include "common.h"
+#include "intern.h"
 #include <stdio.h>
 
 // Add forward declaration at the top
@@ -9,19 +10,21 @@ void print_symbol(struct Symbol *symbol, int indent) {
   for (int i = 0; i < indent; i++)
     printf("  ");
 
-  printf("%s: ", symbol->name);
+  printf("%s: ", intern_str(symbol->name));
   if (symbol->type == SYMBOL_VARIABLE) {
     printf("Variable (type: %s, offset: %d, size: %d)\n",
-           symbol->variable.data_type, symbol->variable.offset,
+           symbol->variable.data_type->spelling, symbol->variable.offset,
            symbol->variable.size);
   } else if (symbol->type == SYMBOL_FUNCTION) {
-    printf("Function (return type: %s)\n", symbol->function.return_type);
+    printf("Function (return type: %s)\n",
+           symbol->function.return_type->spelling);
 
     // Print parameters
     for (int i = 0; i < symbol->function.param_count; i++) {
       for (int j = 0; j < indent + 1; j++)
         printf("  ");
-      printf("Parameter %d: %s\n", i, symbol->function.param_types[i]);
+      printf("Parameter %d: %s\n", i,
+             symbol->function.param_types[i]->spelling);
     }
 
     // Print local variables if any
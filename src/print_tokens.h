@@ -1,26 +1,26 @@
 #include "common.h"
+#include "lexer.h"
 #include <stdio.h>
 #include <string.h>
 
-void print_tokens(struct TokenArray tokens, const char *input) {
+// Print every token of the input. Returns 1 after a lexical error.
+int print_tokens(struct Lexer *lexer, const char *input) {
+  struct Token token;
+  int status;
   int i = 0;
-  while (i < tokens.count) {
-    struct Token token = tokens.tokens[i];
+  while ((status = next_token(lexer, &token)) > 0) {
     printf("Token %d: ", i);
 
     if (token.type == TOKEN_IDENTIFIER || token.type == TOKEN_LITERAL_INT ||
         token.type == TOKEN_LITERAL_STRING) {
-      int len = token.end - token.start;
-      char content[256];
-      strncpy(content, &input[token.start], len);
-      content[len] = '\0';
+      const char *content = &input[token.start];
 
       if (token.type == TOKEN_IDENTIFIER) {
-        printf("IDENTIFIER '%s'\n", content);
+        printf("IDENTIFIER '%.*s'\n", token_length(lexer, &token), content);
       } else if (token.type == TOKEN_LITERAL_INT) {
-        printf("INTEGER %s\n", content);
+        printf("INTEGER %d\n", token_value(lexer, &token));
       } else {
-        printf("STRING '%s'\n", content);
+        printf("STRING '%.*s'\n", token_length(lexer, &token), content);
       }
     } else if (token.type == TOKEN_LEFT_BRACE) {
       printf("{\n");
@@ -83,4 +83,5 @@ void print_tokens(struct TokenArray tokens, const char *input) {
     }
     i++;
   }
+  return status < 0;
 }
@@ -0,0 +1,220 @@
+#pragma once
+
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+// Fast paths for the lexer's inner loops. Each scan starts at position i and
+// returns the position of the first byte that ends the run (or length). On
+// x86-64 whole 16 or 32 byte blocks are classified at once; the implementation
+// is chosen at runtime from the CPU features.
+
+// What to scan over
+#define SCAN_WHITESPACE 0    // Stops at anything but ' ', '\t' and '\n'
+#define SCAN_LINE_COMMENT 1  // Stops at '\n'
+#define SCAN_BLOCK_COMMENT 2 // Stops at the '*' of "*/"
+#define SCAN_IDENTIFIER 3    // Stops at anything but letters, digits and '_'
+#define SCAN_STRING 4        // Stops at '"' and '\\'
+
+// Scanner implementations
+#define SCANNER_AUTO 0
+#define SCANNER_SCALAR 1
+#define SCANNER_SSE2 2
+#define SCANNER_AVX2 3
+
+typedef int (*scan_function)(const char *input, int i, int length, int kind);
+
+static int is_scan_stop(unsigned char c, int kind) {
+  if (kind == SCAN_WHITESPACE) {
+    return c != ' ' && c != '\t' && c != '\n';
+  } else if (kind == SCAN_LINE_COMMENT) {
+    return c == '\n';
+  } else if (kind == SCAN_IDENTIFIER) {
+    return !((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+             (c >= '0' && c <= '9') || c == '_');
+  }
+  return c == '"' || c == '\\';
+}
+
+static int scan_scalar(const char *input, int i, int length, int kind) {
+  if (kind == SCAN_BLOCK_COMMENT) {
+    while (i + 1 < length && !(input[i] == '*' && input[i + 1] == '/')) {
+      i++;
+    }
+    return i + 1 < length ? i : length;
+  }
+  while (i < length && !is_scan_stop(input[i], kind)) {
+    i++;
+  }
+  return i;
+}
+
+#if defined(__x86_64__)
+
+// Bit mask of the bytes in v that end a run of the given kind. next holds
+// the bytes one position further, for the two-character "*/".
+static inline __attribute__((always_inline)) unsigned int
+stop_mask_sse2(__m128i v, __m128i next, int kind) {
+  if (kind == SCAN_WHITESPACE) {
+    __m128i space = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+                     _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'))),
+        _mm_cmpeq_epi8(v, _mm_set1_epi8('\n')));
+    return ~_mm_movemask_epi8(space) & 0xFFFF;
+  } else if (kind == SCAN_LINE_COMMENT) {
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')));
+  } else if (kind == SCAN_BLOCK_COMMENT) {
+    return _mm_movemask_epi8(
+        _mm_and_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('*')),
+                      _mm_cmpeq_epi8(next, _mm_set1_epi8('/'))));
+  } else if (kind == SCAN_IDENTIFIER) {
+    // Setting bit 5 folds 'A'-'Z' onto 'a'-'z'; bytes >= 0x80 are negative
+    // and fall outside every range.
+    __m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+    __m128i alpha =
+        _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+                      _mm_cmplt_epi8(lower, _mm_set1_epi8('z' + 1)));
+    __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)),
+                                  _mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1)));
+    __m128i ident = _mm_or_si128(_mm_or_si128(alpha, digit),
+                                 _mm_cmpeq_epi8(v, _mm_set1_epi8('_')));
+    return ~_mm_movemask_epi8(ident) & 0xFFFF;
+  }
+  return _mm_movemask_epi8(
+      _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('"')),
+                   _mm_cmpeq_epi8(v, _mm_set1_epi8('\\'))));
+}
+
+static inline __attribute__((always_inline)) int
+scan_sse2_kind(const char *input, int i, int length, int kind) {
+  // One byte of slack so "*/" can be matched across the block boundary
+  while (i + 17 <= length) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(input + i));
+    __m128i next = v;
+    if (kind == SCAN_BLOCK_COMMENT) {
+      next = _mm_loadu_si128((const __m128i *)(input + i + 1));
+    }
+    unsigned int stop = stop_mask_sse2(v, next, kind);
+    if (stop) {
+      return i + __builtin_ctz(stop);
+    }
+    i = i + 16;
+  }
+  return scan_scalar(input, i, length, kind);
+}
+
+static int scan_sse2(const char *input, int i, int length, int kind) {
+  // Dispatch to copies specialized for each kind
+  if (kind == SCAN_WHITESPACE) {
+    return scan_sse2_kind(input, i, length, SCAN_WHITESPACE);
+  } else if (kind == SCAN_LINE_COMMENT) {
+    return scan_sse2_kind(input, i, length, SCAN_LINE_COMMENT);
+  } else if (kind == SCAN_BLOCK_COMMENT) {
+    return scan_sse2_kind(input, i, length, SCAN_BLOCK_COMMENT);
+  } else if (kind == SCAN_IDENTIFIER) {
+    return scan_sse2_kind(input, i, length, SCAN_IDENTIFIER);
+  }
+  return scan_sse2_kind(input, i, length, SCAN_STRING);
+}
+
+static inline __attribute__((always_inline, target("avx2"))) unsigned int
+stop_mask_avx2(__m256i v, __m256i next, int kind) {
+  if (kind == SCAN_WHITESPACE) {
+    __m256i space = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')),
+                        _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t'))),
+        _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')));
+    return ~(unsigned int)_mm256_movemask_epi8(space);
+  } else if (kind == SCAN_LINE_COMMENT) {
+    return _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')));
+  } else if (kind == SCAN_BLOCK_COMMENT) {
+    return _mm256_movemask_epi8(
+        _mm256_and_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('*')),
+                         _mm256_cmpeq_epi8(next, _mm256_set1_epi8('/'))));
+  } else if (kind == SCAN_IDENTIFIER) {
+    __m256i lower = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+    __m256i alpha = _mm256_andnot_si256(
+        _mm256_cmpgt_epi8(lower, _mm256_set1_epi8('z')),
+        _mm256_cmpgt_epi8(lower, _mm256_set1_epi8('a' - 1)));
+    __m256i digit =
+        _mm256_andnot_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8('9')),
+                            _mm256_cmpgt_epi8(v, _mm256_set1_epi8('0' - 1)));
+    __m256i ident =
+        _mm256_or_si256(_mm256_or_si256(alpha, digit),
+                        _mm256_cmpeq_epi8(v, _mm256_set1_epi8('_')));
+    return ~(unsigned int)_mm256_movemask_epi8(ident);
+  }
+  return _mm256_movemask_epi8(
+      _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')),
+                      _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\'))));
+}
+
+static inline __attribute__((always_inline, target("avx2,bmi"))) int
+scan_avx2_kind(const char *input, int i, int length, int kind) {
+  while (i + 33 <= length) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(input + i));
+    __m256i next = v;
+    if (kind == SCAN_BLOCK_COMMENT) {
+      next = _mm256_loadu_si256((const __m256i *)(input + i + 1));
+    }
+    unsigned int stop = stop_mask_avx2(v, next, kind);
+    if (stop) {
+      return i + __builtin_ctz(stop);
+    }
+    i = i + 32;
+  }
+  return scan_sse2(input, i, length, kind);
+}
+
+__attribute__((target("avx2,bmi"))) static int
+scan_avx2(const char *input, int i, int length, int kind) {
+  if (kind == SCAN_WHITESPACE) {
+    return scan_avx2_kind(input, i, length, SCAN_WHITESPACE);
+  } else if (kind == SCAN_LINE_COMMENT) {
+    return scan_avx2_kind(input, i, length, SCAN_LINE_COMMENT);
+  } else if (kind == SCAN_BLOCK_COMMENT) {
+    return scan_avx2_kind(input, i, length, SCAN_BLOCK_COMMENT);
+  } else if (kind == SCAN_IDENTIFIER) {
+    return scan_avx2_kind(input, i, length, SCAN_IDENTIFIER);
+  }
+  return scan_avx2_kind(input, i, length, SCAN_STRING);
+}
+
+#endif
+
+// Scanner requested with set_scanner, SCANNER_AUTO picks the best supported
+static int scanner_override = SCANNER_AUTO;
+
+// Force a scanner implementation, e.g. for benchmarking. Returns 0 if the CPU
+// does not support it.
+int set_scanner(int scanner) {
+#if defined(__x86_64__)
+  if (scanner == SCANNER_AVX2 && !__builtin_cpu_supports("avx2")) {
+    return 0;
+  }
+#else
+  if (scanner == SCANNER_SSE2 || scanner == SCANNER_AVX2) {
+    return 0;
+  }
+#endif
+  scanner_override = scanner;
+  return 1;
+}
+
+scan_function select_scanner(void) {
+#if defined(__x86_64__)
+  if (scanner_override == SCANNER_SCALAR) {
+    return scan_scalar;
+  } else if (scanner_override == SCANNER_SSE2) {
+    return scan_sse2;
+  } else if (scanner_override == SCANNER_AVX2 ||
+             __builtin_cpu_supports("avx2")) {
+    return scan_avx2;
+  }
+  return scan_sse2;
+#else
+  return scan_scalar;
+#endif
+}
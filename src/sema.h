@@ -1,28 +1,31 @@
+#pragma once
+
+#include "arena.h"
+#include "ast.h"
 #include "common.h"
+#include "intern.h"
+#include "workers.h"
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 // Forward declarations of semantic analysis functions
-void analyze_node(struct ASTNode *node, struct SemanticContext *context);
-void analyze_function_declaration(struct ASTNode *node,
-                                  struct SemanticContext *context);
-void analyze_variable_declaration(struct ASTNode *node,
-                                  struct SemanticContext *context);
-void analyze_expression(struct ASTNode *node, struct SemanticContext *context);
-void analyze_block(struct ASTNode *node, struct SemanticContext *context);
-void analyze_if_statement(struct ASTNode *node,
-                          struct SemanticContext *context);
-void analyze_while_statement(struct ASTNode *node,
-                             struct SemanticContext *context);
+// Nodes are indices into the flat AST in context->ast.
+void analyze_node(int node, struct SemanticContext *context);
+void analyze_function_declaration(int node, struct SemanticContext *context);
+void analyze_function_body(int node, struct SemanticContext *context);
+void analyze_variable_declaration(int node, struct SemanticContext *context);
+void analyze_expression(int node, struct SemanticContext *context);
+void analyze_block(int block, struct SemanticContext *context);
 
 // Create a new symbol table
-struct SymbolTable *create_symbol_table(void) {
-  struct SymbolTable *table = malloc(sizeof(struct SymbolTable));
+struct SymbolTable *create_symbol_table(struct Arena *arena) {
+  struct SymbolTable *table = arena_alloc(arena, sizeof(struct SymbolTable));
   table->symbols = NULL;
   table->count = 0;
   table->capacity = 0;
-  table->parent = NULL;
+  table->arena = arena;
   return table;
 }
 
@@ -30,348 +33,702 @@ struct SymbolTable *create_symbol_table(void) {
 void add_symbol(struct SymbolTable *table, struct Symbol *symbol) {
   if (table->count >= table->capacity) {
     int new_capacity = table->capacity == 0 ? 8 : table->capacity * 2;
-    table->symbols =
-        realloc(table->symbols, new_capacity * sizeof(struct Symbol *));
+    table->symbols = arena_realloc(table->arena, table->symbols,
+                                   table->capacity * sizeof(struct Symbol *),
+                                   new_capacity * sizeof(struct Symbol *));
     table->capacity = new_capacity;
   }
   table->symbols[table->count++] = symbol;
 }
 
-// Look up a symbol in the current scope and parent scopes
-struct Symbol *lookup_symbol(struct SymbolTable *scope, const char *name) {
-  while (scope) {
-    for (int i = 0; i < scope->count; i++) {
-      if (strcmp(scope->symbols[i]->name, name) == 0) {
-        return scope->symbols[i];
-      }
+static unsigned int scope_hash(int name) {
+  return (unsigned int)name * 2654435761u;
+}
+
+// Find the slot for a name: either the slot holding it or the empty slot
+// where it would be inserted.
+static int scope_slot(struct ScopeTable *scopes, int name) {
+  int slot = scope_hash(name) & (scopes->slot_count - 1);
+  while (scopes->keys[slot] != ID_NONE && scopes->keys[slot] != name) {
+    slot = (slot + 1) & (scopes->slot_count - 1);
+  }
+  return slot;
+}
+
+static void scope_table_resize(struct ScopeTable *scopes, int slot_count) {
+  int *old_keys = scopes->keys;
+  struct Symbol **old_values = scopes->values;
+  int old_slot_count = scopes->slot_count;
+
+  scopes->keys = arena_calloc(scopes->arena, slot_count * sizeof(int));
+  scopes->values =
+      arena_calloc(scopes->arena, slot_count * sizeof(struct Symbol *));
+  scopes->slot_count = slot_count;
+
+  int i = 0;
+  while (i < old_slot_count) {
+    if (old_keys[i] != ID_NONE) {
+      int slot = scope_slot(scopes, old_keys[i]);
+      scopes->keys[slot] = old_keys[i];
+      scopes->values[slot] = old_values[i];
     }
-    scope = scope->parent;
+    i++;
   }
-  return NULL;
 }
 
-// Get size of a data type
-int get_type_size(const char *type) {
-  if (strcmp(type, "int") == 0) {
-    return 8; // Using 64-bit integers
-  } else if (strcmp(type, "char") == 0) {
-    return 1;
+void init_scope_table(struct ScopeTable *scopes, struct Arena *arena) {
+  scopes->arena = arena;
+  scopes->keys = NULL;
+  scopes->values = NULL;
+  scopes->slot_count = 0;
+  scopes->used = 0;
+  scopes->log_capacity = 64;
+  scopes->log_count = 0;
+  scopes->log =
+      arena_alloc(arena, scopes->log_capacity * sizeof(struct Symbol *));
+  scopes->mark_capacity = 16;
+  scopes->depth = 0;
+  scopes->marks = arena_alloc(arena, scopes->mark_capacity * sizeof(int));
+  scope_table_resize(scopes, 256);
+}
+
+// Look up the innermost visible declaration of a name
+struct Symbol *lookup_symbol(struct ScopeTable *scopes, int name) {
+  int slot = scope_slot(scopes, name);
+  return scopes->values[slot];
+}
+
+// Make a symbol visible in the innermost scope, shadowing any outer
+// declaration of the same name.
+void declare_symbol(struct ScopeTable *scopes, struct Symbol *symbol) {
+  // Names are never removed from the table, only their values are cleared,
+  // so the key count only grows with the number of distinct names.
+  if ((scopes->used + 1) * 2 > scopes->slot_count) {
+    scope_table_resize(scopes, scopes->slot_count * 2);
+  }
+  int slot = scope_slot(scopes, symbol->name);
+  if (scopes->keys[slot] == ID_NONE) {
+    scopes->keys[slot] = symbol->name;
+    scopes->used++;
+  }
+  symbol->shadowed = scopes->values[slot];
+  symbol->depth = scopes->depth;
+  scopes->values[slot] = symbol;
+
+  if (scopes->log_count >= scopes->log_capacity) {
+    scopes->log = arena_realloc(
+        scopes->arena, scopes->log,
+        scopes->log_capacity * sizeof(struct Symbol *),
+        scopes->log_capacity * 2 * sizeof(struct Symbol *));
+    scopes->log_capacity = scopes->log_capacity * 2;
+  }
+  scopes->log[scopes->log_count++] = symbol;
+}
+
+void enter_scope(struct ScopeTable *scopes) {
+  if (scopes->depth >= scopes->mark_capacity) {
+    scopes->marks = arena_realloc(scopes->arena, scopes->marks,
+                                  scopes->mark_capacity * sizeof(int),
+                                  scopes->mark_capacity * 2 * sizeof(int));
+    scopes->mark_capacity = scopes->mark_capacity * 2;
+  }
+  scopes->marks[scopes->depth] = scopes->log_count;
+  scopes->depth++;
+}
+
+// Drop every declaration made since the matching enter_scope, making the
+// declarations they shadowed visible again.
+void leave_scope(struct ScopeTable *scopes) {
+  scopes->depth--;
+  int mark = scopes->marks[scopes->depth];
+  while (scopes->log_count > mark) {
+    scopes->log_count--;
+    struct Symbol *symbol = scopes->log[scopes->log_count];
+    int slot = scope_slot(scopes, symbol->name);
+    scopes->values[slot] = symbol->shadowed;
   }
-  return 0; // Unknown type
+}
+
+// Returns the declaration of name in the innermost scope, ignoring outer
+// declarations that may be shadowed.
+static struct Symbol *lookup_current_scope(struct ScopeTable *scopes,
+                                           int name) {
+  struct Symbol *symbol = lookup_symbol(scopes, name);
+  if (symbol && symbol->depth == scopes->depth) {
+    return symbol;
+  }
+  return NULL;
 }
 
 // Create a new variable symbol
-struct Symbol *create_variable_symbol(const char *name, const char *type,
-                                      int offset) {
-  struct Symbol *sym = malloc(sizeof(struct Symbol));
-  sym->name = strdup(name);
+struct Symbol *create_variable_symbol(struct Arena *arena, int name,
+                                      struct Type *type, int offset) {
+  struct Symbol *sym = arena_alloc(arena, sizeof(struct Symbol));
+  sym->name = name;
   sym->type = SYMBOL_VARIABLE;
-  sym->variable.data_type = strdup(type);
-  sym->variable.size = get_type_size(type);
+  sym->variable.data_type = type;
+  sym->variable.size = type->size;
   sym->variable.offset = offset;
   sym->scope = NULL;
+  sym->shadowed = NULL;
+  sym->depth = 0;
   return sym;
 }
 
-// Create a new function symbol
-struct Symbol *create_function_symbol(const char *name, const char *return_type,
-                                      struct ASTNode *node) {
-  struct Symbol *sym = malloc(sizeof(struct Symbol));
-  sym->name = strdup(name);
+// Create a new function symbol. Its locals table is created when its body is
+// analyzed.
+struct Symbol *create_function_symbol(struct Arena *arena,
+                                      struct FlatFunction *function) {
+  struct Symbol *sym = arena_alloc(arena, sizeof(struct Symbol));
+  sym->name = function->name;
   sym->type = SYMBOL_FUNCTION;
-  sym->function.return_type = strdup(return_type);
-  sym->function.param_count = node->function_decl.param_count;
+  sym->function.return_type = function->return_type;
+  sym->function.param_count = function->param_count;
   sym->function.param_types =
-      malloc(node->function_decl.param_count * sizeof(char *));
-  for (int i = 0; i < node->function_decl.param_count; i++) {
-    sym->function.param_types[i] =
-        strdup(node->function_decl.parameters[i].type);
+      arena_alloc(arena, function->param_count * sizeof(struct Type *));
+  for (int i = 0; i < function->param_count; i++) {
+    sym->function.param_types[i] = function->parameters[i].type;
   }
   sym->function.stack_size = 0;
-  sym->function.locals = create_symbol_table();
-  sym->scope = sym->function.locals;
+  sym->function.locals = NULL;
+  sym->scope = NULL;
+  sym->shadowed = NULL;
+  sym->depth = 0;
   return sym;
 }
 
-// Main semantic analysis function
-struct SemanticContext *analyze_program(struct ASTNode *ast) {
-  struct SemanticContext *context = malloc(sizeof(struct SemanticContext));
-  context->global_scope = create_symbol_table();
-  context->current_scope = context->global_scope;
-  context->current_function = NULL;
+// Create the context for analyzing a program
+struct SemanticContext *create_semantic_context(struct Arena *arena) {
+  struct SemanticContext *context =
+      arena_alloc(arena, sizeof(struct SemanticContext));
+  context->arena = arena;
+  context->locals_arena = arena;
+  context->ast = NULL;
+  init_scope_table(&context->scopes, arena);
+  context->global_scope = create_symbol_table(arena);
+  context->current_locals = NULL;
+  context->current_function = ID_NONE;
   context->had_error = 0;
   context->current_stack_offset = 0;
-
-  analyze_node(ast, context);
-
-  // Verify that main function exists
-  if (!lookup_symbol(context->global_scope, "main")) {
-    fprintf(stderr, "Error: No main function found\n");
-    context->had_error = 1;
-  }
-
-  return context->had_error ? NULL : context;
+  context->lowest_stack_offset = 0;
+  context->globals = NULL;
+  context->functions_declared = 0;
+  context->pending_calls = NULL;
+  context->pending_count = 0;
+  context->pending_capacity = 0;
+  return context;
 }
 
-// Analyze a single node
-void analyze_node(struct ASTNode *node, struct SemanticContext *context) {
-  if (!node)
-    return;
-
-  if (node->type == NODE_FUNCTION_DECLARATION) {
-    analyze_function_declaration(node, context);
-    analyze_node(node->next, context);
-  } else if (node->type == NODE_VARIABLE_DECLARATION) {
-    analyze_variable_declaration(node, context);
-  } else if (node->type == NODE_RETURN_STATEMENT) {
-    analyze_expression(node->return_stmt.value, context);
-  } else if (node->type == NODE_IF_STATEMENT) {
-    analyze_if_statement(node, context);
-  } else if (node->type == NODE_WHILE_STATEMENT) {
-    analyze_while_statement(node, context);
-  } else if (node->type == NODE_ASSIGNMENT) {
-    // For assignments, analyze the target identifier first
-    if (node->assignment.target->type == NODE_IDENTIFIER) {
-      struct Symbol *sym = lookup_symbol(
-          context->current_scope, node->assignment.target->identifier.name);
-      if (!sym) {
-        fprintf(stderr, "Error: Assignment to undefined variable %s\n",
-                node->assignment.target->identifier.name);
-        context->had_error = 1;
-      } else if (sym->type == SYMBOL_VARIABLE) {
-        // Store the stack offset in the target identifier node
-        node->assignment.target->identifier.stack_offset = sym->variable.offset;
-      }
-    }
-
-    // Then analyze the value expression
-    analyze_expression(node->assignment.value, context);
-  } else if (node->type == NODE_FUNCTION_CALL ||
-             node->type == NODE_BINARY_OPERATION ||
-             node->type == NODE_INTEGER_LITERAL ||
-             node->type == NODE_IDENTIFIER) {
-    analyze_expression(node, context);
+// Allocate a stack slot for a value of the given type and return its offset.
+// Incomplete types keep the 8-byte slot every variable used to get.
+static int allocate_slot(struct SemanticContext *context, struct Type *type) {
+  int size = type->size;
+  int align = type->align;
+  if (size == 0) {
+    size = 8;
+    align = 8;
   }
-}
-
-// Analyze a block of statements
-void analyze_block(struct ASTNode *node, struct SemanticContext *context) {
-  struct ASTNode *current = node;
-  while (current) {
-    analyze_node(current, context);
-    current = current->next;
+  context->current_stack_offset =
+      (context->current_stack_offset - size) & ~(align - 1);
+  if (context->current_stack_offset < context->lowest_stack_offset) {
+    context->lowest_stack_offset = context->current_stack_offset;
   }
+  return context->current_stack_offset;
 }
 
-// Analyze a function declaration
-void analyze_function_declaration(struct ASTNode *node,
-                                  struct SemanticContext *context) {
-  struct Symbol *func_sym = create_function_symbol(
-      node->function_decl.name, node->function_decl.return_type, node);
-
-  // Add function to current scope
-  if (lookup_symbol(context->current_scope, func_sym->name)) {
-    fprintf(stderr, "Error: Function %s already declared\n", func_sym->name);
+// The checks and declarations below are shared by the walk over the flat AST
+// and by the parser, which calls them as it goes when sema is fused into
+// parsing (see parse_and_analyze). Both see the program in source order.
+
+// Add a function to the global scope. Returns NULL if the name is already
+// declared, in which case the body must not be analyzed.
+struct Symbol *declare_function(struct SemanticContext *context,
+                                struct FlatFunction *function) {
+  if (lookup_symbol(&context->scopes, function->name)) {
+    fprintf(stderr, "Error: Function %s already declared\n",
+            intern_str(function->name));
     context->had_error = 1;
-    return;
+    return NULL;
   }
-  add_symbol(context->current_scope, func_sym);
+  struct Symbol *func_sym = create_function_symbol(context->arena, function);
+  add_symbol(context->global_scope, func_sym);
+  declare_symbol(&context->scopes, func_sym);
+  return func_sym;
+}
+
+// Open the scope of a declared function's parameters and body
+void enter_function(struct SemanticContext *context, struct Symbol *func_sym,
+                    struct FlatFunction *function) {
+  func_sym->function.locals = create_symbol_table(context->locals_arena);
+  func_sym->scope = func_sym->function.locals;
 
   // Set up function context
-  char *prev_function = context->current_function;
   context->current_function = func_sym->name;
-  struct SymbolTable *prev_scope = context->current_scope;
-  context->current_scope = func_sym->function.locals;
-  context->current_scope->parent = prev_scope;
+  context->current_locals = func_sym->function.locals;
+  enter_scope(&context->scopes);
   context->current_stack_offset = 0;
+  context->lowest_stack_offset = 0;
 
   // Add parameters to function's local scope
-  for (int i = 0; i < node->function_decl.param_count; i++) {
+  for (int i = 0; i < function->param_count; i++) {
     // Parameters are stored in negative offsets like other locals
-    context->current_stack_offset -= 8;
-    struct Symbol *param_sym = create_variable_symbol(
-        node->function_decl.parameters[i].name,
-        node->function_decl.parameters[i].type, context->current_stack_offset);
-    add_symbol(context->current_scope, param_sym);
+    struct Type *type = function->parameters[i].type;
+    struct Symbol *param_sym =
+        create_variable_symbol(context->locals_arena,
+                               function->parameters[i].name, type,
+                               allocate_slot(context, type));
+    add_symbol(context->current_locals, param_sym);
+    declare_symbol(&context->scopes, param_sym);
   }
+}
 
-  // Analyze function body
-  struct ASTNode *body = node->function_decl.body;
-  while (body) {
-    analyze_node(body, context);
-    body = body->next;
+// Declare a function and open the scope of its parameters and body. Returns
+// NULL if the name is already declared, in which case the body must not be
+// analyzed.
+struct Symbol *begin_function(struct SemanticContext *context,
+                              struct FlatFunction *function) {
+  struct Symbol *func_sym = declare_function(context, function);
+  if (func_sym) {
+    enter_function(context, func_sym, function);
   }
+  return func_sym;
+}
 
-  // Update function's stack size (align to 16 bytes)
-  func_sym->function.stack_size = (-context->current_stack_offset + 15) & ~15;
+// Close the scope opened by enter_function once the body is analyzed
+void end_function(struct SemanticContext *context, struct Symbol *func_sym) {
+  // Update function's stack size (align to 16 bytes). The slots of the
+  // bodies' variables are below the function's own ones.
+  func_sym->function.stack_size = (-context->lowest_stack_offset + 15) & ~15;
 
   // Restore context
-  context->current_scope = prev_scope;
-  context->current_function = prev_function;
+  leave_scope(&context->scopes);
+  context->current_locals = NULL;
+  context->current_function = ID_NONE;
 }
 
-// Analyze a variable declaration
-void analyze_variable_declaration(struct ASTNode *node,
-                                  struct SemanticContext *context) {
+// Allocate the stack slot of a variable declaration and store its offset in
+// *offset. Returns the symbol to pass to end_variable once the initializer is
+// analyzed, or NULL if the name is already declared in the current scope, in
+// which case the initializer is not analyzed.
+struct Symbol *begin_variable(struct SemanticContext *context, int name,
+                              struct Type *datatype, int *offset) {
   // Allocate stack space for the variable
-  context->current_stack_offset -= 8; // 8 bytes for all variables for now
+  *offset = allocate_slot(context, datatype);
 
   struct Symbol *var_sym =
-      create_variable_symbol(node->var_decl.name, node->var_decl.datatype,
-                             context->current_stack_offset);
-
-  // Store the offset in the AST node for code generation
-  node->var_decl.stack_offset = context->current_stack_offset;
+      create_variable_symbol(context->locals_arena, name, datatype, *offset);
 
   // Check if variable already exists in current scope
-  if (lookup_symbol(context->current_scope, var_sym->name)) {
+  if (lookup_current_scope(&context->scopes, name)) {
     fprintf(stderr, "Error: Variable %s already declared in current scope\n",
-            var_sym->name);
+            intern_str(name));
     context->had_error = 1;
-    return;
+    return NULL;
   }
+  return var_sym;
+}
 
-  // Analyze initialization expression if present
-  if (node->var_decl.value) {
-    analyze_expression(node->var_decl.value, context);
+// Make a variable visible after its initializer
+void end_variable(struct SemanticContext *context, struct Symbol *var_sym) {
+  // Only the function's outermost block is recorded for --print-sema
+  if (context->scopes.depth == 1) {
+    add_symbol(context->current_locals, var_sym);
+  }
+  declare_symbol(&context->scopes, var_sym);
+}
+
+// Look up a name in the scopes of the function being analyzed, then among
+// the program's functions if they are kept apart
+static struct Symbol *lookup_name(struct SemanticContext *context, int name) {
+  struct Symbol *sym = lookup_symbol(&context->scopes, name);
+  if (!sym && context->globals) {
+    sym = lookup_symbol(context->globals, name);
   }
+  return sym;
+}
 
-  add_symbol(context->current_scope, var_sym);
+// Stack offset of the variable a name refers to, 0 if it is not a variable.
+// Its type is stored in *type, NULL if it is not a variable. error is the
+// message format reported if the name is undefined.
+int resolve_variable(struct SemanticContext *context, int name,
+                     struct Type **type, const char *error) {
+  struct Symbol *sym = lookup_name(context, name);
+  *type = NULL;
+  if (!sym) {
+    fprintf(stderr, error, intern_str(name));
+    context->had_error = 1;
+  } else if (sym->type == SYMBOL_VARIABLE) {
+    *type = sym->variable.data_type;
+    return sym->variable.offset;
+  }
+  return 0;
 }
 
-// Analyze an expression
-void analyze_expression(struct ASTNode *node, struct SemanticContext *context) {
-  if (!node)
+// Check that a called function is declared. printf is provided by libc. A
+// function may be called before its definition, so while functions are
+// still being declared the check waits for finish_analysis.
+void check_call(struct SemanticContext *context, int name) {
+  if (name == ID_PRINTF || lookup_name(context, name)) {
+    return;
+  }
+  if (context->functions_declared) {
+    fprintf(stderr, "Error: Undefined function %s\n", intern_str(name));
+    context->had_error = 1;
     return;
+  }
+  if (context->pending_count == context->pending_capacity) {
+    int capacity =
+        context->pending_capacity == 0 ? 16 : context->pending_capacity * 2;
+    context->pending_calls = arena_realloc(
+        context->arena, context->pending_calls,
+        context->pending_capacity * sizeof(int), capacity * sizeof(int));
+    context->pending_capacity = capacity;
+  }
+  context->pending_calls[context->pending_count++] = name;
+}
+
+// Enter the body of an if or while statement. Returns the stack offset to
+// pass to leave_body.
+int enter_body(struct SemanticContext *context) {
+  enter_scope(&context->scopes);
+  return context->current_stack_offset;
+}
+
+// Leave a body, its variables' slots are reused by the code after it
+void leave_body(struct SemanticContext *context, int saved_offset) {
+  leave_scope(&context->scopes);
+  context->current_stack_offset = saved_offset;
+}
 
-  if (node->type == NODE_BINARY_OPERATION) {
-    analyze_expression(node->binary_op.left, context);
-    analyze_expression(node->binary_op.right, context);
-  } else if (node->type == NODE_INTEGER_LITERAL) {
-    // Nothing to analyze for integer literals
-  } else if (node->type == NODE_IDENTIFIER) {
-    struct Symbol *sym =
-        lookup_symbol(context->current_scope, node->identifier.name);
-    if (!sym) {
-      fprintf(stderr, "Error: Undefined variable %s\n", node->identifier.name);
+// Check the calls to functions that were not declared yet and that the
+// program has a main function once everything is analyzed. Returns the
+// context, or NULL if any error was reported.
+struct SemanticContext *finish_analysis(struct SemanticContext *context) {
+  int i = 0;
+  while (i < context->pending_count) {
+    int name = context->pending_calls[i];
+    if (!lookup_symbol(&context->scopes, name)) {
+      fprintf(stderr, "Error: Undefined function %s\n", intern_str(name));
       context->had_error = 1;
-    } else if (sym->type == SYMBOL_VARIABLE) {
-      // Store the stack offset in the AST node for code generation
-      node->identifier.stack_offset = sym->variable.offset;
     }
-  } else if (node->type == NODE_FUNCTION_CALL) {
-    struct Symbol *sym =
-        lookup_symbol(context->current_scope, node->func_call.name);
-    if (!sym && strcmp(node->func_call.name, "printf") != 0) {
-      fprintf(stderr, "Error: Undefined function %s\n", node->func_call.name);
+    i = i + 1;
+  }
+  context->pending_count = 0;
+
+  if (!lookup_symbol(&context->scopes, ID_MAIN)) {
+    fprintf(stderr, "Error: No main function found\n");
+    context->had_error = 1;
+  }
+
+  return context->had_error ? NULL : context;
+}
+
+// Analyze the functions in ast, which follow the ones the context has
+// already seen, one after another. Errors are recorded in
+// context->had_error.
+void analyze_functions(struct SemanticContext *context, struct FlatAST *ast) {
+  context->ast = ast;
+
+  // The root's children are the function declarations
+  int node = 1;
+  while (node < ast->ends[0]) {
+    analyze_node(node, context);
+    node = ast->ends[node];
+  }
+}
+
+// Bodies of the declared functions, analyzed by worker threads. Each thread
+// has a context of its own, with its own scopes and stack offsets, that looks
+// the functions up in the shared program context.
+struct ParallelSema {
+  struct SemanticContext *program;
+  struct Interner *interner; // For the names in error messages
+  int *nodes;                // Function declarations to analyze
+  int count;
+  atomic_int next; // Index of the next function to analyze
+};
+
+struct SemaWorker {
+  struct ParallelSema *shared;
+  struct SemanticContext *context;
+  struct Arena arena; // Adopted by the program's locals arena once done
+};
+
+static void *sema_worker(void *arg) {
+  struct SemaWorker *worker = arg;
+  struct ParallelSema *shared = worker->shared;
+  use_interner(shared->interner);
+
+  struct SemanticContext *context = create_semantic_context(&worker->arena);
+  context->ast = shared->program->ast;
+  context->global_scope = shared->program->global_scope;
+  context->globals = &shared->program->scopes;
+  context->functions_declared = 1;
+  worker->context = context;
+
+  int index;
+  while ((index = atomic_fetch_add(&shared->next, 1)) < shared->count) {
+    analyze_function_body(shared->nodes[index], context);
+  }
+  return NULL;
+}
+
+// Analyze the function bodies on jobs threads
+static void analyze_parallel(struct SemanticContext *context, int *nodes,
+                             int count, int jobs) {
+  struct ParallelSema shared;
+  shared.program = context;
+  shared.interner = current_interner();
+  shared.nodes = nodes;
+  shared.count = count;
+  atomic_init(&shared.next, 0);
+
+  struct SemaWorker *workers = malloc(jobs * sizeof(struct SemaWorker));
+  if (!workers) {
+    fprintf(stderr, "Error: memory allocation failed\n");
+    exit(1);
+  }
+  int i = 0;
+  while (i < jobs) {
+    workers[i].shared = &shared;
+    workers[i].context = NULL;
+    arena_init(&workers[i].arena);
+    i = i + 1;
+  }
+  run_workers(sema_worker, workers, sizeof(struct SemaWorker), jobs);
+  i = 0;
+  while (i < jobs) {
+    // Workers that could not be started have no context
+    if (workers[i].context && workers[i].context->had_error) {
       context->had_error = 1;
     }
+    arena_adopt(context->locals_arena, &workers[i].arena);
+    i = i + 1;
+  }
+  free(workers);
+}
 
-    // Analyze function arguments
-    struct ASTNode *arg = node->func_call.arguments;
-    while (arg) {
-      analyze_expression(arg, context);
-      arg = arg->next;
-    }
-  } else if (node->type == NODE_ASSIGNMENT) {
-    // For assignments, analyze the target identifier first
-    if (node->assignment.target->type == NODE_IDENTIFIER) {
-      struct Symbol *sym = lookup_symbol(
-          context->current_scope, node->assignment.target->identifier.name);
-      if (!sym) {
-        fprintf(stderr, "Error: Assignment to undefined variable %s\n",
-                node->assignment.target->identifier.name);
-        context->had_error = 1;
-      } else if (sym->type == SYMBOL_VARIABLE) {
-        // Store the stack offset in the target identifier node
-        node->assignment.target->identifier.stack_offset = sym->variable.offset;
-      }
+// Main semantic analysis function. Every function is declared first, so
+// functions can be called before their definition, and then the bodies are
+// analyzed on up to jobs threads.
+struct SemanticContext *analyze_program(struct FlatAST *ast,
+                                        struct Arena *arena, int jobs) {
+  struct SemanticContext *context = create_semantic_context(arena);
+  context->ast = ast;
+
+  // The root's children are the function declarations
+  int count = 0;
+  int *nodes = arena_alloc(arena, (ast->function_count + 1) * sizeof(int));
+  int node = 1;
+  while (node < ast->ends[0]) {
+    if (ast->kinds[node] == NODE_FUNCTION_DECLARATION) {
+      struct FlatFunction *function = &ast->functions[ast->data[node]];
+      function->symbol = declare_function(context, function);
+      nodes[count++] = node;
     }
+    node = ast->ends[node];
+  }
+  context->functions_declared = 1;
 
-    // Then analyze the value expression
-    analyze_expression(node->assignment.value, context);
+  if (jobs > count) {
+    jobs = count;
+  }
+  if (jobs > 1) {
+    analyze_parallel(context, nodes, count, jobs);
+  } else {
+    int i = 0;
+    while (i < count) {
+      analyze_function_body(nodes[i], context);
+      i = i + 1;
+    }
   }
+  return finish_analysis(context);
 }
 
-// Analyze a while statement
-void analyze_while_statement(struct ASTNode *node,
-                             struct SemanticContext *context) {
-  // Analyze the while condition in the current scope
-  analyze_expression(node->while_stmt.condition, context);
+// Analyze a single node
+void analyze_node(int node, struct SemanticContext *context) {
+  struct FlatAST *ast = context->ast;
+  int kind = ast->kinds[node];
 
-  // Create a new scope for while body
-  struct SymbolTable *while_scope = create_symbol_table();
-  while_scope->parent = context->current_scope;
+  if (kind == NODE_FUNCTION_DECLARATION) {
+    analyze_function_declaration(node, context);
+  } else if (kind == NODE_VARIABLE_DECLARATION) {
+    analyze_variable_declaration(node, context);
+  } else if (kind == NODE_RETURN_STATEMENT) {
+    analyze_expression(node + 1, context);
+  } else if (kind == NODE_ASSIGNMENT || kind == NODE_FUNCTION_CALL ||
+             kind == NODE_BINARY_OPERATION || kind == NODE_INTEGER_LITERAL ||
+             kind == NODE_IDENTIFIER) {
+    analyze_expression(node, context);
+  }
+}
 
-  // Save current scope and enter while scope
-  struct SymbolTable *prev_scope = context->current_scope;
-  context->current_scope = while_scope;
+// Block being walked by analyze_block
+struct SemaFrame {
+  int block;        // The NODE_BLOCK
+  int next;         // Next statement to analyze
+  int owner;        // If statement whose then body this is, or -1
+  int saved_offset; // Stack offset to restore when the block is left
+};
+
+// Push the body of an if or while statement, which gets its own scope
+static struct SemaFrame *push_sema_frame(struct SemanticContext *context,
+                                         struct SemaFrame *frames,
+                                         struct SemaFrame *inline_frames,
+                                         int *count, int *capacity, int block,
+                                         int owner) {
+  if (*count == *capacity) {
+    frames = stack_grow(frames, inline_frames, capacity,
+                        sizeof(struct SemaFrame));
+  }
+  struct SemaFrame *frame = &frames[(*count)++];
+  frame->block = block;
+  frame->next = block + 1;
+  frame->owner = owner;
+  frame->saved_offset = enter_body(context);
+  return frames;
+}
 
-  // Save current stack offset
-  int saved_offset = context->current_stack_offset;
+// Analyze the statements of a block. The caller opens a scope for it if
+// needed; nested if and while bodies are walked with an explicit stack
+// rather than by recursion.
+void analyze_block(int block, struct SemanticContext *context) {
+  struct FlatAST *ast = context->ast;
+  struct SemaFrame inline_frames[16];
+  struct SemaFrame *frames = inline_frames;
+  int capacity = 16;
+  int count = 1;
+  frames[0].block = block;
+  frames[0].next = block + 1;
+  frames[0].owner = -1;
+  frames[0].saved_offset = context->current_stack_offset;
+
+  while (count > 0) {
+    struct SemaFrame *frame = &frames[count - 1];
+    if (frame->next >= ast->ends[frame->block]) {
+      // The outermost block's scope belongs to the caller
+      count = count - 1;
+      if (count == 0) {
+        break;
+      }
+      leave_body(context, frame->saved_offset);
+
+      // The else body starts at the same offset as the if body did
+      int owner = frame->owner;
+      int else_body = ast->ends[frame->block];
+      if (owner >= 0 && else_body < ast->ends[owner]) {
+        frames = push_sema_frame(context, frames, inline_frames, &count,
+                                 &capacity, else_body, -1);
+      }
+      continue;
+    }
 
-  // Analyze the while body
-  analyze_block(node->while_stmt.body, context);
+    int node = frame->next;
+    frame->next = ast->ends[node];
+    int kind = ast->kinds[node];
+    if (kind == NODE_IF_STATEMENT || kind == NODE_WHILE_STATEMENT) {
+      // The condition is analyzed in the current scope
+      int condition = node + 1;
+      analyze_expression(condition, context);
+      frames = push_sema_frame(context, frames, inline_frames, &count,
+                               &capacity, ast->ends[condition],
+                               kind == NODE_IF_STATEMENT ? node : -1);
+    } else {
+      analyze_node(node, context);
+    }
+  }
 
-  // Restore scope and offset
-  context->current_scope = prev_scope;
-  context->current_stack_offset = saved_offset;
+  stack_free(frames, inline_frames);
 }
 
-// Analyze an if statement
-void analyze_if_statement(struct ASTNode *node,
-                          struct SemanticContext *context) {
-  // Analyze the if condition in the current scope
-  analyze_expression(node->if_stmt.condition, context);
-
-  // Create a new scope for 'if' body
-  struct SymbolTable *if_scope = create_symbol_table();
-  if_scope->parent = context->current_scope;
-
-  // Save current scope and enter if scope
-  struct SymbolTable *prev_scope = context->current_scope;
-  context->current_scope = if_scope;
+// Analyze the body of a function declared with declare_function
+void analyze_function_body(int node, struct SemanticContext *context) {
+  struct FlatFunction *function =
+      &context->ast->functions[context->ast->data[node]];
+  // A redeclaration has been reported already
+  if (!function->symbol) {
+    return;
+  }
 
-  // Save current stack offset
-  int saved_offset = context->current_stack_offset;
+  // Analyze function body, which shares the parameters' scope
+  enter_function(context, function->symbol, function);
+  analyze_block(node + 1, context);
+  end_function(context, function->symbol);
+}
 
-  // Analyze the 'if' body
-  analyze_block(node->if_stmt.body, context);
+// Analyze a function declaration
+void analyze_function_declaration(int node, struct SemanticContext *context) {
+  struct FlatFunction *function =
+      &context->ast->functions[context->ast->data[node]];
+  function->symbol = declare_function(context, function);
+  analyze_function_body(node, context);
+}
 
-  // Restore scope and offset
-  context->current_scope = prev_scope;
-  context->current_stack_offset = saved_offset;
+// Analyze a variable declaration
+void analyze_variable_declaration(int node, struct SemanticContext *context) {
+  struct FlatAST *ast = context->ast;
+  struct FlatVariable *variable = &ast->variables[ast->data[node]];
 
-  // Handle else body
-  if (node->if_stmt.else_body) {
-    // Create a new scope for 'else' body
-    struct SymbolTable *else_scope = create_symbol_table();
-    else_scope->parent = context->current_scope;
+  // Store the offset in the AST for code generation
+  struct Symbol *var_sym =
+      begin_variable(context, variable->name, variable->datatype,
+                     &variable->stack_offset);
+  if (!var_sym) {
+    return;
+  }
 
-    // Enter else scope
-    context->current_scope = else_scope;
-    context->current_stack_offset =
-        saved_offset; // Reset to the same offset as before the if
+  // Analyze initialization expression if present
+  if (ast->ends[node] > node + 1) {
+    analyze_expression(node + 1, context);
+  }
+  end_variable(context, var_sym);
+}
 
-    // Analyze the 'else' body
-    analyze_block(node->if_stmt.else_body, context);
+// Analyze an expression. The nodes are checked in pre-order, which is the
+// order they are stored in, so this is a single scan over the subtree.
+void analyze_expression(int node, struct SemanticContext *context) {
+  struct FlatAST *ast = context->ast;
+  int end = ast->ends[node];
+
+  while (node < end) {
+    int kind = ast->kinds[node];
+    if (kind == NODE_IDENTIFIER) {
+      // Store the stack offset in the AST for code generation
+      struct FlatVariable *variable = &ast->variables[ast->data[node]];
+      variable->stack_offset =
+          resolve_variable(context, variable->name, &variable->datatype,
+                           "Error: Undefined variable %s\n");
+    } else if (kind == NODE_FUNCTION_CALL) {
+      // The arguments follow as the call's children
+      check_call(context, ast->data[node]);
+    } else if (kind == NODE_ASSIGNMENT) {
+      // For assignments, analyze the target identifier first
+      int target = node + 1;
+      if (ast->kinds[target] == NODE_IDENTIFIER) {
+        struct FlatVariable *variable = &ast->variables[ast->data[target]];
+        variable->stack_offset = resolve_variable(
+            context, variable->name, &variable->datatype,
+            "Error: Assignment to undefined variable %s\n");
+      }
 
-    // Restore scope and offset
-    context->current_scope = prev_scope;
-    context->current_stack_offset = saved_offset;
+      // Then continue with the value expression
+      node = ast->ends[target];
+      continue;
+    }
+    // Binary operations and literals have nothing to check themselves
+    node = node + 1;
   }
 }
 
 // Get the symbol table for a function
 struct SymbolTable *get_function_scope(struct SemanticContext *context,
-                                       const char *func_name) {
-  struct Symbol *func = lookup_symbol(context->global_scope, func_name);
+                                       int func_name) {
+  struct Symbol *func = lookup_symbol(&context->scopes, func_name);
   return func ? func->function.locals : NULL;
 }
 
 // Get a function's total stack size
-int get_function_stack_size(struct SemanticContext *context,
-                            const char *func_name) {
-  struct Symbol *func = lookup_symbol(context->global_scope, func_name);
+int get_function_stack_size(struct SemanticContext *context, int func_name) {
+  struct Symbol *func = lookup_symbol(&context->scopes, func_name);
   return func ? func->function.stack_size : 0;
 }
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Source text of the program being compiled. Regular files are mapped
+// read-only so the lexer works on the page cache directly; pipes and other
+// streams are read in large chunks into a heap buffer. The text is not NUL
+// terminated, everything that reads it is bounded by length.
+struct SourceFile {
+  const char *data;
+  size_t length;
+  int mapped; // data is a mapping to munmap rather than a buffer to free
+};
+
+#define SOURCE_CHUNK_SIZE (1 << 20) // Bytes requested per read from a pipe
+
+// Read a stream to its end
+static int read_source_stream(struct SourceFile *source, int fd,
+                              const char *filename) {
+  size_t capacity = SOURCE_CHUNK_SIZE;
+  size_t length = 0;
+  char *buffer = malloc(capacity);
+  if (!buffer) {
+    fprintf(stderr, "Error: memory allocation failed\n");
+    return 1;
+  }
+  while (1) {
+    if (capacity - length < SOURCE_CHUNK_SIZE) {
+      capacity = capacity * 2;
+      char *grown = realloc(buffer, capacity);
+      if (!grown) {
+        fprintf(stderr, "Error: memory allocation failed\n");
+        free(buffer);
+        return 1;
+      }
+      buffer = grown;
+    }
+    ssize_t count = read(fd, buffer + length, capacity - length);
+    if (count == 0) {
+      break;
+    } else if (count < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      fprintf(stderr, "Error: could not read file '%s': %s\n", filename,
+              strerror(errno));
+      free(buffer);
+      return 1;
+    }
+    length = length + count;
+  }
+  source->data = buffer;
+  source->length = length;
+  source->mapped = 0;
+  return 0;
+}
+
+void release_source(struct SourceFile *source) {
+  if (source->mapped) {
+    munmap((void *)source->data, source->length);
+  } else {
+    free((void *)source->data);
+  }
+  source->data = NULL;
+  source->length = 0;
+}
+
+// Load the file named filename, or standard input if it is "-". Returns 0 on
+// success and 1 after reporting an error.
+int read_source(struct SourceFile *source, const char *filename) {
+  int fd = STDIN_FILENO;
+  if (strcmp(filename, "-") != 0) {
+    fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+      fprintf(stderr, "Error: could not open file '%s'\n", filename);
+      return 1;
+    }
+  }
+
+  struct stat info;
+  int result;
+  if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+    int flags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+    flags = flags | MAP_POPULATE; // Fault the whole file in up front
+#endif
+    void *data = mmap(NULL, info.st_size, PROT_READ, flags, fd, 0);
+    if (data == MAP_FAILED) {
+      // Not every file system can be mapped, read it instead
+      result = read_source_stream(source, fd, filename);
+    } else {
+      madvise(data, info.st_size, MADV_SEQUENTIAL);
+      source->data = data;
+      source->length = info.st_size;
+      source->mapped = 1;
+      result = 0;
+    }
+  } else {
+    result = read_source_stream(source, fd, filename);
+  }
+  if (fd != STDIN_FILENO) {
+    close(fd);
+  }
+
+  // Token positions are ints
+  if (result == 0 && source->length > INT_MAX) {
+    fprintf(stderr, "Error: file '%s' is too large\n", filename);
+    release_source(source);
+    return 1;
+  }
+  return result;
+}
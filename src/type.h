@@ -0,0 +1,175 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "common.h"
+#include "intern.h"
+
+// Type descriptors. Every type is created once and shared, so types compare
+// with == and their size, alignment and spelling are computed only when the
+// type is first built. Like the interner, each compilation has its own table
+// for as long as it runs. Threads that help with a compilation share it with
+// use_types, so types are looked up and created under a lock; a type never
+// changes once it is created.
+
+struct TypeTable {
+  struct Type **slots; // Open addressing table, NULL marks an empty slot
+  int slot_count;
+  int count;
+  struct Type *int_type;
+  struct Type *char_type;
+  struct Arena arena; // Types and their spellings
+  pthread_mutex_t lock;
+};
+
+static _Thread_local struct TypeTable type_storage;
+static _Thread_local struct TypeTable *types;
+
+static unsigned int type_hash(int kind, struct Type *base, int length,
+                              int name) {
+  unsigned int hash = (unsigned int)kind * 2654435761u;
+  hash = (hash ^ (unsigned int)(size_t)base) * 16777619u;
+  hash = (hash ^ (unsigned int)length) * 16777619u;
+  hash = (hash ^ (unsigned int)name) * 16777619u;
+  return hash;
+}
+
+static void type_grow_slots(void) {
+  int slot_count = types->slot_count == 0 ? 256 : types->slot_count * 2;
+  struct Type **slots = calloc(slot_count, sizeof(struct Type *));
+  if (!slots) {
+    fprintf(stderr, "Error: memory allocation failed\n");
+    exit(1);
+  }
+  int i = 0;
+  while (i < types->slot_count) {
+    struct Type *type = types->slots[i];
+    if (type) {
+      int slot = type_hash(type->kind, type->base, type->length, type->name) &
+                 (slot_count - 1);
+      while (slots[slot]) {
+        slot = (slot + 1) & (slot_count - 1);
+      }
+      slots[slot] = type;
+    }
+    i++;
+  }
+  free(types->slots);
+  types->slots = slots;
+  types->slot_count = slot_count;
+}
+
+static struct Type *add_type(int kind, struct Type *base, int length,
+                             int name) {
+  int slot = type_hash(kind, base, length, name) & (types->slot_count - 1);
+  while (types->slots[slot]) {
+    struct Type *type = types->slots[slot];
+    if (type->kind == kind && type->base == base && type->length == length &&
+        type->name == name) {
+      return type;
+    }
+    slot = (slot + 1) & (types->slot_count - 1);
+  }
+
+  struct Type *type = arena_alloc(&types->arena, sizeof(struct Type));
+  type->kind = kind;
+  type->base = base;
+  type->length = length;
+  type->name = name;
+  char spelling[64];
+  if (kind == TYPE_INT || kind == TYPE_CHAR) {
+    type->size = kind == TYPE_INT ? 8 : 1; // Using 64-bit integers
+    type->align = type->size;
+    type->spelling = intern_str(name);
+  } else if (kind == TYPE_POINTER) {
+    type->size = 8;
+    type->align = 8;
+    snprintf(spelling, sizeof(spelling), "%s*", base->spelling);
+    type->spelling = arena_strdup(&types->arena, spelling);
+  } else if (kind == TYPE_ARRAY) {
+    type->size = base->size * length;
+    type->align = base->align;
+    snprintf(spelling, sizeof(spelling), "%s[%d]", base->spelling, length);
+    type->spelling = arena_strdup(&types->arena, spelling);
+  } else {
+    // Struct members cannot be declared yet, so structs are incomplete
+    type->size = 0;
+    type->align = 1;
+    type->spelling = intern_str(name);
+  }
+
+  types->count++;
+  // Keep the load factor below one half
+  if (types->count * 2 > types->slot_count) {
+    type_grow_slots();
+    slot = type_hash(kind, base, length, name) & (types->slot_count - 1);
+    while (types->slots[slot]) {
+      slot = (slot + 1) & (types->slot_count - 1);
+    }
+  }
+  types->slots[slot] = type;
+  return type;
+}
+
+// Return the type with the given structure, creating it on first use
+static struct Type *make_type(int kind, struct Type *base, int length,
+                              int name) {
+  pthread_mutex_lock(&types->lock);
+  struct Type *type = add_type(kind, base, length, name);
+  pthread_mutex_unlock(&types->lock);
+  return type;
+}
+
+struct Type *pointer_to(struct Type *base) {
+  return make_type(TYPE_POINTER, base, 0, ID_NONE);
+}
+
+struct Type *array_of(struct Type *base, int length) {
+  return make_type(TYPE_ARRAY, base, length, ID_NONE);
+}
+
+struct Type *struct_type(int tag) {
+  return make_type(TYPE_STRUCT, NULL, 0, tag);
+}
+
+// Type named by a declaration. Names other than the builtin types are taken
+// to be struct tags.
+struct Type *type_for_name(int name) {
+  if (name == ID_INT) {
+    return types->int_type;
+  } else if (name == ID_CHAR) {
+    return types->char_type;
+  }
+  return struct_type(name);
+}
+
+void init_types(void) {
+  types = &type_storage;
+  pthread_mutex_init(&types->lock, NULL);
+  types->slots = NULL;
+  types->slot_count = 0;
+  types->count = 0;
+  arena_init(&types->arena);
+  type_grow_slots();
+  types->int_type = make_type(TYPE_INT, NULL, 0, ID_INT);
+  types->char_type = make_type(TYPE_CHAR, NULL, 0, ID_CHAR);
+}
+
+// The table of the calling thread, to pass to use_types
+struct TypeTable *current_types(void) { return types; }
+
+// Make the calling thread use the table of another thread
+void use_types(struct TypeTable *shared) { types = shared; }
+
+void free_types(void) {
+  pthread_mutex_destroy(&types->lock);
+  free(types->slots);
+  arena_free(&types->arena);
+  types->slots = NULL;
+  types->slot_count = 0;
+  types->count = 0;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Run worker on count threads, the calling thread being the first of them,
+// and wait for all of them to return. Thread i is passed the i-th element of
+// args, whose elements are size bytes; with a size of 0 every thread gets
+// args itself. A thread that cannot be started is left out, so workers take
+// their work from a queue they share rather than being handed a part of it.
+void run_workers(void *(*worker)(void *), void *args, size_t size,
+                 int count) {
+  pthread_t *threads = malloc(count * sizeof(pthread_t));
+  if (!threads) {
+    fprintf(stderr, "Error: memory allocation failed\n");
+    exit(1);
+  }
+  int started = 1;
+  while (started < count) {
+    if (pthread_create(&threads[started], NULL, worker,
+                       (char *)args + started * size) != 0) {
+      break;
+    }
+    started = started + 1;
+  }
+  worker(args);
+  int i = 1;
+  while (i < started) {
+    pthread_join(threads[i], NULL);
+    i = i + 1;
+  }
+  free(threads);
+}
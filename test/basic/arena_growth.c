@@ -0,0 +1,16 @@
+// RUN: awk 'BEGIN { n = 400; for (f = 0; f < n; f++) { print "int f" f "(int a) {"; print "    int b = a + " f ";"; print "    return b;"; print "}" } print "int main() {"; print "    int sum = 0;"; for (f = 0; f < n; f++) print "    sum = sum + f" f "(1);"; for (v = 0; v < 3000; v++) print "    int local" v " = " v % 10 ";"; printf "    sum = sum"; for (v = 0; v < 3000; v++) printf " + local%%d", v; print ";"; print "    printf(\"sum: %%d\\n\", sum);"; s = "z"; while (length(s) < 20000) s = s s; print "    printf(\"" s "\\n\");"; print "    return 0;"; print "}" }' > %t.program.c
+// RUN: %compiler %t.program.c > %t.s
+// RUN: %compiler --stream %t.program.c > %t.stream.s
+// RUN: %compiler -j4 %t.program.c > %t.parallel.s
+// RUN: cmp %t.s %t.parallel.s
+// RUN: %gcc %t.s -o %t
+// RUN: %t | FileCheck %s
+// RUN: %t | tail -n 1 | wc -c | FileCheck --check-prefix=STRING %s
+// RUN: %gcc %t.stream.s -o %t.stream
+// RUN: %t.stream | FileCheck %s
+// CHECK: sum: 93700
+// STRING: 32769
+// Enough functions, locals and instructions to fill many arena blocks, arrays
+// that grow past the large allocation size and are resized with realloc, and
+// a string literal that gets a block of its own. --stream resets the arena of
+// each function before the next one.
@@ -0,0 +1,15 @@
+// RUN: rm -rf %t && mkdir -p %t
+// RUN: cp %s %t/first.c && cp %s %t/second.c
+// RUN: %compiler -j2 %t/first.c %t/second.c
+// RUN: cmp %t/first.s %t/second.s
+// RUN: %gcc %t/first.s -o %t/first
+// RUN: %t/first | FileCheck %s
+int triple(int x) {
+    return x * 3;
+}
+
+int main() {
+    printf("%d\n", triple(14));
+    // CHECK: 42
+    return 0;
+}
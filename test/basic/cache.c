@@ -0,0 +1,23 @@
+// RUN: %compiler %s > %t.uncached.s
+// RUN: rm -rf %t.cache
+// RUN: %compiler --cache %t.cache %s > %t.miss.s
+// RUN: %compiler --cache %t.cache %s > %t.s
+// RUN: cmp %t.uncached.s %t.miss.s
+// RUN: cmp %t.uncached.s %t.s
+// RUN: %gcc %t.s -o %t
+// RUN: %t | FileCheck %s
+// A temporary file left by a killed compiler is removed once it is stale
+// RUN: touch -d '1 hour ago' %t.cache/tmp.stale
+// RUN: touch %t.cache/tmp.fresh
+// RUN: %compiler --cache %t.cache --stream %s > %t.stream.s
+// RUN: test ! -e %t.cache/tmp.stale
+// RUN: test -e %t.cache/tmp.fresh
+int twice(int x) {
+    return x + x;
+}
+
+int main() {
+    // CHECK: cached: 42
+    printf("cached: %d\n", twice(21));
+    return 0;
+}
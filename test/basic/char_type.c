@@ -0,0 +1,25 @@
+// RUN: %compiler %s > %t.s
+// RUN: %gcc %t.s -o %t
+// RUN: %t | FileCheck %s
+int twice(char value) {
+    return value + value;
+}
+
+int main() {
+    char a = 100;
+    char b = 27;
+    int n = 1000;
+    // CHECK: a: 100 b: 27 n: 1000
+    printf("a: %d b: %d n: %d\n", a, b, n);
+
+    // Only the low byte is kept, and it is read back sign extended
+    a = a + b;
+    b = a + 1;
+    // CHECK: a: 127 b: -128
+    printf("a: %d b: %d\n", a, b);
+
+    char c = n;
+    // CHECK: c: -24 twice: -48
+    printf("c: %d twice: %d\n", c, twice(c));
+    return 0;
+}
@@ -0,0 +1,17 @@
+// RUN: awk 'BEGIN { n = 100000; print "int main() {"; print "    int depth = 0;"; for (i = 0; i < n; i++) print "    if (depth == " i ") { int level = " i "; depth = level + 1;"; for (i = 0; i < n; i++) printf "}"; print ""; print "    printf(\"depth: %%d\\n\", depth);"; print "    return 0;"; print "}" }' > %t.nested.c
+// RUN: %compiler %t.nested.c > %t.nested.s
+// RUN: %gcc %t.nested.s -o %t.nested
+// RUN: %t.nested | FileCheck --check-prefix=NESTED %s
+// NESTED: depth: 100000
+// RUN: awk 'BEGIN { n = 100000; print "int main() {"; print "    int x = " n - 1 ";"; print "    int y = 0;"; printf "    if (x == 0) { y = 0; }"; for (i = 1; i < n; i++) printf " else if (x == %%d) { y = %%d; }", i, i * 2; print ""; print "    printf(\"chain: %%d\\n\", y);"; print "    return 0;"; print "}" }' > %t.chain.c
+// RUN: %compiler %t.chain.c > %t.chain.s
+// RUN: %gcc %t.chain.s -o %t.chain
+// RUN: %t.chain | FileCheck --check-prefix=CHAIN %s
+// CHAIN: chain: 199998
+// RUN: awk 'BEGIN { n = 100000; print "int main() {"; printf "    int sum = 1"; for (i = 1; i < n; i++) printf " + 1"; print ";"; print "    printf(\"sum: %%d\\n\", sum);"; print "    return 0;"; print "}" }' > %t.sum.c
+// RUN: %compiler %t.sum.c > %t.sum.s
+// RUN: %gcc %t.sum.s -o %t.sum
+// RUN: %t.sum | FileCheck --check-prefix=SUM %s
+// SUM: sum: 100000
+// Nested bodies, else-if chains and operator chains 100000 deep, which
+// overflow the native stack when they are walked recursively
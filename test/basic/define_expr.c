@@ -0,0 +1,76 @@
+// RUN: %compiler %s > %t.s
+// RUN: %gcc %t.s -o %t
+// RUN: %t | FileCheck %s
+// RUN: %compiler -j4 %s > %t.parallel.s
+// RUN: %compiler --stream %s > %t.stream.s
+// RUN: %compiler --stream -j4 %s > %t.pipeline.s
+// RUN: %compiler --single-pass %s > %t.single.s
+// RUN: %compiler --only-reachable %s > %t.reachable.s
+// RUN: %gcc %t.parallel.s -o %t.parallel && %t.parallel | FileCheck %s
+// RUN: %gcc %t.stream.s -o %t.stream && %t.stream | FileCheck %s
+// RUN: %gcc %t.pipeline.s -o %t.pipeline && %t.pipeline | FileCheck %s
+// RUN: %gcc %t.single.s -o %t.single && %t.single | FileCheck %s
+// RUN: %gcc %t.reachable.s -o %t.reachable && %t.reachable | FileCheck %s
+// "define" must be followed by a space
+// RUN: printf '#defineFOO 1\nint main() { return FOO; }\n' > %t.bad.c
+// RUN: not %compiler %t.bad.c 2>&1 | FileCheck --check-prefix=BAD %s
+// BAD: Line 1: Error: Unexpected character
+#define WIDTH 8
+#define HEIGHT (WIDTH * 2 + 1) // Refers to an earlier constant
+#define AREA WIDTH * HEIGHT
+#define NEGATIVE -(AREA % 10)
+#define NEWLINE '\n'
+#define FLAGS (WIDTH > 4) && (HEIGHT != 17) /* false */
+#define WIDE 100
+#define W 1
+#define NOT_NOT !!1
+#define NOT_NOT_ZERO !!0
+#define COMPLEMENT ~~0
+#define NEGATE_NEGATIVE -(-5)
+#define COMPARE 3 < 4 && 4 > 3
+
+// A redefinition applies from where it is, as in C
+#define VERSION 1
+int old_version() {
+    return VERSION;
+}
+#define VERSION 2
+
+int main() {
+    // CHECK: height: 17
+    printf("height: %d\n", HEIGHT);
+
+    // CHECK: area: 136
+    printf("area: %d\n", AREA);
+
+    // CHECK: negative: -6
+    printf("negative: %d\n", NEGATIVE);
+
+    // CHECK: newline: 10
+    printf("newline: %d\n", NEWLINE);
+
+    // CHECK: flags: 0
+    printf("flags: %d\n", FLAGS);
+
+    // A constant whose name is a prefix of another one
+    // CHECK: w: 1 wide: 100
+    printf("w: %d wide: %d\n", W, WIDE);
+
+    // Doubled unary operators
+    // CHECK: not not: 1 0
+    printf("not not: %d %d\n", NOT_NOT, NOT_NOT_ZERO);
+
+    // CHECK: complement: 0
+    printf("complement: %d\n", COMPLEMENT);
+
+    // CHECK: negate: 5
+    printf("negate: %d\n", NEGATE_NEGATIVE);
+
+    // CHECK: compare: 1
+    printf("compare: %d\n", COMPARE);
+
+    // CHECK: version: 1 2
+    printf("version: %d %d\n", old_version(), VERSION);
+
+    return 0;
+}
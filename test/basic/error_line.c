@@ -0,0 +1,15 @@
+// RUN: not %compiler %s 2>&1 | FileCheck %s
+// Line numbers are looked up from the offset of the token when a diagnostic
+// needs them. A constant substituted for a #define is reported on the line
+// where it is used, not where it is defined.
+#define LIMIT 10
+
+/* A comment spanning
+   a few lines
+   before the error */
+int main() {
+    int a = LIMIT;
+
+    // CHECK: Error on line [[@LINE+1]]: Expected ';' after return statement.
+    return a LIMIT;
+}
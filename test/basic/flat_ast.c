@@ -0,0 +1,50 @@
+// RUN: %compiler %s > %t.s
+// RUN: %gcc %t.s -o %t
+// RUN: %t | FileCheck %s
+// RUN: %compiler -j4 %s > %t.parallel.s
+// RUN: cmp %t.s %t.parallel.s
+// The flat AST finds the next sibling of a node one past the node's subtree.
+// Empty bodies, calls nested in arguments and statements following deeply
+// nested subtrees all have to end in the right place.
+int add(int a, int b) {
+    return a + b;
+}
+
+int nothing() {
+    return 0;
+}
+
+int main() {
+    int x = 3;
+    if (x == 3) {
+    }
+    while (x == 0) {
+    }
+    if (x == 4) {
+    } else {
+    }
+
+    // CHECK: nested: 15
+    printf("nested: %d\n", add(add(1, add(2, 3)), add(add(4, 5), nothing())));
+
+    if (x == 3) {
+        while (x != 0) {
+            if (x == 2) {
+                printf("two\n");
+            } else {
+                printf("not two\n");
+            }
+            x = x - 1;
+        }
+        x = 7;
+    }
+    // CHECK: not two
+    // CHECK-NEXT: two
+    // CHECK-NEXT: not two
+    // CHECK-NEXT: after: 7
+    printf("after: %d\n", x);
+
+    // CHECK-NEXT: strings: a b c
+    printf("strings: %s %s %s\n", "a", "b", "c");
+    return add(nothing(), 0);
+}
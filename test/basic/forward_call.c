@@ -0,0 +1,29 @@
+// RUN: %compiler %s > %t.s
+// RUN: %gcc %t.s -o %t
+// RUN: %t | FileCheck %s
+// RUN: %compiler -j2 %s > %t.parallel.s
+// RUN: cmp %t.s %t.parallel.s
+// RUN: %compiler --single-pass %s > %t.single.s
+// RUN: %gcc %t.single.s -o %t.single
+// RUN: %t.single | FileCheck %s
+int main() {
+    printf("%d\n", is_even(10));
+    // CHECK: 1
+    printf("%d\n", is_even(7));
+    // CHECK: 0
+    return 0;
+}
+
+int is_even(int n) {
+    if (n == 0) {
+        return 1;
+    }
+    return is_odd(n - 1);
+}
+
+int is_odd(int n) {
+    if (n == 0) {
+        return 0;
+    }
+    return is_even(n - 1);
+}
@@ -0,0 +1,36 @@
+// RUN: %compiler %s > %t.s
+// RUN: %gcc %t.s -o %t
+// RUN: %t | FileCheck %s
+// RUN: awk 'BEGIN { n = 10000; for (f = 0; f < n; f++) print "int name_" f "(int x_" f ") { return x_" f "; }"; print "int main() {"; print "    int total = 0;"; for (f = 0; f < n; f += 97) print "    total = total + name_" f "(" f ");"; print "    printf(\"total: %%d\\n\", total);"; print "    return 0;"; print "}" }' > %t.many.c
+// RUN: %compiler %t.many.c > %t.many.s
+// RUN: %compiler -j4 %t.many.c > %t.many.parallel.s
+// RUN: cmp %t.many.s %t.many.parallel.s
+// RUN: %gcc %t.many.s -o %t.many
+// RUN: %t.many | FileCheck --check-prefix=MANY %s
+// MANY: total: 519532
+// Names that share a prefix with a keyword or a name the table is seeded
+// with are different names. The generated program adds enough names to fill
+// several pages of entries and grow the slot table, also from several
+// threads at once.
+int mainly(int integer) {
+    return integer + 1;
+}
+
+int printf_twice(int characters) {
+    return characters * 2;
+}
+
+int main() {
+    int iff = 1;
+    int whiles = 2;
+    int returned = 3;
+    int elsewhere = 4;
+    int structure = 5;
+    int in = 6;
+    int cha = 7;
+    // CHECK: keywords: 28
+    printf("keywords: %d\n", iff + whiles + returned + elsewhere + structure + in + cha);
+    // CHECK: seeded: 11
+    printf("seeded: %d\n", mainly(4) + printf_twice(3));
+    return 0;
+}
@@ -0,0 +1,31 @@
+// RUN: awk 'BEGIN { n = 3; for (f = 0; f < n; f++) { print "int step" f "(int x) {"; print "    int i = 0;"; for (k = 0; k < 5; k++) { print "    if (x == " k " || x > 100 && x < 0) {"; print "        printf(\"step" f " case " k "\\n\");"; print "    } else {"; print "        while (i < " k ") { i = i + 1; }"; print "    }" } print "    return i;"; print "}" } print "int main() {"; print "    int total = 0;"; for (f = 0; f < n; f++) print "    total = total + step" f "(" f ");"; print "    printf(\"total: %%d\\n\", total);"; print "    return 0;"; print "}" }' > %t.program.c
+// RUN: %compiler %t.program.c > %t.s
+// RUN: %compiler -j4 %t.program.c > %t.parallel.s
+// RUN: cmp %t.s %t.parallel.s
+// RUN: FileCheck --check-prefix=ASM %s < %t.s
+// RUN: grep '^\.L.*:$' %t.s | sort | uniq -d | wc -l | FileCheck --check-prefix=DUPLICATES %s
+// RUN: %gcc %t.s -o %t
+// RUN: %t | FileCheck %s
+// Labels are numbered per kind across the whole program, and the emitter
+// prints the prefix and the number. Enough of each kind to need two digits.
+// ASM: .LC15:
+// ASM: .LC0:
+// ASM: step0:
+// ASM: .Llogic_short1:
+// ASM: .Llogic_short0:
+// ASM: .Lelse0:
+// ASM: .Lwhile_start0:
+// ASM: .Lif_end0:
+// ASM: step2:
+// ASM: .Llogic_short29:
+// ASM: .Llogic_end28:
+// ASM: .Lelse14:
+// ASM: .Lwhile_start14:
+// ASM: .Lwhile_end14:
+// ASM: .Lif_end14:
+// ASM: main:
+// DUPLICATES: {{^ *}}0
+// CHECK: step0 case 0
+// CHECK: step1 case 1
+// CHECK: step2 case 2
+// CHECK: total: 12
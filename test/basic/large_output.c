@@ -0,0 +1,18 @@
+// RUN: awk 'BEGIN { print "int main() {"; print "    int total = 0;"; for (i = 0; i < 20000; i++) print "    total = total + " i % 7 " * 3;"; print "    printf(\"total: %%d\\n\", total);"; print "    return 0;"; print "}" }' > %t.many.c
+// RUN: %compiler %t.many.c > %t.many.s
+// RUN: test $(wc -c < %t.many.s) -gt 1048576
+// RUN: %compiler %t.many.c | cat > %t.piped.s
+// RUN: cmp %t.many.s %t.piped.s
+// RUN: %compiler --stream %t.many.c > %t.stream.s
+// RUN: %compiler --stream %t.many.c | cat > %t.stream.piped.s
+// RUN: cmp %t.stream.s %t.stream.piped.s
+// RUN: %gcc %t.many.s -o %t.many
+// RUN: %t.many | FileCheck --check-prefix=MANY %s
+// MANY: total: 179991
+// RUN: awk 'BEGIN { s = "y"; while (length(s) < 1100000) s = s s; printf "int main() {\n    printf(\"%%s\\n\");\n    return 0;\n}\n", s }' > %t.string.c
+// RUN: %compiler %t.string.c > %t.string.s
+// RUN: %gcc %t.string.s -o %t.string
+// RUN: %t.string | wc -c | FileCheck --check-prefix=STRING %s
+// STRING: 2097153
+// Assembly larger than the 1 MiB emit buffer, which is written out several
+// times, and a string literal larger than the whole buffer, which bypasses it
@@ -0,0 +1,18 @@
+// RUN: not %compiler %s 2>&1 | FileCheck %s
+// RUN: not %compiler --print-tokens %s 2> %t.err | FileCheck --check-prefix=TOKENS %s
+// RUN: FileCheck --check-prefix=TOKENS-ERROR %s < %t.err
+// Tokens are scanned as the parser needs them, so a syntax error before a
+// lexical error is reported first, and --print-tokens prints the tokens up
+// to the lexical error.
+int main() {
+    int a = 1
+    // CHECK: Error on line [[@LINE+6]]: Expected ';' after variable declaration.
+    // CHECK-NOT: Unexpected character
+    // TOKENS: Token 9: IDENTIFIER 'a'
+    // TOKENS-NEXT: Token 10: =
+    // TOKENS-NEXT: Token 11: IDENTIFIER 'a'
+    // TOKENS-ERROR: Line [[@LINE+1]]: Error: Unexpected character '@'
+    a = a @ 2;
+    // TOKENS-NOT: Token
+    return a;
+}
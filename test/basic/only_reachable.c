@@ -0,0 +1,37 @@
+// RUN: %compiler --only-reachable %s > %t.s
+// RUN: %gcc %t.s -o %t
+// RUN: %t | FileCheck %s
+// A redefined constant keeps its earlier value in the bodies before the
+// redefinition, so such input is parsed whole
+// RUN: printf '#define N 1\nint f() { return N; }\n#define N 2\nint main() { printf("%%%%d %%%%d\\n", f(), N); return 0; }\n' > %t.redefined.c
+// RUN: %compiler --only-reachable %t.redefined.c > %t.redefined.s
+// RUN: %gcc %t.redefined.s -o %t.redefined
+// RUN: %t.redefined | FileCheck --check-prefix=REDEFINED %s
+// REDEFINED: 1 2
+
+// Never called from main, so neither body is parsed or analyzed
+int unused(int a) {
+    return undefined_variable + undefined_function(a);
+}
+
+int leaf(int y) {
+    return y * 2;
+}
+
+int helper(int x) {
+    if (x > 0) {
+        return leaf(x) + 1;
+    }
+    return 0;
+}
+
+int also_unused() {
+    { { } }
+    return 1 +;
+}
+
+int main() {
+    // CHECK: helper: 7
+    printf("helper: %d\n", helper(3));
+    return 0;
+}
@@ -0,0 +1,47 @@
+// RUN: %compiler %s > %t.serial.s
+// RUN: %compiler -j4 %s > %t.s
+// RUN: cmp %t.serial.s %t.s
+// RUN: %gcc %t.s -o %t
+// RUN: %t | FileCheck %s
+int sign(int x) {
+    if (x < 0) {
+        printf("negative\n");
+        return 0 - 1;
+    } else {
+        printf("not negative\n");
+    }
+    return 0;
+}
+
+int count_down(int n) {
+    int steps = 0;
+    while (n > 0 && steps < 100) {
+        n = n - 1;
+        steps = steps + 1;
+    }
+    printf("steps %d\n", steps);
+    return steps;
+}
+
+int either(int a, int b) {
+    if (a || b) {
+        printf("either\n");
+        return 1;
+    }
+    printf("neither\n");
+    return 0;
+}
+
+int main() {
+    sign(0 - 5);
+    // CHECK: negative
+    sign(3);
+    // CHECK: not negative
+    count_down(7);
+    // CHECK: steps 7
+    either(0, 1);
+    // CHECK: either
+    either(0, 0);
+    // CHECK: neither
+    return 0;
+}
@@ -0,0 +1,24 @@
+// RUN: %compiler -j4 %s > %t.s
+// RUN: %compiler %s > %t.serial.s
+// RUN: cmp %t.serial.s %t.s
+// RUN: %gcc %t.s -o %t
+// RUN: %t | FileCheck %s
+#define OPEN '{'
+#define CLOSE '}'
+
+/* The braces in comments, strings and character literals do not open or
+   close blocks { { */
+int braces() {
+    // }
+    printf("{ \" } }\n");
+    return CLOSE - OPEN;
+}
+
+int main() {
+    printf("%d\n", braces());
+    // CHECK: { " } }
+    // CHECK: 2
+    printf("/* } */\n");
+    // CHECK: /* } */
+    return 0;
+}
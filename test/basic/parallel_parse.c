@@ -0,0 +1,36 @@
+// RUN: %compiler -j4 %s > %t.s
+// RUN: %compiler %s > %t.serial.s
+// RUN: cmp %t.serial.s %t.s
+// RUN: %compiler -j4 --print-ast %s > %t.ast
+// RUN: %compiler --print-ast %s > %t.serial.ast
+// RUN: cmp %t.serial.ast %t.ast
+// RUN: %gcc %t.s -o %t
+// RUN: %t | FileCheck %s
+#define BASE 10
+int before() {
+    int SCALE = 3;
+    return BASE + SCALE;
+}
+
+// A define only applies to the code after it, also when the bodies are
+// parsed separately
+#define SCALE 4
+int after() {
+    return BASE * SCALE;
+}
+
+int inner() {
+    int OFFSET = 1;
+#define OFFSET 100
+    return OFFSET + 5;
+}
+
+int main() {
+    printf("%d\n", before());
+    // CHECK: 13
+    printf("%d\n", after());
+    // CHECK: 40
+    printf("%d\n", inner());
+    // CHECK: 105
+    return 0;
+}
@@ -0,0 +1,29 @@
+// RUN: %compiler --stream -j4 %s > %t.s
+// RUN: %compiler --stream %s > %t.serial.s
+// RUN: cmp %t.serial.s %t.s
+// RUN: %gcc %t.s -o %t
+// RUN: %t | FileCheck %s
+// More functions than the pipeline holds at once, with labels and strings
+// numbered across all of them
+int f1(int x) { if (x > 0) { return x; } return 0 - x; }
+int f2(int x) { return f1(x) + 1; }
+int f3(int x) { printf("f3\n"); return f2(x) * 2; }
+int f4(int x) { while (x > 10) { x = x - 10; } return x; }
+int f5(int x) { return f4(x) + f3(x); }
+int f6(int x) { printf("f6\n"); return f5(x) - 1; }
+int f7(int x) { if (x == 7) { return 70; } return f6(x); }
+int f8(int x) { return f7(x) + f1(x); }
+int f9(int x) { printf("f9\n"); return f8(x) * 3; }
+int f10(int x) { return f9(x) + f10_helper(x); }
+int f10_helper(int x) { while (x > 0) { x = x - 1; } return x; }
+
+int main() {
+    // CHECK: f9
+    // CHECK: f6
+    // CHECK: f3
+    // CHECK: 219
+    printf("%d\n", f10(23));
+    // CHECK: 231
+    printf("%d\n", f10(7));
+    return 0;
+}
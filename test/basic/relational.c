@@ -0,0 +1,52 @@
+// RUN: %compiler %s > %t.s
+// RUN: %gcc %t.s -o %t
+// RUN: %t | FileCheck %s
+
+int side_effect(int value) {
+    printf("side effect %d\n", value);
+    return value;
+}
+
+int main() {
+    int a = 3;
+    int b = 5;
+
+    // CHECK: less: 1 0 0
+    printf("less: %d %d %d\n", a < b, b < a, a < a);
+
+    // CHECK: less_equal: 1 0 1
+    printf("less_equal: %d %d %d\n", a <= b, b <= a, a <= a);
+
+    // CHECK: greater: 0 1 0
+    printf("greater: %d %d %d\n", a > b, b > a, a > a);
+
+    // CHECK: greater_equal: 0 1 1
+    printf("greater_equal: %d %d %d\n", a >= b, b >= a, a >= a);
+
+    // CHECK: precedence: 1
+    printf("precedence: %d\n", a + 1 * 2 < b + 1 == 1);
+
+    // CHECK: logical: 1 0 1 0
+    printf("logical: %d %d %d %d\n", a < b && b > 0, a > b && b > 0,
+           a > b || b == 5, a > b || b != 5);
+
+    // && binds tighter than ||
+    // CHECK: mixed: 1
+    printf("mixed: %d\n", 1 || 0 && 0);
+
+    // The right operand is only evaluated when needed
+    // CHECK-NOT: side effect 1
+    // CHECK: short_and: 0
+    printf("short_and: %d\n", 0 && side_effect(1));
+
+    // CHECK: side effect 2
+    // CHECK: short_or: 1
+    printf("short_or: %d\n", 0 || side_effect(2));
+
+    if (a < b && b <= 5) {
+        // CHECK: in range
+        printf("in range\n");
+    }
+
+    return 0;
+}
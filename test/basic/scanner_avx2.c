@@ -0,0 +1,8 @@
+// RUN: %compiler --print-tokens --scanner scalar %S/scanner_boundaries.c > %t.scalar
+// RUN: %compiler --print-tokens --scanner avx2 %S/scanner_boundaries.c > %t.avx2
+// RUN: cmp %t.scalar %t.avx2
+// RUN: %compiler --scanner avx2 %S/scanner_boundaries.c > %t.s
+// RUN: %gcc %t.s -o %t
+// RUN: %t | FileCheck %S/scanner_boundaries.c
+// REQUIRES: avx2
+// The AVX2 scanner on the block boundaries of scanner_boundaries.c
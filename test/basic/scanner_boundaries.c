@@ -0,0 +1,103 @@
+// RUN: %compiler --print-tokens --scanner scalar %s > %t.scalar
+// RUN: %compiler --print-tokens --scanner sse2 %s > %t.sse2
+// RUN: cmp %t.scalar %t.sse2
+// RUN: %compiler --scanner sse2 %s > %t.s
+// RUN: %gcc %t.s -o %t
+// RUN: %t | FileCheck %s
+// REQUIRES: x86_64
+// Every scan below ends 15, 16, 17, 31, 32 or 33 bytes after it starts, so
+// just before, on and just after the SIMD scanners' block boundaries. A scan
+// that runs past its end swallows the statement after it. The AVX2 scanner is
+// checked on this file by scanner_avx2.c.
+
+int main() {
+    int count = 0;
+
+    // Block comments, the '*' of "*/" at each offset, so at 15 and 31 the
+    // "*/" is split across a boundary
+    /*...............*/ count = count + 1;
+    /*................*/ count = count + 1;
+    /*.................*/ count = count + 1;
+    /*...............................*/ count = count + 1;
+    /*................................*/ count = count + 1;
+    /*.................................*/ count = count + 1;
+    // A '*' and a '/' that are not "*/", on either side of a boundary
+    /*...............*................/....*/ count = count + 1;
+
+    // Line comments, the newline at each offset
+    //---------------
+    count = count + 1;
+    //----------------
+    count = count + 1;
+    //-----------------
+    count = count + 1;
+    //-------------------------------
+    count = count + 1;
+    //--------------------------------
+    count = count + 1;
+    //---------------------------------
+    count = count + 1;
+    // CHECK: count: 13
+    printf("count: %d\n", count);
+
+    // Identifiers, the scan starts after the first character
+    int v15_xxxxxxxxxxxx = 15;
+    int v16_xxxxxxxxxxxxx = 16;
+    int v17_xxxxxxxxxxxxxx = 17;
+    int v31_xxxxxxxxxxxxxxxxxxxxxxxxxxxx = 31;
+    int v32_xxxxxxxxxxxxxxxxxxxxxxxxxxxxx = 32;
+    int v33_xxxxxxxxxxxxxxxxxxxxxxxxxxxxxx = 33;
+
+    // Whitespace, the newline and the indentation
+    int total = 0;
+    total = total +
+              v15_xxxxxxxxxxxx;
+    total = total +
+               v16_xxxxxxxxxxxxx;
+    total = total +
+                v17_xxxxxxxxxxxxxx;
+    total = total +
+                              v31_xxxxxxxxxxxxxxxxxxxxxxxxxxxx;
+    total = total +
+                               v32_xxxxxxxxxxxxxxxxxxxxxxxxxxxxx;
+    total = total +
+                                v33_xxxxxxxxxxxxxxxxxxxxxxxxxxxxxx;
+    // CHECK-NEXT: total: 144
+    printf("total: %d\n", total);
+
+    // Strings, the backslash at each offset
+    // CHECK-NEXT: {{^}}sssssssssssssss{{$}}
+    printf("sssssssssssssss\n");
+    // CHECK-NEXT: {{^}}ssssssssssssssss{{$}}
+    printf("ssssssssssssssss\n");
+    // CHECK-NEXT: {{^}}sssssssssssssssss{{$}}
+    printf("sssssssssssssssss\n");
+    // CHECK-NEXT: {{^}}sssssssssssssssssssssssssssssss{{$}}
+    printf("sssssssssssssssssssssssssssssss\n");
+    // CHECK-NEXT: {{^}}ssssssssssssssssssssssssssssssss{{$}}
+    printf("ssssssssssssssssssssssssssssssss\n");
+    // CHECK-NEXT: {{^}}sssssssssssssssssssssssssssssssss{{$}}
+    printf("sssssssssssssssssssssssssssssssss\n");
+    // Strings, the closing quote at each offset after an escape
+    // CHECK-NEXT: {{^.}}qqqqqqqqqqqqqqq{{$}}
+    printf("\tqqqqqqqqqqqqqqq");
+    printf("\n");
+    // CHECK-NEXT: {{^.}}qqqqqqqqqqqqqqqq{{$}}
+    printf("\tqqqqqqqqqqqqqqqq");
+    printf("\n");
+    // CHECK-NEXT: {{^.}}qqqqqqqqqqqqqqqqq{{$}}
+    printf("\tqqqqqqqqqqqqqqqqq");
+    printf("\n");
+    // CHECK-NEXT: {{^.}}qqqqqqqqqqqqqqqqqqqqqqqqqqqqqqq{{$}}
+    printf("\tqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqq");
+    printf("\n");
+    // CHECK-NEXT: {{^.}}qqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqq{{$}}
+    printf("\tqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqq");
+    printf("\n");
+    // CHECK-NEXT: {{^.}}qqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqq{{$}}
+    printf("\tqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqq");
+    printf("\n");
+    return 0;
+}
+// A block comment ending less than a block before the end of the input
+/*....................*/
@@ -0,0 +1,51 @@
+// RUN: %compiler %s > %t.s
+// RUN: %gcc %t.s -o %t
+// RUN: %t | FileCheck %s
+// RUN: printf 'int main() {\n    int a = 1;\n    if (a == 1) {\n        int b = 2;\n        int b = 3;\n    }\n    return 0;\n}\n' > %t.redeclared.c
+// RUN: not %compiler %t.redeclared.c 2>&1 | FileCheck --check-prefix=REDECLARED %s
+// REDECLARED: Error: Variable b already declared in current scope
+// A block may shadow a variable of an enclosing scope, which is visible again
+// once the block ends. Only a second declaration in the same scope is an
+// error.
+int shadow_parameter(int a) {
+    if (a > 0) {
+        int a = 100;
+        return a;
+    }
+    return a;
+}
+
+int main() {
+    int x = 1;
+    if (x == 1) {
+        int x = 2;
+        int i = 0;
+        while (i < 2) {
+            int x = 10 + i;
+            // CHECK: loop: 10
+            // CHECK: loop: 11
+            printf("loop: %d\n", x);
+            i = i + 1;
+        }
+        // CHECK: if: 2
+        printf("if: %d\n", x);
+    }
+    // CHECK: main: 1
+    printf("main: %d\n", x);
+
+    // Sibling blocks declare the same name
+    if (x == 1) {
+        int y = 5;
+        // CHECK: first: 5
+        printf("first: %d\n", y);
+    }
+    if (x == 1) {
+        int y = 6;
+        // CHECK: second: 6
+        printf("second: %d\n", y);
+    }
+
+    // CHECK: parameter: 100 -3
+    printf("parameter: %d %d\n", shadow_parameter(1), shadow_parameter(0 - 3));
+    return 0;
+}
@@ -0,0 +1,30 @@
+// RUN: %compiler --single-pass %s > %t.s
+// RUN: %gcc %t.s -o %t
+// RUN: %t | FileCheck %s
+int scale(int value, int factor) {
+    int result = value * factor;
+    return result;
+}
+
+int main() {
+    int a = 1;
+    int b = 2;
+    if (a < b) {
+        int a = 10;
+        b = a + b;
+    } else {
+        int c = 5;
+        b = c;
+    }
+    // CHECK: a: 1 b: 12
+    printf("a: %d b: %d\n", a, b);
+
+    while (a < 4) {
+        int step = scale(a, 2);
+        a = a + 1;
+        b = b + step;
+    }
+    // CHECK: a: 4 b: 24
+    printf("a: %d b: %d\n", a, b);
+    return 0;
+}
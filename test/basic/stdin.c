@@ -0,0 +1,14 @@
+// RUN: cat %s | %compiler - > %t.s
+// RUN: %gcc %t.s -o %t
+// RUN: %t | FileCheck %s
+int main() {
+    int total = 0;
+    int i = 0;
+    while (i < 5) {
+        i = i + 1;
+        total = total + i;
+    }
+    // CHECK: total: 15
+    printf("total: %d\n", total);
+    return 0;
+}
@@ -0,0 +1,24 @@
+// RUN: %compiler --stream %s > %t.s
+// RUN: %gcc %t.s -o %t
+// RUN: %t | FileCheck %s
+int square(int x) {
+    return x * x;
+}
+
+int sum_squares(int n) {
+    int total = 0;
+    int i = 1;
+    while (i < n + 1) {
+        total = total + square(i);
+        i = i + 1;
+    }
+    return total;
+}
+
+int main() {
+    // CHECK: square: 49
+    printf("square: %d\n", square(7));
+    // CHECK: sum: 55
+    printf("sum: %d\n", sum_squares(5));
+    return 0;
+}
@@ -0,0 +1,25 @@
+// RUN: %compiler %s > %t.s
+// RUN: %gcc %t.s -o %t
+// RUN: %t | FileCheck %s
+// RUN: awk 'BEGIN { s = "x"; while (length(s) < 70000) s = s s; printf "int main() { printf(\"%%s\\n\"); return 0; }\n", s }' > %t.long.c
+// RUN: %compiler %t.long.c > %t.long.s
+// RUN: %gcc %t.long.s -o %t.long
+// RUN: %t.long | wc -c | FileCheck --check-prefix=LONG %s
+// LONG: 131073
+// Tokens keep a 16-bit length. Longer tokens and substituted constants keep
+// their length and value in the lexer's side table, which only holds the
+// latest few of them.
+#define ONE 1
+#define TWO 2
+#define THREE 3
+#define FOUR 4
+#define FIVE 5
+#define SIX 6
+
+int main() {
+    // CHECK: sum: 21
+    printf("sum: %d\n", ONE + TWO + THREE + FOUR + FIVE + SIX);
+    // CHECK: mixed: 12
+    printf("mixed: %d\n", SIX * FIVE / THREE + ONE * FOUR - TWO);
+    return 0;
+}
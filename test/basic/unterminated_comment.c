@@ -0,0 +1,10 @@
+// RUN: not %compiler %s 2>&1 | FileCheck %s
+// An unterminated block comment is reported on the line where it starts
+int main() {
+    return 0;
+}
+
+// CHECK: Line [[@LINE+1]]: Error: Unterminated multi-line comment
+/* This comment
+   is never
+   closed
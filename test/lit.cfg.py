@@ -15,5 +15,16 @@ config.substitutions.append(('%gcc', 'gcc'))
 # Features
 config.available_features.add('shell')
 
+# The SIMD scanners of the lexer can be forced with --scanner
+import platform
+if platform.machine() == 'x86_64':
+    config.available_features.add('x86_64')
+    try:
+        with open('/proc/cpuinfo') as cpuinfo:
+            if ' avx2' in cpuinfo.read():
+                config.available_features.add('avx2')
+    except OSError:
+        pass
+
 # Tell lit where to find the test files
 config.suffixes = ['.c']  # Look for .c files instead of .test files
\ No newline at end of file